@@ -0,0 +1,60 @@
+#include "AccumulationBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glm/geometric.hpp>
+
+namespace {
+	float luminance(glm::vec3 colour) {
+		return glm::dot(colour, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	// Errors are relative to the brightness, but not below this so that
+	// noise in nearly black pixels isn't blown out of proportion
+	const float MIN_ERROR_SCALE = 0.05f;
+}
+
+void AccumulationBuffer::initialize(int width, int height) {
+	bufferWidth = width;
+	bufferHeight = height;
+	pixels.assign(width*height, Pixel());
+}
+
+void AccumulationBuffer::add(int x, int y, glm::vec3 colour, SurfaceFeatures const &features) {
+	Pixel &p = pixels[y*bufferWidth + x];
+	p.count++;
+	p.mean += (colour - p.mean) / float(p.count);
+	p.features.albedo += (features.albedo - p.features.albedo) / float(p.count);
+	p.features.normal += (features.normal - p.features.normal) / float(p.count);
+	p.features.depth += (features.depth - p.features.depth) / float(p.count);
+
+	float l = luminance(colour);
+	float delta = l - p.luminanceMean;
+	p.luminanceMean += delta / float(p.count);
+	p.luminanceM2 += delta*(l - p.luminanceMean);
+}
+
+float AccumulationBuffer::varianceOfMean(int x, int y) const {
+	Pixel const &p = pixels[y*bufferWidth + x];
+	if (p.count < 2) {
+		return std::numeric_limits<float>::infinity();
+	}
+	float variance = p.luminanceM2 / float(p.count - 1);
+	return variance / float(p.count);
+}
+
+float AccumulationBuffer::relativeError(int x, int y) const {
+	Pixel const &p = pixels[y*bufferWidth + x];
+	float standardError = std::sqrt(varianceOfMean(x, y));
+	return standardError / std::max(p.luminanceMean, MIN_ERROR_SCALE);
+}
+
+void AccumulationBuffer::resolve(Tile const &tile, glm::vec3* colours) const {
+	for (int y = 0, k = 0; y < tile.height; y++) {
+		for (int x = 0; x < tile.width; x++, k++) {
+			colours[k] = mean(tile.x + x, tile.y + y);
+		}
+	}
+}
@@ -0,0 +1,78 @@
+//------------------------------------------------------------------------------
+// Running per-pixel statistics of samples, for progressive rendering.
+//
+// Every pass of the renderer adds more samples to each pixel, and the image
+// shown is the mean so far. That keeps refining instead of starting over, so
+// a first rough image is up quickly and gets better for as long as we let it.
+//
+// Besides the mean, the variance of each pixel's brightness is tracked (with
+// Welford's algorithm, which stays accurate over many samples). From it we
+// can tell how far a pixel's mean probably still is from converging, and
+// stop sampling the ones that are close enough.
+//
+// Each sample also brings the features of the surface its camera ray hit,
+// whose means are kept as well for the denoiser (see Denoiser.h).
+//
+// Tiles don't overlap, so different threads can each add to their own tile
+// without any locking.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+#include <glm/vec3.hpp>
+
+#include "TileScheduler.h"
+
+// What the camera ray of a sample hit, besides its colour. All 0 for rays
+// that hit nothing.
+struct SurfaceFeatures {
+	// How much of the light reaching the surface it reflects, ignoring the
+	// light itself
+	glm::vec3 albedo = glm::vec3(0);
+	// Unit normal facing the camera
+	glm::vec3 normal = glm::vec3(0);
+	// Distance from the camera
+	float depth = 0;
+};
+
+class AccumulationBuffer {
+public:
+	// Allocates a width x height buffer with no samples
+	void initialize(int width, int height);
+
+	int width() const { return bufferWidth; }
+	int height() const { return bufferHeight; }
+
+	// Adds one sample to pixel (x, y)
+	void add(int x, int y, glm::vec3 colour, SurfaceFeatures const &features = SurfaceFeatures());
+
+	int samples(int x, int y) const { return pixels[y*bufferWidth + x].count; }
+	glm::vec3 mean(int x, int y) const { return pixels[y*bufferWidth + x].mean; }
+	// The mean of the features of the pixel's samples
+	SurfaceFeatures const &features(int x, int y) const { return pixels[y*bufferWidth + x].features; }
+
+	// Estimated variance of the pixel's mean brightness. Infinite until there
+	// are 2 samples.
+	float varianceOfMean(int x, int y) const;
+
+	// Estimated error of the pixel's mean brightness (the standard error),
+	// relative to that brightness. Infinite until there are 2 samples.
+	float relativeError(int x, int y) const;
+
+	// The mean of every pixel of the tile, row by row, bottom row first
+	void resolve(Tile const &tile, glm::vec3* colours) const;
+
+private:
+	struct Pixel {
+		glm::vec3 mean = glm::vec3(0);
+		float luminanceMean = 0.f;
+		// Sum of squared differences from the mean luminance
+		float luminanceM2 = 0.f;
+		SurfaceFeatures features;
+		int count = 0;
+	};
+
+	int bufferWidth = 0;
+	int bufferHeight = 0;
+	std::vector<Pixel> pixels;
+};
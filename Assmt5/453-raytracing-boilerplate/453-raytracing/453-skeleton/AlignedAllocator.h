@@ -0,0 +1,37 @@
+//------------------------------------------------------------------------------
+// std::allocator replacement that aligns every allocation, by default to a
+// cache line. Arrays read by the SIMD kernels use it so aligned loads are
+// safe and a vector never straddles two cache lines.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+template <class T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+	typedef T value_type;
+
+	template <class U>
+	struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() = default;
+	template <class U>
+	AlignedAllocator(AlignedAllocator<U, Alignment> const &) {}
+
+	T* allocate(std::size_t n) {
+		return static_cast<T*>(::operator new(n*sizeof(T), std::align_val_t(Alignment)));
+	}
+	void deallocate(T* p, std::size_t) {
+		::operator delete(p, std::align_val_t(Alignment));
+	}
+
+	template <class U>
+	bool operator==(AlignedAllocator<U, Alignment> const &) const { return true; }
+	template <class U>
+	bool operator!=(AlignedAllocator<U, Alignment> const &) const { return false; }
+};
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
@@ -0,0 +1,528 @@
+#include "BVH.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "Instance.h"
+#include "Log.h"
+#include "RayStatistics.h"
+
+namespace {
+	// Leaves are never made bigger than this, and never smaller unless the
+	// surface area heuristic says splitting further doesn't pay off.
+	const int MAX_LEAF_SIZE = 4;
+	const int SAH_BINS = 12;
+	// Relative cost of visiting a node vs testing a primitive
+	const float TRAVERSAL_COST = 1.f;
+	// Past this depth only median splits are made, which keeps the tree
+	// shallow enough for the fixed size traversal stack
+	const int MAX_SAH_DEPTH = 64;
+	const int TRAVERSAL_STACK_SIZE = 128;
+
+	vec3 safeInverse(vec3 d) {
+		// Avoid 0 * inf = NaN in the slab test for axis aligned rays
+		const float tiny = 1e-20f;
+		return vec3(
+			1.f/(std::abs(d.x) > tiny ? d.x : std::copysign(tiny, d.x)),
+			1.f/(std::abs(d.y) > tiny ? d.y : std::copysign(tiny, d.y)),
+			1.f/(std::abs(d.z) > tiny ? d.z : std::copysign(tiny, d.z))
+		);
+	}
+
+	// The range check every Shape::hitPrimitive() makes
+	bool acceptHit(float t, float tMin, float tMax, int primitive, Hit &hit) {
+		if (t == 0 || t <= tMin || t >= tMax) {
+			return false;
+		}
+		hit.t = t;
+		hit.primitive = primitive;
+		return true;
+	}
+
+	// Whether the arrays make a tree over shapes that traversal can walk
+	// without reading outside them or overflowing its stack: every child is
+	// a later node reached only once, every leaf's primitives are in the
+	// array, and every primitive is one of an existing shape.
+	bool isWalkable(std::vector<std::shared_ptr<Shape>> const &shapes,
+			BVH::Node const* nodes, int nodeCount, BVH::PrimitiveRef const* primitives, int primitiveCount) {
+		for (int i = 0; i < primitiveCount; i++) {
+			BVH::PrimitiveRef const &ref = primitives[i];
+			if (ref.shape < 0 || ref.shape >= int(shapes.size())
+				|| ref.primitive < 0 || ref.primitive >= shapes[ref.shape]->primitiveCount()) {
+				return false;
+			}
+		}
+		if (nodeCount == 0) {
+			return true;
+		}
+
+		struct Pending {
+			int node;
+			int depth;
+		};
+		std::vector<Pending> pending{ { 0, 0 } };
+		std::vector<bool> reached(nodeCount, false);
+		while (!pending.empty()) {
+			Pending current = pending.back();
+			pending.pop_back();
+			if (reached[current.node]) {
+				return false;
+			}
+			reached[current.node] = true;
+
+			BVH::Node const &node = nodes[current.node];
+			if (node.primitiveCount > 0) {
+				if (node.firstPrimitive < 0 || int64_t(node.firstPrimitive) + node.primitiveCount > primitiveCount) {
+					return false;
+				}
+				continue;
+			}
+			// Traversal holds one node per level above this one, plus both
+			// children once it's been visited
+			if (node.axis < 0 || node.axis > 2 || current.depth + 2 > TRAVERSAL_STACK_SIZE
+				|| current.node + 1 >= nodeCount
+				|| node.secondChild <= current.node + 1 || node.secondChild >= nodeCount) {
+				return false;
+			}
+			pending.push_back({ node.secondChild, current.depth + 1 });
+			pending.push_back({ current.node + 1, current.depth + 1 });
+		}
+		return true;
+	}
+}
+
+void BVH::setShapes(std::vector<std::shared_ptr<Shape>> const &shapes) {
+	this->shapes.clear();
+	entries.clear();
+	spheres.clear();
+	planes.clear();
+	meshes.clear();
+	instances.clear();
+	others.clear();
+	unbounded.clear();
+	for (auto const &shape : shapes) {
+		ShapeEntry entry{ ShapeKind::Other, 0, shape->id, shape->castsShadows };
+		if (auto triangles = dynamic_cast<Triangles*>(shape.get())) {
+			entry.kind = ShapeKind::Triangles;
+			entry.index = int(meshes.size());
+			meshes.push_back(triangles->mesh.get());
+		}
+		else if (auto sphere = dynamic_cast<Sphere*>(shape.get())) {
+			entry.kind = ShapeKind::Sphere;
+			entry.index = int(spheres.size());
+			spheres.push_back(PackedSphere{ sphere->centre, sphere->radius });
+		}
+		else if (auto plane = dynamic_cast<Plane*>(shape.get())) {
+			entry.kind = ShapeKind::Plane;
+			entry.index = int(planes.size());
+			planes.push_back(PackedPlane{ plane->point, plane->normal });
+		}
+		else if (auto instance = dynamic_cast<Instance*>(shape.get())) {
+			entry.kind = ShapeKind::Instance;
+			entry.index = int(instances.size());
+			instances.push_back(instance);
+		}
+		else {
+			entry.index = int(others.size());
+			others.push_back(shape.get());
+		}
+		if (!shape->isBounded()) {
+			unbounded.push_back(PrimitiveRef{ int(this->shapes.size()), 0 });
+		}
+		this->shapes.push_back(shape.get());
+		entries.push_back(entry);
+	}
+}
+
+void BVH::build(std::vector<std::shared_ptr<Shape>> const &shapes) {
+	setShapes(shapes);
+	borrowedFrom.reset();
+	ownNodes.clear();
+	ownPrimitives.clear();
+
+	std::vector<BuildPrimitive> build;
+	for (int s = 0; s < int(shapes.size()); s++) {
+		Shape const &shape = *shapes[s];
+		if (!shape.isBounded()) {
+			continue;
+		}
+		for (int i = 0; i < shape.primitiveCount(); i++) {
+			BuildPrimitive p;
+			p.bounds = shape.primitiveBounds(i);
+			p.centre = p.bounds.centre();
+			p.ref = PrimitiveRef{ s, i };
+			build.push_back(p);
+		}
+	}
+
+	if (!build.empty()) {
+		// A binary tree with at least one primitive per leaf never has
+		// more than 2n - 1 nodes
+		ownNodes.reserve(2*build.size() - 1);
+		ownPrimitives.reserve(build.size());
+		buildRecursive(build, 0, int(build.size()), 0);
+	}
+	nodes = ownNodes.data();
+	nodesSize = int(ownNodes.size());
+	primitives = ownPrimitives.data();
+	primitivesSize = int(ownPrimitives.size());
+
+	Log::debug("BVH built over {} primitives ({} unbounded shapes), {} nodes",
+		primitivesSize, unbounded.size(), nodesSize);
+}
+
+bool BVH::borrow(std::vector<std::shared_ptr<Shape>> const &shapes,
+		Node const* nodes, int nodeCount, PrimitiveRef const* primitives, int primitiveCount,
+		std::shared_ptr<const void> owner) {
+	if (!isWalkable(shapes, nodes, nodeCount, primitives, primitiveCount)) {
+		return false;
+	}
+	setShapes(shapes);
+	ownNodes = std::vector<Node>();
+	ownPrimitives = std::vector<PrimitiveRef>();
+	this->nodes = nodes;
+	nodesSize = nodeCount;
+	this->primitives = primitives;
+	primitivesSize = primitiveCount;
+	borrowedFrom = owner;
+	return true;
+}
+
+int BVH::buildRecursive(std::vector<BuildPrimitive> &build, int start, int end, int depth) {
+	int nodeIndex = int(ownNodes.size());
+	ownNodes.push_back(Node{});
+
+	AABB bounds, centreBounds;
+	for (int i = start; i < end; i++) {
+		bounds.extend(build[i].bounds);
+		centreBounds.extend(build[i].centre);
+	}
+	ownNodes[nodeIndex].bounds = bounds;
+
+	int count = end - start;
+	auto makeLeaf = [&]() {
+		ownNodes[nodeIndex].firstPrimitive = int(ownPrimitives.size());
+		ownNodes[nodeIndex].primitiveCount = count;
+		ownNodes[nodeIndex].secondChild = -1;
+		ownNodes[nodeIndex].axis = 0;
+		for (int i = start; i < end; i++) {
+			ownPrimitives.push_back(build[i].ref);
+		}
+		return nodeIndex;
+	};
+
+	if (count == 1) {
+		return makeLeaf();
+	}
+
+	// Split along the axis where the primitive centres are most spread out
+	vec3 extent = centreBounds.extent();
+	int axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	int mid = start;
+	if (extent[axis] <= 0.f || depth >= MAX_SAH_DEPTH) {
+		// All centres coincide (nothing to gain from the heuristic) or the
+		// tree is already deep
+		if (count <= MAX_LEAF_SIZE) {
+			return makeLeaf();
+		}
+		mid = start + count/2;
+		std::nth_element(build.begin() + start, build.begin() + mid, build.begin() + end,
+			[&](BuildPrimitive const &a, BuildPrimitive const &b) { return a.centre[axis] < b.centre[axis]; });
+	}
+	else {
+		// Binned surface area heuristic: drop the centres into buckets
+		// along the axis and pick the bucket boundary with the lowest cost
+		struct Bin {
+			AABB bounds;
+			int count = 0;
+		};
+		Bin bins[SAH_BINS];
+		float scale = SAH_BINS/extent[axis];
+		auto binIndex = [&](vec3 const &c) {
+			int b = int((c[axis] - centreBounds.min[axis])*scale);
+			return std::min(std::max(b, 0), SAH_BINS - 1);
+		};
+		for (int i = start; i < end; i++) {
+			Bin &bin = bins[binIndex(build[i].centre)];
+			bin.count++;
+			bin.bounds.extend(build[i].bounds);
+		}
+
+		// Sweep from the right to get the cost of every right hand side,
+		// then from the left to combine it with the left hand side
+		float rightArea[SAH_BINS];
+		int rightCount[SAH_BINS];
+		AABB accumulated;
+		int accumulatedCount = 0;
+		for (int b = SAH_BINS - 1; b > 0; b--) {
+			accumulated.extend(bins[b].bounds);
+			accumulatedCount += bins[b].count;
+			rightArea[b] = accumulated.surfaceArea();
+			rightCount[b] = accumulatedCount;
+		}
+
+		float bestCost = std::numeric_limits<float>::max();
+		int bestSplit = -1;
+		accumulated = AABB();
+		accumulatedCount = 0;
+		for (int b = 1; b < SAH_BINS; b++) {
+			accumulated.extend(bins[b - 1].bounds);
+			accumulatedCount += bins[b - 1].count;
+			if (accumulatedCount == 0 || rightCount[b] == 0) continue;
+			float cost = accumulated.surfaceArea()*accumulatedCount + rightArea[b]*rightCount[b];
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+
+		float leafCost = bounds.surfaceArea()*count;
+		float splitCost = TRAVERSAL_COST*bounds.surfaceArea() + bestCost;
+		if (count <= MAX_LEAF_SIZE && (bestSplit < 0 || leafCost <= splitCost)) {
+			return makeLeaf();
+		}
+
+		if (bestSplit >= 0) {
+			auto split = std::partition(build.begin() + start, build.begin() + end,
+				[&](BuildPrimitive const &p) { return binIndex(p.centre) < bestSplit; });
+			mid = int(split - build.begin());
+		}
+		if (mid == start || mid == end) {
+			// The bins couldn't separate the primitives, fall back to a median split
+			mid = start + count/2;
+			std::nth_element(build.begin() + start, build.begin() + mid, build.begin() + end,
+				[&](BuildPrimitive const &a, BuildPrimitive const &b) { return a.centre[axis] < b.centre[axis]; });
+		}
+	}
+
+	ownNodes[nodeIndex].primitiveCount = 0;
+	ownNodes[nodeIndex].axis = axis;
+	buildRecursive(build, start, mid, depth + 1);
+	int second = buildRecursive(build, mid, end, depth + 1);
+	ownNodes[nodeIndex].secondChild = second;
+	return nodeIndex;
+}
+
+inline bool BVH::hitPrimitive(ShapeEntry const &entry, Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const {
+	switch (entry.kind) {
+	case ShapeKind::Triangles: {
+		float u, v;
+		float t = meshes[entry.index]->intersect(ray, primitive, u, v);
+		if (!acceptHit(t, tMin, tMax, primitive, hit)) {
+			return false;
+		}
+		hit.u = u;
+		hit.v = v;
+		return true;
+	}
+	case ShapeKind::Sphere: {
+		PackedSphere const &sphere = spheres[entry.index];
+		return acceptHit(intersectSphere(sphere.centre, sphere.radius, ray), tMin, tMax, primitive, hit);
+	}
+	case ShapeKind::Plane: {
+		PackedPlane const &plane = planes[entry.index];
+		return acceptHit(intersectPlane(plane.point, plane.normal, ray), tMin, tMax, primitive, hit);
+	}
+	case ShapeKind::Instance:
+		// Qualified, so it's a direct call
+		return instances[entry.index]->Instance::hitPrimitive(ray, primitive, tMin, tMax, hit);
+	case ShapeKind::Other:
+		break;
+	}
+	return others[entry.index]->hitPrimitive(ray, primitive, tMin, tMax, hit);
+}
+
+template <bool anyHit, bool shadowCastersOnly>
+Hit BVH::traverse(Ray const &ray, int skipID, float tMin, float tMax) const {
+	Hit closest;
+	TraversalCounters &counters = threadTraversalCounters();
+	counters.rayQueries++;
+
+	auto consider = [&](PrimitiveRef const &ref) {
+		ShapeEntry const &entry = entries[ref.shape];
+		if (entry.id == skipID || (shadowCastersOnly && !entry.castsShadows)) {
+			return false;
+		}
+		counters.primitiveTests++;
+		if (hitPrimitive(entry, ray, ref.primitive, tMin, tMax, closest)) {
+			closest.shape = shapeOf(ref);
+			tMax = closest.t;
+			return true;
+		}
+		return false;
+	};
+
+	for (PrimitiveRef const &ref : unbounded) {
+		if (consider(ref) && anyHit) {
+			return closest;
+		}
+	}
+
+	if (nodesSize == 0) {
+		return closest;
+	}
+
+	vec3 invDirection = safeInverse(ray.direction);
+	bool directionNegative[3] = { invDirection.x < 0, invDirection.y < 0, invDirection.z < 0 };
+
+	int stack[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		Node const &node = nodes[stack[--stackSize]];
+		counters.nodeVisits++;
+		float tNear;
+		if (!node.bounds.intersect(ray, invDirection, tMin, tMax, tNear)) {
+			continue;
+		}
+
+		if (node.primitiveCount > 0) {
+			for (int i = 0; i < node.primitiveCount; i++) {
+				if (consider(primitives[node.firstPrimitive + i]) && anyHit) {
+					return closest;
+				}
+			}
+			continue;
+		}
+
+		// Push the far child first so the near one is visited next, which
+		// shrinks tMax early and lets more of the far side be skipped
+		int first = int(&node - nodes) + 1;
+		int second = node.secondChild;
+		if (directionNegative[node.axis]) {
+			std::swap(first, second);
+		}
+		stack[stackSize++] = second;
+		stack[stackSize++] = first;
+	}
+
+	return closest;
+}
+
+Intersection BVH::closestIntersection(Ray const &ray, int skipID, float tMin, float tMax) const {
+	Hit hit = traverse<false, false>(ray, skipID, tMin, tMax);
+	return hit.shape ? hit.shape->resolveHit(ray, hit) : Intersection();
+}
+
+Hit BVH::closestHit(Ray const &ray, int skipID, float tMin, float tMax) const {
+	return traverse<false, false>(ray, skipID, tMin, tMax);
+}
+
+Intersection BVH::anyIntersection(Ray const &ray, int skipID, float tMin, float tMax) const {
+	Hit hit = traverse<true, false>(ray, skipID, tMin, tMax);
+	return hit.shape ? hit.shape->resolveHit(ray, hit) : Intersection();
+}
+
+bool BVH::occluded(Ray const &ray, int skipID, float tMin, float tMax) const {
+	return traverse<true, true>(ray, skipID, tMin, tMax).shape != nullptr;
+}
+
+// --------------------------------------------------------------------------
+// Packet traversal. Lane hits are stored as indices into primitives, or as
+// -2 - i for unbounded[i].
+
+void BVH::intersectPacket(PacketKernels const &kernels, RayPacket &packet, PrimitiveRef const &ref, int id) const {
+	ShapeEntry const &entry = entries[ref.shape];
+	switch (entry.kind) {
+	case ShapeKind::Triangles:
+		kernels.intersectTriangle(packet, meshes[entry.index]->arrays(), ref.primitive, id);
+		break;
+	case ShapeKind::Sphere: {
+		PackedSphere const &sphere = spheres[entry.index];
+		kernels.intersectSphere(packet, &sphere.centre.x, sphere.radius, id);
+		break;
+	}
+	case ShapeKind::Plane: {
+		PackedPlane const &plane = planes[entry.index];
+		kernels.intersectPlane(packet, &plane.point.x, &plane.normal.x, id);
+		break;
+	}
+	case ShapeKind::Instance:
+		instances[entry.index]->intersectPacket(kernels, packet, id);
+		break;
+	case ShapeKind::Other:
+		// No kernel for it, test the rays one at a time
+		for (int i = 0; i < packet.size; i++) {
+			Ray ray(
+				vec3(packet.originX[i], packet.originY[i], packet.originZ[i]),
+				vec3(packet.directionX[i], packet.directionY[i], packet.directionZ[i])
+			);
+			Hit hit;
+			if (others[entry.index]->hitPrimitive(ray, ref.primitive, packet.tMin, packet.tMax[i], hit)) {
+				packet.tMax[i] = hit.t;
+				packet.hit[i] = id;
+			}
+		}
+		break;
+	}
+}
+
+void BVH::closestIntersections(PacketKernels const &kernels, RayPacket &packet, int skipID) const {
+	TraversalCounters &counters = threadTraversalCounters();
+	counters.packetQueries++;
+	counters.packetRays += packet.size;
+
+	for (size_t i = 0; i < unbounded.size(); i++) {
+		if (entries[unbounded[i].shape].id != skipID) {
+			counters.packetPrimitiveTests++;
+			intersectPacket(kernels, packet, unbounded[i], -2 - int(i));
+		}
+	}
+
+	if (nodesSize == 0) {
+		return;
+	}
+
+	// The rays are coherent, so the first one decides the visiting order for all
+	bool directionNegative[3] = { packet.directionX[0] < 0, packet.directionY[0] < 0, packet.directionZ[0] < 0 };
+
+	int stack[TRAVERSAL_STACK_SIZE];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		Node const &node = nodes[stack[--stackSize]];
+		counters.packetNodeVisits++;
+		// Descend as long as any ray in the packet still overlaps the box
+		if (kernels.intersectBox(packet, &node.bounds.min.x, &node.bounds.max.x) == 0) {
+			continue;
+		}
+
+		if (node.primitiveCount > 0) {
+			for (int i = 0; i < node.primitiveCount; i++) {
+				int index = node.firstPrimitive + i;
+				if (entries[primitives[index].shape].id != skipID) {
+					counters.packetPrimitiveTests++;
+					intersectPacket(kernels, packet, primitives[index], index);
+				}
+			}
+			continue;
+		}
+
+		int first = int(&node - nodes) + 1;
+		int second = node.secondChild;
+		if (directionNegative[node.axis]) {
+			std::swap(first, second);
+		}
+		stack[stackSize++] = second;
+		stack[stackSize++] = first;
+	}
+}
+
+Intersection BVH::resolvePacketHit(Ray const &ray, int hit, int skipID) const {
+	if (hit == -1) {
+		return Intersection();
+	}
+	PrimitiveRef const &ref = hit >= 0 ? primitives[hit] : unbounded[-2 - hit];
+	Intersection result = shapeOf(ref)->intersectPrimitive(ray, ref.primitive);
+	if (result.numberOfIntersections == 0) {
+		// The SIMD and scalar tests disagree right at an edge. Rare enough
+		// to just redo the whole query on the scalar path.
+		return closestIntersection(ray, skipID);
+	}
+	return result;
+}
@@ -0,0 +1,161 @@
+//------------------------------------------------------------------------------
+// Bounding volume hierarchy over every primitive in a scene.
+//
+// Each Shape is split into its primitives (the triangles of a mesh, a single
+// sphere, ...) and all of them go into one binary tree of bounding boxes that
+// is built with the surface area heuristic. Closest hit queries then only
+// visit the handful of boxes along the ray instead of every triangle.
+//
+// Unbounded shapes (planes) can't be put in a box, so they are kept aside and
+// tested on every query. There are only ever a few of them.
+//
+// The tree refers to shapes by their index in the list it was built from and
+// holds no pointers, so it can be saved as it is and later borrowed straight
+// from a file mapped into memory (see SceneCache.h).
+//
+// Queries don't go through the Shape interface. The shapes are sorted by
+// kind into arrays of their own (the centres and radii of all spheres side
+// by side, and so on), and a primitive is tested with a switch on its kind
+// that calls the inline test for it, so the innermost loop makes no virtual
+// calls and reads packed data instead of following a pointer to each shape.
+// Only instances and shapes of other kinds are asked through the interface.
+// Sphere and plane geometry is copied in when the tree is built, so moving
+// one afterwards needs the tree to be built again.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "RayTrace.h"
+#include "RayPacket.h"
+
+class Instance;
+
+class BVH {
+public:
+	// Builds the tree. The shapes must outlive the BVH, which holds raw
+	// pointers to them.
+	void build(std::vector<std::shared_ptr<Shape>> const &shapes);
+
+	// Nearest hit with tMin < t < tMax, ignoring the shape with id skipID.
+	Intersection closestIntersection(
+		Ray const &ray, int skipID,
+		float tMin = 0.f, float tMax = std::numeric_limits<float>::max()
+	) const;
+	// The same, without working out more than which primitive was hit where
+	// (hit.shape is nullptr if none was)
+	Hit closestHit(Ray const &ray, int skipID, float tMin, float tMax) const;
+
+	// First hit found with tMin < t < tMax (not necessarily the nearest),
+	// ignoring the shape with id skipID. Returns as soon as one is found.
+	Intersection anyIntersection(Ray const &ray, int skipID, float tMin, float tMax) const;
+
+	// Whether any shape that casts shadows is hit with tMin < t < tMax,
+	// ignoring the shape with id skipID. Stops at the first one found.
+	bool occluded(Ray const &ray, int skipID, float tMin, float tMax) const;
+
+	// Closest hits for a whole packet of rays at once, using the SIMD kernels.
+	// Afterwards packet.hit[i] identifies the primitive hit by ray i (or is
+	// -1), to be turned into an Intersection with resolvePacketHit().
+	void closestIntersections(PacketKernels const &kernels, RayPacket &packet, int skipID) const;
+	Intersection resolvePacketHit(Ray const &ray, int hit, int skipID) const;
+
+	int nodeCount() const { return nodesSize; }
+	int primitiveCount() const { return primitivesSize; }
+	AABB bounds() const { return nodesSize == 0 ? AABB() : nodes[0].bounds; }
+
+	// Nodes are stored depth first: the left child of an interior node is
+	// the next node in the array, the right child is at secondChild.
+	// Leaves reference primitives[firstPrimitive, firstPrimitive + count).
+	struct Node {
+		AABB bounds;
+		int firstPrimitive;
+		int primitiveCount; // 0 for interior nodes
+		int secondChild;
+		int axis; // split axis, used to visit the nearer child first
+	};
+
+	struct PrimitiveRef {
+		int shape; // index into the shapes the tree was built from
+		int primitive;
+	};
+
+	// The tree as it is stored, for saving it
+	Node const* nodeData() const { return nodes; }
+	PrimitiveRef const* primitiveData() const { return primitives; }
+
+	// Uses a tree saved from one built over the same shapes, without copying
+	// it. The arrays must stay as they are; owner is kept alive while they're
+	// used. The shapes must outlive the BVH, like with build(). Returns
+	// false, leaving the BVH as it was, if the arrays aren't a tree over
+	// those shapes that queries could safely walk.
+	bool borrow(std::vector<std::shared_ptr<Shape>> const &shapes,
+		Node const* nodes, int nodeCount, PrimitiveRef const* primitives, int primitiveCount,
+		std::shared_ptr<const void> owner);
+
+private:
+	// What a shape is, which says which of the arrays below holds it
+	enum class ShapeKind { Triangles, Sphere, Plane, Instance, Other };
+
+	// What queries need to know of a shape without touching it: its kind,
+	// where it is in the array for that kind, and what they filter on
+	struct ShapeEntry {
+		ShapeKind kind;
+		int index;
+		int id;
+		bool castsShadows;
+	};
+
+	struct PackedSphere {
+		vec3 centre;
+		float radius;
+	};
+
+	struct PackedPlane {
+		vec3 point;
+		vec3 normal;
+	};
+
+	// Fills in shapes, entries, the arrays for each kind and unbounded
+	void setShapes(std::vector<std::shared_ptr<Shape>> const &shapes);
+	Shape* shapeOf(PrimitiveRef const &ref) const { return shapes[ref.shape]; }
+
+	// Shape::hitPrimitive() of the shape in entry, without calling it
+	bool hitPrimitive(ShapeEntry const &entry, Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const;
+	void intersectPacket(PacketKernels const &kernels, RayPacket &packet, PrimitiveRef const &ref, int id) const;
+
+	// Per-primitive data only needed while building
+	struct BuildPrimitive {
+		AABB bounds;
+		vec3 centre;
+		PrimitiveRef ref;
+	};
+
+	int buildRecursive(std::vector<BuildPrimitive> &build, int start, int end, int depth);
+
+	template <bool anyHit, bool shadowCastersOnly>
+	Hit traverse(Ray const &ray, int skipID, float tMin, float tMax) const;
+
+	// One of each per shape, in the order they were given
+	std::vector<Shape*> shapes;
+	std::vector<ShapeEntry> entries;
+
+	std::vector<PackedSphere> spheres;
+	std::vector<PackedPlane> planes;
+	std::vector<TriangleMesh const*> meshes;
+	std::vector<Instance const*> instances;
+	std::vector<Shape const*> others;
+
+	std::vector<PrimitiveRef> unbounded;
+
+	// The tree: either the arrays below, or borrowed ones
+	Node const* nodes = nullptr;
+	int nodesSize = 0;
+	PrimitiveRef const* primitives = nullptr;
+	int primitivesSize = 0;
+	std::shared_ptr<const void> borrowedFrom;
+
+	std::vector<Node> ownNodes;
+	std::vector<PrimitiveRef> ownPrimitives;
+};
@@ -0,0 +1,125 @@
+#include "Camera.h"
+
+#include <cmath>
+
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace {
+	// Maps the unit square onto the unit disk, keeping evenly spread points
+	// evenly spread (Shirley and Chiu's concentric mapping)
+	glm::vec2 squareToDisk(glm::vec2 sample) {
+		glm::vec2 p = 2.f*sample - glm::vec2(1);
+		if (p.x == 0 && p.y == 0) {
+			return glm::vec2(0);
+		}
+		float radius, angle;
+		if (std::abs(p.x) > std::abs(p.y)) {
+			radius = p.x;
+			angle = glm::quarter_pi<float>()*(p.y/p.x);
+		}
+		else {
+			radius = p.y;
+			angle = glm::half_pi<float>() - glm::quarter_pi<float>()*(p.x/p.y);
+		}
+		return radius*glm::vec2(std::cos(angle), std::sin(angle));
+	}
+
+	// The turn by yaw and pitch, with the pitch cut short if it would bring
+	// the view within a degree of up or down
+	glm::mat3 turnRotation(Camera const &camera, float yaw, float pitch) {
+		const float MARGIN = glm::radians(1.f);
+		glm::vec3 forward = glm::normalize(camera.direction);
+		glm::vec3 up = glm::normalize(camera.up);
+		float fromUp = std::acos(glm::clamp(glm::dot(forward, up), -1.f, 1.f));
+		pitch = fromUp - glm::clamp(fromUp - pitch, MARGIN, glm::pi<float>() - MARGIN);
+		glm::vec3 right = glm::normalize(glm::cross(forward, up));
+		return glm::mat3(glm::rotate(glm::mat4(1), yaw, up)*glm::rotate(glm::mat4(1), pitch, right));
+	}
+}
+
+void Camera::turn(float yaw, float pitch) {
+	direction = turnRotation(*this, yaw, pitch)*direction;
+}
+
+void Camera::orbit(glm::vec3 centre, float yaw, float pitch) {
+	glm::mat3 rotation = turnRotation(*this, yaw, pitch);
+	position = centre + rotation*(position - centre);
+	direction = rotation*direction;
+}
+
+void Camera::move(glm::vec3 offset) {
+	glm::vec3 forward = glm::normalize(direction);
+	glm::vec3 right = glm::normalize(glm::cross(forward, up));
+	position += offset.x*right + offset.y*glm::cross(right, forward) + offset.z*forward;
+}
+
+CameraRays::CameraRays(Camera const &camera, int width, int height)
+	: camera(camera)
+	, width(float(width))
+	, height(float(height))
+{
+	forward = glm::normalize(camera.direction);
+	right = glm::cross(forward, camera.up);
+	if (glm::length(right) == 0) {
+		// Up is along the view direction, so any perpendicular will do
+		right = glm::cross(forward, std::abs(forward.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0));
+	}
+	right = glm::normalize(right);
+	up = glm::cross(right, forward);
+
+	float planeHeight = camera.type == Camera::Orthographic
+		? camera.height
+		: 2.f*std::tan(0.5f*glm::radians(camera.fieldOfView));
+	planeSize = glm::vec2(planeHeight*this->width/this->height, planeHeight);
+}
+
+//------------------------------------------------------------------------------
+// This is part 1 of your assignment. Make the rays that go from the camera
+// out into the scene with the right directions and angles to produce a
+// perspective image.
+//------------------------------------------------------------------------------
+Ray CameraRays::generate(int x, int y, glm::vec2 offset, glm::vec2 lensSample) const {
+	// Where the ray crosses the image plane, from -0.5 to 0.5 across it
+	float i = (float(x) + offset.x)/width - 0.5f;
+	float j = (float(y) + offset.y)/height - 0.5f;
+	glm::vec3 onPlane = (i*planeSize.x)*right + (j*planeSize.y)*up;
+
+	switch (camera.type) {
+	case Camera::Orthographic:
+		return Ray(camera.position + onPlane, forward);
+	case Camera::ThinLens:
+		if (camera.hasLens()) {
+			// Every ray through this point of the image meets the pinhole
+			// ray at the plane in focus
+			glm::vec3 focus = camera.position + camera.focusDistance*(onPlane + forward);
+			glm::vec2 lens = camera.aperture*squareToDisk(lensSample);
+			glm::vec3 origin = camera.position + lens.x*right + lens.y*up;
+			return Ray(origin, glm::normalize(focus - origin));
+		}
+		break;
+	case Camera::Pinhole:
+		break;
+	}
+	return Ray(camera.position, glm::normalize(onPlane + forward));
+}
+
+RayDifferential CameraRays::differential(Ray const &ray) const {
+	// One pixel's step across and up the image plane
+	glm::vec3 stepX = (planeSize.x/width)*right;
+	glm::vec3 stepY = (planeSize.y/height)*up;
+
+	RayDifferential result;
+	if (camera.type == Camera::Orthographic) {
+		result.dOdx = stepX;
+		result.dOdy = stepY;
+		return result;
+	}
+	// The direction is onPlane + forward normalized, and the derivative of
+	// v/|v| is the part of dv across v, over |v|
+	glm::vec3 direction = glm::normalize(ray.direction);
+	float length = 1.f/glm::dot(direction, forward);
+	result.dDdx = (stepX - glm::dot(direction, stepX)*direction)/length;
+	result.dDdy = (stepY - glm::dot(direction, stepY)*direction)/length;
+	return result;
+}
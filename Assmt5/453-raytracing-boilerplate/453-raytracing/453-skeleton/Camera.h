@@ -0,0 +1,101 @@
+//------------------------------------------------------------------------------
+// The camera, which makes the ray for each pixel sample as it's traced.
+//
+// There are three kinds:
+//
+//   pinhole       a perspective view from a single point (the default)
+//   orthographic  parallel rays, for views without perspective
+//   thin lens     a perspective view through a lens with an aperture, for
+//                 depth of field: rays start all over the aperture and meet
+//                 again at the focus distance, so only what's at that
+//                 distance is sharp and the rest blurs more the wider the
+//                 aperture is
+//
+// Any of them can be put anywhere, looking in any direction. The defaults
+// are those of the assignment's camera: at the origin, looking down -z, with
+// an image plane 1 unit tall one unit in front of it.
+//
+// Rays aren't made up front. CameraRays works out what's needed for one
+// image size once, then makes the ray through any point of any pixel when
+// it's asked for, from the pixel's integer coordinates and the offset
+// within it, so rendering a huge image doesn't first fill memory with rays
+// and every pixel is placed exactly, however wide the image is.
+//
+// Each ray can also be given its differential (see RayDifferential.h), for
+// filtering the textures it hits.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "RayDifferential.h"
+#include "RayTrace.h"
+
+struct Camera {
+	enum Type { Pinhole, Orthographic, ThinLens };
+	Type type = Pinhole;
+
+	glm::vec3 position = glm::vec3(0);
+	// Which way the camera looks, and which way is up in the image. They
+	// needn't be unit length or perpendicular, only not parallel.
+	glm::vec3 direction = glm::vec3(0, 0, -1);
+	glm::vec3 up = glm::vec3(0, 1, 0);
+
+	// Pinhole and thin lens: the angle from the bottom to the top of the
+	// image, in degrees. The width follows from the image's aspect ratio.
+	float fieldOfView = 53.1301f;
+	// Orthographic: the height of the view, in scene units
+	float height = 1;
+
+	// Thin lens: the radius of the aperture, and the distance along the view
+	// direction to the plane in focus
+	float aperture = 0;
+	float focusDistance = 1;
+
+	// Whether the camera's rays need a point on the lens, i.e. it's a thin
+	// lens with an aperture
+	bool hasLens() const { return type == ThinLens && aperture > 0; }
+
+	// For moving the camera around interactively. Angles are in radians,
+	// and turning never goes all the way to looking straight along up,
+	// where the image would have no up left.
+	//
+	// Turns the camera where it is: yaw about up (positive to the left),
+	// then pitch about the right of the image (positive upwards)
+	void turn(float yaw, float pitch);
+	// Swings the camera around centre, turning it by the same angles, so a
+	// centre in the middle of the image stays there
+	void orbit(glm::vec3 centre, float yaw, float pitch);
+	// Moves the camera by offset in its own axes: x towards the right of the
+	// image, y towards its top and z the way the camera looks
+	void move(glm::vec3 offset);
+};
+
+// A camera set up for images of one size
+class CameraRays {
+public:
+	CameraRays(Camera const &camera, int width, int height);
+
+	// The ray through point (x + offset.x, y + offset.y) of the image, in
+	// pixels from its bottom-left corner. lensSample, in [0, 1) in both
+	// coordinates, picks where on the aperture a thin lens ray starts, and
+	// is ignored if the camera has no lens.
+	Ray generate(int x, int y, glm::vec2 offset = glm::vec2(0), glm::vec2 lensSample = glm::vec2(0)) const;
+	// How a ray from generate() changes from one pixel to the next. Thin
+	// lens rays get those of the pinhole ray in the same direction, which
+	// cover the same area where the image is in focus.
+	RayDifferential differential(Ray const &ray) const;
+
+private:
+	Camera camera;
+	float width;
+	float height;
+
+	// Unit vectors towards the right and the top of the image and into it
+	glm::vec3 right;
+	glm::vec3 up;
+	glm::vec3 forward;
+	// The size of the image plane: at distance 1 for the perspective
+	// cameras, where the rays start for the orthographic one
+	glm::vec2 planeSize;
+};
@@ -0,0 +1,253 @@
+#include "Denoiser.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+
+#include "SurfaceTexture.h"
+#include "ThreadPool.h"
+
+namespace {
+	float luminance(glm::vec3 colour) {
+		return glm::dot(colour, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	// Albedos are clamped to at least this before dividing by them, so black
+	// surfaces don't blow the noise up
+	const float MIN_ALBEDO = 0.01f;
+	// Keeps the edge stopping functions from dividing by 0
+	const float EPSILON = 1e-6f;
+	// A pixel whose samples all saw the same surface has a mean normal of
+	// length 1. Shorter ones mix surfaces, or a surface with something else.
+	const float MIN_NORMAL_LENGTH = 0.95f;
+
+	// The B3 spline, the 1D taps of the 5x5 a-trous kernel
+	const float KERNEL[5] = { 1.f/16.f, 1.f/4.f, 3.f/8.f, 1.f/4.f, 1.f/16.f };
+
+	// What the filter knows about each pixel, besides the colour being
+	// filtered
+	struct Guide {
+		glm::vec3 albedo;
+		glm::vec3 normal;
+		float depth;
+		// How fast the depth changes from one pixel to the next
+		float depthGradientX;
+		float depthGradientY;
+		bool hit;
+	};
+
+	class Filter {
+	public:
+		Filter(AccumulationBuffer const &accumulation, DenoiserSettings const &settings)
+			: settings(settings)
+			, width(accumulation.width())
+			, height(accumulation.height())
+			, guides(width*height)
+			, lighting(width*height)
+			, variance(width*height)
+		{
+			ThreadPool &pool = ThreadPool::global();
+			pool.parallelFor(height, [&](int y) {
+				for (int x = 0; x < width; x++) {
+					SurfaceFeatures const &features = accumulation.features(x, y);
+					Guide &guide = guides[y*width + x];
+					guide.hit = glm::length(features.normal) >= MIN_NORMAL_LENGTH;
+					guide.albedo = glm::max(features.albedo, glm::vec3(MIN_ALBEDO));
+					guide.normal = guide.hit ? glm::normalize(features.normal) : glm::vec3(0);
+					guide.depth = features.depth;
+					// Demodulated, so only the lighting is left
+					lighting[y*width + x] = accumulation.mean(x, y)/guide.albedo;
+				}
+			});
+			pool.parallelFor(height, [&](int y) {
+				for (int x = 0; x < width; x++) {
+					Guide &guide = guides[y*width + x];
+					guide.depthGradientX = depthGradient(x, y, 1, 0);
+					guide.depthGradientY = depthGradient(x, y, 0, 1);
+					float albedo = std::max(luminance(guide.albedo), MIN_ALBEDO);
+					float v = accumulation.varianceOfMean(x, y);
+					variance[y*width + x] = std::isfinite(v) ? v/(albedo*albedo) : spatialVariance(x, y);
+				}
+			});
+		}
+
+		void run(std::vector<glm::vec3> &colours) {
+			std::vector<glm::vec3> nextLighting(lighting.size());
+			std::vector<float> nextVariance(variance.size());
+			for (int pass = 0; pass < settings.passes; pass++) {
+				int step = 1 << pass;
+				ThreadPool::global().parallelFor(height, [&](int y) {
+					for (int x = 0; x < width; x++) {
+						filterPixel(x, y, step, nextLighting[y*width + x], nextVariance[y*width + x]);
+					}
+				});
+				lighting.swap(nextLighting);
+				variance.swap(nextVariance);
+			}
+
+			colours.resize(lighting.size());
+			for (size_t i = 0; i < lighting.size(); i++) {
+				colours[i] = lighting[i]*guides[i].albedo;
+			}
+		}
+
+	private:
+		DenoiserSettings const &settings;
+		int width;
+		int height;
+		std::vector<Guide> guides;
+		std::vector<glm::vec3> lighting;
+		std::vector<float> variance;
+
+		bool inside(int x, int y) const {
+			return x >= 0 && x < width && y >= 0 && y < height;
+		}
+
+		// Change in depth per pixel along (dx, dy), from the neighbours on the
+		// same side of any edge. 0 if neither neighbour is on the surface.
+		float depthGradient(int x, int y, int dx, int dy) const {
+			Guide const &centre = guides[y*width + x];
+			if (!centre.hit) {
+				return 0;
+			}
+			float best = -1;
+			for (int side = -1; side <= 1; side += 2) {
+				int nx = x + side*dx;
+				int ny = y + side*dy;
+				if (!inside(nx, ny) || !guides[ny*width + nx].hit) {
+					continue;
+				}
+				float gradient = std::abs(guides[ny*width + nx].depth - centre.depth);
+				if (best < 0 || gradient < best) {
+					best = gradient;
+				}
+			}
+			return std::max(best, 0.f);
+		}
+
+		// Pixels with a single sample don't know their own variance yet, so
+		// it's estimated from the neighbours on the same surface instead
+		float spatialVariance(int x, int y) const {
+			Guide const &centre = guides[y*width + x];
+			if (!centre.hit) {
+				return 0;
+			}
+			const int RADIUS = 2;
+			float sum = 0, sumOfSquares = 0;
+			int count = 0;
+			for (int ny = std::max(y - RADIUS, 0); ny <= std::min(y + RADIUS, height - 1); ny++) {
+				for (int nx = std::max(x - RADIUS, 0); nx <= std::min(x + RADIUS, width - 1); nx++) {
+					Guide const &other = guides[ny*width + nx];
+					if (!other.hit || glm::dot(other.normal, centre.normal) < 0.9f) {
+						continue;
+					}
+					float l = luminance(lighting[ny*width + nx]);
+					sum += l;
+					sumOfSquares += l*l;
+					count++;
+				}
+			}
+			if (count < 2) {
+				return 0;
+			}
+			float mean = sum/count;
+			return std::max(0.f, sumOfSquares/count - mean*mean);
+		}
+
+		// The variance around the pixel, blurred a little with a 3x3 Gaussian
+		// so the luminance weights don't follow the noise in it
+		float blurredVariance(int x, int y) const {
+			const float GAUSSIAN[2] = { 1.f/2.f, 1.f/4.f };
+			float sum = 0, weights = 0;
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					int nx = x + dx;
+					int ny = y + dy;
+					if (!inside(nx, ny) || !guides[ny*width + nx].hit) {
+						continue;
+					}
+					float w = GAUSSIAN[std::abs(dx)]*GAUSSIAN[std::abs(dy)];
+					sum += w*variance[ny*width + nx];
+					weights += w;
+				}
+			}
+			return weights > 0 ? sum/weights : 0.f;
+		}
+
+		void filterPixel(int x, int y, int step, glm::vec3 &outLighting, float &outVariance) const {
+			int index = y*width + x;
+			Guide const &centre = guides[index];
+			// Rays that hit nothing have no surface to filter along
+			if (!centre.hit) {
+				outLighting = lighting[index];
+				outVariance = variance[index];
+				return;
+			}
+
+			float centreLuminance = luminance(lighting[index]);
+			float luminanceScale = settings.colourSigma*std::sqrt(blurredVariance(x, y)) + EPSILON;
+
+			glm::vec3 sum(0);
+			float varianceSum = 0;
+			float weights = 0;
+			for (int ky = -2; ky <= 2; ky++) {
+				for (int kx = -2; kx <= 2; kx++) {
+					int nx = x + kx*step;
+					int ny = y + ky*step;
+					if (!inside(nx, ny)) {
+						continue;
+					}
+					int other = ny*width + nx;
+					Guide const &guide = guides[other];
+					if (!guide.hit) {
+						continue;
+					}
+
+					float w = KERNEL[kx + 2]*KERNEL[ky + 2];
+					if (other != index) {
+						float cosine = std::max(0.f, glm::dot(centre.normal, guide.normal));
+						float normalWeight = std::pow(cosine, settings.normalExponent);
+						float expectedDepth = std::abs(centre.depthGradientX*kx*step) + std::abs(centre.depthGradientY*ky*step);
+						float depthWeight = std::abs(centre.depth - guide.depth)/(settings.depthSigma*expectedDepth + EPSILON);
+						float luminanceWeight = std::abs(centreLuminance - luminance(lighting[other]))/luminanceScale;
+						w *= normalWeight*std::exp(-depthWeight - luminanceWeight);
+					}
+
+					sum += w*lighting[other];
+					varianceSum += w*w*variance[other];
+					weights += w;
+				}
+			}
+			// The centre always counts, so weights is never 0
+			outLighting = sum/weights;
+			outVariance = varianceSum/(weights*weights);
+		}
+	};
+}
+
+SurfaceFeatures surfaceFeatures(Scene const &scene, Ray const &ray, RayDifferential const &differential, Intersection const &hit) {
+	SurfaceFeatures features;
+	if (hit.numberOfIntersections == 0 || glm::dot(hit.normal, hit.normal) <= 0) {
+		return features;
+	}
+	for (int l : scene.areaLights) {
+		if (intersectAreaLight(scene.lights[l], ray) < hit.t) {
+			return features;
+		}
+	}
+	ObjectMaterial textured;
+	ObjectMaterial const &material = materialAt(ray, differential, hit, textured);
+	features.albedo = glm::min(material.diffuse + material.specular + material.reflectionStrength, glm::vec3(1));
+	features.normal = glm::normalize(hit.normal);
+	if (glm::dot(features.normal, ray.direction) > 0) {
+		features.normal = -features.normal;
+	}
+	features.depth = hit.t*glm::length(ray.direction);
+	return features;
+}
+
+void denoise(AccumulationBuffer const &accumulation, DenoiserSettings const &settings, std::vector<glm::vec3> &colours) {
+	Filter filter(accumulation, settings);
+	filter.run(colours);
+}
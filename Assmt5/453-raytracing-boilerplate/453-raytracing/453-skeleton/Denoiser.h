@@ -0,0 +1,52 @@
+//------------------------------------------------------------------------------
+// Smooths the noise out of an image rendered with few samples per pixel.
+//
+// This is the spatial part of SVGF (Schied et al., "Spatiotemporal
+// Variance-Guided Filtering", 2017): an a-trous wavelet filter, i.e. a 5x5
+// blur repeated with the taps spread twice as far apart each time, that
+// stops at edges. Neighbours only count if they're the same surface (close
+// in depth, with the same normal) and differ in brightness by no more than
+// the noise of the pixel explains. That noise is the variance of the pixel's
+// mean, which the accumulation buffer already estimates for adaptive
+// sampling, and it shrinks as the filter goes so later passes blur less.
+//
+// The colour is divided by the albedo before filtering and multiplied back
+// afterwards, so only the lighting is blurred and textures and colour edges
+// stay sharp. Pixels that see no surface, or only part of one (at its edge,
+// or where an area light covers part of it), are left as they are.
+//
+// Each pass runs over the rows on the global thread pool.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+
+#include <glm/vec3.hpp>
+
+#include "AccumulationBuffer.h"
+#include "RayDifferential.h"
+#include "RayTrace.h"
+#include "Scene.h"
+
+struct DenoiserSettings {
+	// Passes of the filter. Each doubles how far it reaches: 5 reach 62
+	// pixels away.
+	int passes = 5;
+	// How much brighter or darker than the noise explains a neighbour can be
+	// and still count, in standard deviations
+	float colourSigma = 4.f;
+	// How sharply the weight falls off as neighbouring normals turn away
+	float normalExponent = 128.f;
+	// How far off the depth can be, relative to how fast it changes across
+	// the pixel
+	float depthSigma = 1.f;
+};
+
+// The features of what the camera ray hit, for the accumulation buffer. Area
+// lights are left out of the filter, so rays that see one get none. The
+// albedo includes the material's textures, filtered over the ray's
+// differential.
+SurfaceFeatures surfaceFeatures(Scene const &scene, Ray const &ray, RayDifferential const &differential, Intersection const &hit);
+
+// The denoised mean of every pixel, row by row, bottom row first
+void denoise(AccumulationBuffer const &accumulation, DenoiserSettings const &settings, std::vector<glm::vec3> &colours);
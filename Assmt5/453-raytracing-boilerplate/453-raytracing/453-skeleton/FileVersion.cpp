@@ -0,0 +1,12 @@
+#include "FileVersion.h"
+
+FileVersion fileVersion(std::string const &path) {
+	FileVersion version;
+	// The same file can be named in different ways
+	std::error_code error;
+	std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+	version.key = error ? path : canonical.string();
+	version.modified = std::filesystem::last_write_time(version.key, error);
+	version.known = !error;
+	return version;
+}
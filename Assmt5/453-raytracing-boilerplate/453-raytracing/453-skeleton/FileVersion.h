@@ -0,0 +1,24 @@
+//------------------------------------------------------------------------------
+// Names a file the same way however a scene spells its path, along with when
+// it was last modified, for the caches that keep what was loaded from files
+// (meshes and textures) to tell whether they have it already.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+struct FileVersion {
+	// The canonical path, or the path as given if it has none (the file
+	// doesn't exist, say)
+	std::string key;
+	std::filesystem::file_time_type modified;
+	// False if the modification time couldn't be read, in which case the
+	// file should be treated as changed
+	bool known = false;
+
+	// Whether the file is the same as when other was taken
+	bool unchanged(FileVersion const &other) const { return known && other.known && modified == other.modified; }
+};
+
+FileVersion fileVersion(std::string const &path);
@@ -0,0 +1,636 @@
+#include "ImageWriter.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include <glm/common.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "Log.h"
+
+namespace {
+	const struct { const char* name; ToneMapping toneMapping; } TONE_MAPPINGS[] = {
+		{ "clamp", ToneMapping::Clamp },
+		{ "reinhard", ToneMapping::Reinhard },
+		{ "aces", ToneMapping::ACES },
+	};
+
+	std::string extensionOf(std::string const &fileName) {
+		std::string extension = std::filesystem::path(fileName).extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+		return extension;
+	}
+
+	// Bytes are put in little endian order by hand, so the files come out the
+	// same on any machine
+	void putUint32(std::vector<char> &bytes, uint32_t value) {
+		for (int i = 0; i < 4; i++) {
+			bytes.push_back(char((value >> (8*i)) & 0xff));
+		}
+	}
+
+	void putUint64(std::vector<char> &bytes, uint64_t value) {
+		for (int i = 0; i < 8; i++) {
+			bytes.push_back(char((value >> (8*i)) & 0xff));
+		}
+	}
+
+	void putFloat(std::vector<char> &bytes, float value) {
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		putUint32(bytes, bits);
+	}
+
+	void putString(std::vector<char> &bytes, const char* text) {
+		bytes.insert(bytes.end(), text, text + std::strlen(text) + 1);
+	}
+
+	// Writes the file a row at a time, from the top row down unless
+	// bottomUp. encodeRow turns one row of pixels into the bytes to write.
+	template <typename EncodeRow>
+	bool writeRows(std::ofstream &out, int width, int height, glm::vec3 const* pixels, bool bottomUp, EncodeRow encodeRow) {
+		std::vector<char> bytes;
+		for (int row = 0; row < height && out; row++) {
+			int y = bottomUp ? row : height - 1 - row;
+			bytes.clear();
+			encodeRow(y, pixels + std::size_t(y)*width, bytes);
+			out.write(bytes.data(), bytes.size());
+		}
+		return bool(out);
+	}
+
+	// --------------------------------------------------------------------------
+	// PFM: a text header, then the rows bottom up as raw floats. A negative
+	// scale in the header says they're little endian.
+
+	bool writePFM(std::ofstream &out, int width, int height, glm::vec3 const* pixels) {
+		out << "PF\n" << width << " " << height << "\n-1.0\n";
+		return writeRows(out, width, height, pixels, true, [&](int, glm::vec3 const* row, std::vector<char> &bytes) {
+			for (int x = 0; x < width; x++) {
+				putFloat(bytes, row[x].r);
+				putFloat(bytes, row[x].g);
+				putFloat(bytes, row[x].b);
+			}
+		});
+	}
+
+	// --------------------------------------------------------------------------
+	// Radiance HDR: a text header, then the rows top down in RGBE. Each row
+	// is run length encoded one component at a time, as Radiance itself does.
+
+	void toRGBE(glm::vec3 colour, unsigned char rgbe[4]) {
+		colour = glm::max(colour, glm::vec3(0));
+		float largest = std::max(std::max(colour.r, colour.g), colour.b);
+		if (!(largest >= 1e-32f) || !std::isfinite(largest)) {
+			rgbe[0] = rgbe[1] = rgbe[2] = rgbe[3] = 0;
+			return;
+		}
+		int exponent;
+		float scale = std::frexp(largest, &exponent)*256.f/largest;
+		rgbe[0] = (unsigned char)(colour.r*scale);
+		rgbe[1] = (unsigned char)(colour.g*scale);
+		rgbe[2] = (unsigned char)(colour.b*scale);
+		rgbe[3] = (unsigned char)(exponent + 128);
+	}
+
+	// Runs of at least 4 equal bytes are stored as a count over 128 and the
+	// byte, everything else as a count and the bytes as they are
+	void encodeRun(unsigned char const* data, int count, std::vector<char> &bytes) {
+		const int MIN_RUN = 4;
+		const int MAX_RUN = 127;
+		const int MAX_LITERAL = 128;
+		int x = 0;
+		while (x < count) {
+			int runStart = x;
+			int runLength = 0;
+			while (runStart < count) {
+				runLength = 1;
+				while (runStart + runLength < count && runLength < MAX_RUN && data[runStart + runLength] == data[runStart]) {
+					runLength++;
+				}
+				if (runLength >= MIN_RUN) {
+					break;
+				}
+				runStart += runLength;
+			}
+			// The bytes before the run as they are
+			while (x < runStart) {
+				int literal = std::min(runStart - x, MAX_LITERAL);
+				bytes.push_back(char(literal));
+				bytes.insert(bytes.end(), data + x, data + x + literal);
+				x += literal;
+			}
+			if (runStart < count) {
+				bytes.push_back(char(128 + runLength));
+				bytes.push_back(char(data[runStart]));
+				x = runStart + runLength;
+			}
+		}
+	}
+
+	bool writeRadianceHDR(std::ofstream &out, int width, int height, glm::vec3 const* pixels) {
+		out << "#?RADIANCE\nFORMAT=32-bit_rle_rgbe\n\n-Y " << height << " +X " << width << "\n";
+		// Run length encoding only works for rows 8 to 32767 pixels wide
+		bool encoded = width >= 8 && width < 32768;
+		std::vector<unsigned char> components(4*std::size_t(width));
+		return writeRows(out, width, height, pixels, false, [&](int, glm::vec3 const* row, std::vector<char> &bytes) {
+			if (!encoded) {
+				for (int x = 0; x < width; x++) {
+					unsigned char rgbe[4];
+					toRGBE(row[x], rgbe);
+					bytes.insert(bytes.end(), rgbe, rgbe + 4);
+				}
+				return;
+			}
+			for (int x = 0; x < width; x++) {
+				unsigned char rgbe[4];
+				toRGBE(row[x], rgbe);
+				for (int c = 0; c < 4; c++) {
+					components[c*width + x] = rgbe[c];
+				}
+			}
+			bytes.push_back(2);
+			bytes.push_back(2);
+			bytes.push_back(char(width >> 8));
+			bytes.push_back(char(width & 0xff));
+			for (int c = 0; c < 4; c++) {
+				encodeRun(&components[c*width], width, bytes);
+			}
+		});
+	}
+
+	// --------------------------------------------------------------------------
+	// OpenEXR: a header of named attributes, a table of where each row
+	// starts, then the rows top down, each with its channels one after the
+	// other in alphabetical order (B, G, R) as half floats. Uncompressed rows
+	// all have the same size, so the table is known before any are written.
+
+	void putAttribute(std::vector<char> &bytes, const char* name, const char* type, std::vector<char> const &value) {
+		putString(bytes, name);
+		putString(bytes, type);
+		putUint32(bytes, uint32_t(value.size()));
+		bytes.insert(bytes.end(), value.begin(), value.end());
+	}
+
+	bool writeEXR(std::ofstream &out, int width, int height, glm::vec3 const* pixels) {
+		const uint32_t HALF = 1;
+		std::vector<char> header = { 0x76, 0x2f, 0x31, 0x01 };
+		putUint32(header, 2); // version 2, single part scanline file
+
+		std::vector<char> channels;
+		for (const char* name : { "B", "G", "R" }) {
+			putString(channels, name);
+			putUint32(channels, HALF);
+			putUint32(channels, 0); // linear flag and reserved bytes
+			putUint32(channels, 1); // x sampling
+			putUint32(channels, 1); // y sampling
+		}
+		channels.push_back(0);
+		putAttribute(header, "channels", "chlist", channels);
+		putAttribute(header, "compression", "compression", { 0 });
+
+		std::vector<char> window;
+		putUint32(window, 0);
+		putUint32(window, 0);
+		putUint32(window, uint32_t(width - 1));
+		putUint32(window, uint32_t(height - 1));
+		putAttribute(header, "dataWindow", "box2i", window);
+		putAttribute(header, "displayWindow", "box2i", window);
+		putAttribute(header, "lineOrder", "lineOrder", { 0 }); // increasing y
+
+		std::vector<char> value;
+		putFloat(value, 1.f);
+		putAttribute(header, "pixelAspectRatio", "float", value);
+		value.clear();
+		putFloat(value, 0.f);
+		putFloat(value, 0.f);
+		putAttribute(header, "screenWindowCenter", "v2f", value);
+		value.clear();
+		putFloat(value, 1.f);
+		putAttribute(header, "screenWindowWidth", "float", value);
+		header.push_back(0);
+
+		uint64_t rowSize = 3*2*uint64_t(width);
+		uint64_t chunkSize = 8 + rowSize; // y and size, then the row
+		uint64_t firstChunk = header.size() + 8*uint64_t(height);
+		for (int row = 0; row < height; row++) {
+			putUint64(header, firstChunk + row*chunkSize);
+		}
+		out.write(header.data(), header.size());
+
+		return writeRows(out, width, height, pixels, false, [&](int y, glm::vec3 const* row, std::vector<char> &bytes) {
+			putUint32(bytes, uint32_t(height - 1 - y));
+			putUint32(bytes, uint32_t(rowSize));
+			for (int c = 2; c >= 0; c--) {
+				for (int x = 0; x < width; x++) {
+					uint16_t half = glm::packHalf1x16(row[x][c]);
+					bytes.push_back(char(half & 0xff));
+					bytes.push_back(char(half >> 8));
+				}
+			}
+		});
+	}
+
+	// --------------------------------------------------------------------------
+	// PNG: a signature and a header chunk, then the rows top down as one zlib
+	// stream split over IDAT chunks. Each row is filtered against the one
+	// above with whichever of the five filters leaves the smallest values,
+	// then compressed as it comes by a small deflate encoder: LZ77 matches
+	// within the last 32 KB and the fixed Huffman codes, as stb does it.
+
+	void putUint32BigEndian(std::vector<char> &bytes, uint32_t value) {
+		for (int i = 3; i >= 0; i--) {
+			bytes.push_back(char((value >> (8*i)) & 0xff));
+		}
+	}
+
+	uint32_t crc32(const char* data, std::size_t size) {
+		static const std::array<uint32_t, 256> TABLE = [] {
+			std::array<uint32_t, 256> table;
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++) {
+					c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				}
+				table[n] = c;
+			}
+			return table;
+		}();
+		uint32_t crc = 0xffffffffu;
+		for (std::size_t i = 0; i < size; i++) {
+			crc = TABLE[(crc ^ uint8_t(data[i])) & 0xff] ^ (crc >> 8);
+		}
+		return ~crc;
+	}
+
+	void putChunk(std::vector<char> &bytes, const char* type, std::vector<char> const &data) {
+		putUint32BigEndian(bytes, uint32_t(data.size()));
+		std::size_t start = bytes.size();
+		bytes.insert(bytes.end(), type, type + 4);
+		bytes.insert(bytes.end(), data.begin(), data.end());
+		putUint32BigEndian(bytes, crc32(&bytes[start], bytes.size() - start));
+	}
+
+	// Compresses data written a piece at a time into one zlib stream, a
+	// single deflate block with the fixed codes. Only the window the matches
+	// come from is kept, however long the stream gets.
+	class Deflater {
+	public:
+		explicit Deflater(std::vector<char> &out)
+			: out(out), window(2*WINDOW), head(1 << HASH_BITS, -1), previous(WINDOW, -1) {
+			out.push_back(0x78); // deflate with a 32 KB window
+			out.push_back(0x01); // no dictionary, fastest compression level
+			putBits(1, 1); // last block
+			putBits(1, 2); // fixed codes
+		}
+
+		void write(const unsigned char* data, std::size_t size) {
+			updateAdler(data, size);
+			while (size > 0) {
+				std::size_t piece = std::min<std::size_t>(size, WINDOW);
+				if (filled + int(piece) > 2*WINDOW) {
+					slide();
+				}
+				std::memcpy(&window[filled], data, piece);
+				int end = filled + int(piece);
+				compress(filled, end);
+				filled = end;
+				data += piece;
+				size -= piece;
+			}
+		}
+
+		// Ends the stream; nothing can be written after
+		void finish() {
+			putSymbol(256);
+			if (bitCount > 0) {
+				out.push_back(char(bits & 0xff));
+				bits = 0;
+				bitCount = 0;
+			}
+			uint32_t adler = (adlerHigh << 16) | adlerLow;
+			for (int i = 3; i >= 0; i--) {
+				out.push_back(char((adler >> (8*i)) & 0xff));
+			}
+		}
+
+	private:
+		static const int WINDOW = 1 << 15;
+		static const int HASH_BITS = 15;
+		static const int MIN_MATCH = 3;
+		static const int MAX_MATCH = 258;
+		// How many earlier places with the same hash are tried for a match
+		static const int MAX_CHAIN = 16;
+
+		void updateAdler(const unsigned char* data, std::size_t size) {
+			const uint32_t MOD = 65521;
+			// The sums can't overflow over this many bytes before the modulo
+			const std::size_t BLOCK = 5552;
+			while (size > 0) {
+				std::size_t count = std::min(size, BLOCK);
+				for (std::size_t i = 0; i < count; i++) {
+					adlerLow += data[i];
+					adlerHigh += adlerLow;
+				}
+				adlerLow %= MOD;
+				adlerHigh %= MOD;
+				data += count;
+				size -= count;
+			}
+		}
+
+		// Drops the older half of the window to make room for more
+		void slide() {
+			std::memmove(&window[0], &window[WINDOW], WINDOW);
+			filled -= WINDOW;
+			for (int &position : head) {
+				position = position >= WINDOW ? position - WINDOW : -1;
+			}
+			for (int &position : previous) {
+				position = position >= WINDOW ? position - WINDOW : -1;
+			}
+		}
+
+		int hashAt(int position) const {
+			uint32_t value = uint32_t(window[position]) | uint32_t(window[position + 1]) << 8 | uint32_t(window[position + 2]) << 16;
+			return int((value*2654435761u) >> (32 - HASH_BITS));
+		}
+
+		void insert(int position) {
+			int hash = hashAt(position);
+			previous[position & (WINDOW - 1)] = head[hash];
+			head[hash] = position;
+		}
+
+		// The longest earlier copy of the bytes at position, at most as long
+		// as the bytes before end. Returns its length, 0 if under MIN_MATCH.
+		int longestMatch(int position, int end, int &distance) const {
+			if (position + MIN_MATCH > end) {
+				return 0;
+			}
+			int limit = end - position < MAX_MATCH ? end - position : MAX_MATCH;
+			int bestLength = 0;
+			int candidate = head[hashAt(position)];
+			for (int tries = 0; tries < MAX_CHAIN && candidate >= 0 && position - candidate <= WINDOW; tries++) {
+				int length = 0;
+				while (length < limit && window[candidate + length] == window[position + length]) {
+					length++;
+				}
+				if (length > bestLength) {
+					bestLength = length;
+					distance = position - candidate;
+					if (length == limit) {
+						break;
+					}
+				}
+				int next = previous[candidate & (WINDOW - 1)];
+				// Older places are overwritten as the window moves on
+				if (next >= candidate) {
+					break;
+				}
+				candidate = next;
+			}
+			return bestLength >= MIN_MATCH ? bestLength : 0;
+		}
+
+		// Encodes window[begin, end), matching against everything before it.
+		// A match is put off by a byte when the next one along is longer.
+		void compress(int begin, int end) {
+			int p = begin;
+			while (p < end) {
+				int distance = 0;
+				int length = longestMatch(p, end, distance);
+				if (length > 0 && length < MAX_MATCH && p + 1 < end) {
+					insert(p);
+					int nextDistance = 0;
+					if (longestMatch(p + 1, end, nextDistance) > length) {
+						putSymbol(window[p]);
+						p++;
+						continue;
+					}
+					putMatch(length, distance);
+					p++;
+					length--;
+				}
+				else if (length > 0) {
+					putMatch(length, distance);
+				}
+				else {
+					length = 1;
+					putSymbol(window[p]);
+				}
+				for (int i = 0; i < length; i++, p++) {
+					if (p + MIN_MATCH <= end) {
+						insert(p);
+					}
+				}
+			}
+		}
+
+		void putBits(uint32_t value, int count) {
+			bits |= value << bitCount;
+			bitCount += count;
+			while (bitCount >= 8) {
+				out.push_back(char(bits & 0xff));
+				bits >>= 8;
+				bitCount -= 8;
+			}
+		}
+
+		// Huffman codes are stored from their highest bit down
+		void putCode(uint32_t code, int length) {
+			uint32_t reversed = 0;
+			for (int i = 0; i < length; i++) {
+				reversed = (reversed << 1) | ((code >> i) & 1);
+			}
+			putBits(reversed, length);
+		}
+
+		// A literal byte, the end of the block or a length, in the fixed codes
+		void putSymbol(int symbol) {
+			if (symbol < 144) putCode(0x30 + symbol, 8);
+			else if (symbol < 256) putCode(0x190 + symbol - 144, 9);
+			else if (symbol < 280) putCode(symbol - 256, 7);
+			else putCode(0xc0 + symbol - 280, 8);
+		}
+
+		void putMatch(int length, int distance) {
+			static const int LENGTH_BASE[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+				35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			static const int LENGTH_EXTRA[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+				3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			static const int DISTANCE_BASE[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+				257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+			static const int DISTANCE_EXTRA[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+				7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+			int l = 28;
+			while (LENGTH_BASE[l] > length) l--;
+			putSymbol(257 + l);
+			putBits(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+			int d = 29;
+			while (DISTANCE_BASE[d] > distance) d--;
+			putCode(d, 5);
+			putBits(distance - DISTANCE_BASE[d], DISTANCE_EXTRA[d]);
+		}
+
+		std::vector<char> &out;
+		uint32_t bits = 0;
+		int bitCount = 0;
+		uint32_t adlerLow = 1;
+		uint32_t adlerHigh = 0;
+
+		// The bytes matches can come from, then the ones being compressed
+		std::vector<unsigned char> window;
+		int filled = 0;
+		// The last place each hash was seen, and the place before that with
+		// the same hash, by place in the window
+		std::vector<int> head;
+		std::vector<int> previous;
+	};
+
+	int paeth(int a, int b, int c) {
+		int p = a + b - c;
+		int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+		if (pa <= pb && pa <= pc) return a;
+		return pb <= pc ? b : c;
+	}
+
+	// Filters a row of bytes with each of the five filters into best, as the
+	// filter used followed by the filtered bytes, keeping the one whose bytes
+	// read as signed add up smallest. filtered is room to try them in.
+	void filterRow(std::vector<unsigned char> const &row, std::vector<unsigned char> const &above,
+			int bytesPerPixel, std::vector<unsigned char> &filtered, std::vector<unsigned char> &best) {
+		long bestCost = -1;
+		for (int filter = 0; filter < 5; filter++) {
+			filtered[0] = (unsigned char)filter;
+			long cost = 0;
+			for (std::size_t i = 0; i < row.size(); i++) {
+				int left = i >= std::size_t(bytesPerPixel) ? row[i - bytesPerPixel] : 0;
+				int up = above[i];
+				int upLeft = i >= std::size_t(bytesPerPixel) ? above[i - bytesPerPixel] : 0;
+				int predicted = 0;
+				switch (filter) {
+				case 1: predicted = left; break;
+				case 2: predicted = up; break;
+				case 3: predicted = (left + up)/2; break;
+				case 4: predicted = paeth(left, up, upLeft); break;
+				}
+				unsigned char value = (unsigned char)(row[i] - predicted);
+				filtered[1 + i] = value;
+				cost += std::abs(int((signed char)value));
+			}
+			if (bestCost < 0 || cost < bestCost) {
+				bestCost = cost;
+				best.swap(filtered);
+			}
+		}
+	}
+
+	bool writePNG(std::ofstream &out, int width, int height, glm::vec3 const* pixels, ToneMapping toneMapping) {
+		const int COMPONENTS = 3;
+		// Compressed bytes are written out once there are this many
+		const std::size_t CHUNK_SIZE = 1 << 16;
+
+		std::vector<char> chunks = { char(0x89), 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+		std::vector<char> header;
+		putUint32BigEndian(header, uint32_t(width));
+		putUint32BigEndian(header, uint32_t(height));
+		header.push_back(8); // bits per component
+		header.push_back(2); // RGB
+		header.push_back(0); // deflate
+		header.push_back(0); // per row filters
+		header.push_back(0); // not interlaced
+		putChunk(chunks, "IHDR", header);
+		out.write(chunks.data(), chunks.size());
+
+		std::vector<unsigned char> row(std::size_t(width)*COMPONENTS);
+		std::vector<unsigned char> above(row.size(), 0);
+		std::vector<unsigned char> filtered(1 + row.size());
+		std::vector<unsigned char> best(filtered.size());
+		std::vector<char> compressed;
+		Deflater deflater(compressed);
+		bool written = writeRows(out, width, height, pixels, false, [&](int, glm::vec3 const* pixelRow, std::vector<char> &bytes) {
+			for (int x = 0; x < width; x++) {
+				glm::vec3 colour = toneMap(pixelRow[x], toneMapping);
+				for (int c = 0; c < COMPONENTS; c++) {
+					row[x*COMPONENTS + c] = (unsigned char)(255*colour[c]);
+				}
+			}
+			filterRow(row, above, COMPONENTS, filtered, best);
+			deflater.write(best.data(), best.size());
+			row.swap(above);
+			if (compressed.size() >= CHUNK_SIZE) {
+				putChunk(bytes, "IDAT", compressed);
+				compressed.clear();
+			}
+		});
+
+		deflater.finish();
+		chunks.clear();
+		putChunk(chunks, "IDAT", compressed);
+		putChunk(chunks, "IEND", {});
+		out.write(chunks.data(), chunks.size());
+		return written && out;
+	}
+}
+
+bool findToneMapping(const char* name, ToneMapping &toneMapping) {
+	for (auto const &entry : TONE_MAPPINGS) {
+		if (std::strcmp(entry.name, name) == 0) {
+			toneMapping = entry.toneMapping;
+			return true;
+		}
+	}
+	return false;
+}
+
+glm::vec3 toneMap(glm::vec3 colour, ToneMapping toneMapping) {
+	colour = glm::max(colour, glm::vec3(0));
+	switch (toneMapping) {
+	case ToneMapping::Clamp:
+		break;
+	case ToneMapping::Reinhard:
+		colour = colour/(glm::vec3(1) + colour);
+		break;
+	case ToneMapping::ACES:
+		// Narkowicz's fit of the ACES filmic curve
+		colour = (colour*(2.51f*colour + 0.03f))/(colour*(2.43f*colour + 0.59f) + 0.14f);
+		break;
+	}
+	return glm::clamp(colour, 0.f, 1.f);
+}
+
+bool isFloatImageFile(std::string const &fileName) {
+	std::string extension = extensionOf(fileName);
+	return extension == ".pfm" || extension == ".hdr" || extension == ".exr";
+}
+
+bool writeImage(std::string const &fileName, int width, int height, glm::vec3 const* pixels, ToneMapping toneMapping) {
+	std::string extension = extensionOf(fileName);
+	std::ofstream out(fileName, std::ios::binary);
+	bool written;
+	if (extension == ".pfm") {
+		written = writePFM(out, width, height, pixels);
+	}
+	else if (extension == ".hdr") {
+		written = writeRadianceHDR(out, width, height, pixels);
+	}
+	else if (extension == ".exr") {
+		written = writeEXR(out, width, height, pixels);
+	}
+	else {
+		written = writePNG(out, width, height, pixels, toneMapping);
+	}
+	out.close();
+	written = written && out;
+	if (!written) {
+		Log::error("Can't write the image to {}", fileName);
+	}
+	return written;
+}
@@ -0,0 +1,40 @@
+//------------------------------------------------------------------------------
+// Saves rendered images, in 8 bit PNG or in one of the float formats that
+// keep the full range of the render for compositing:
+//
+//   .pfm  Portable Float Map: 32 bit floats, exactly as rendered
+//   .hdr  Radiance RGBE: an 8 bit mantissa per channel and a shared exponent,
+//         run length encoded
+//   .exr  OpenEXR, uncompressed 16 bit half floats
+//
+// Every format is written a row at a time straight from the image, PNG
+// compressing each row as it goes, so saving a huge image needs no second
+// copy of it. The float formats are always linear; tone mapping only
+// applies to PNG, which can't hold values above 1 and so either clips them
+// (the default) or compresses them with a tone mapping operator first.
+//
+// Images are given as ImageBuffer holds them: row by row, bottom row first.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+
+#include <glm/vec3.hpp>
+
+enum class ToneMapping { Clamp, Reinhard, ACES };
+
+// The operator called name: clamp, reinhard or aces. Returns false if
+// there's none.
+bool findToneMapping(const char* name, ToneMapping &toneMapping);
+
+// Maps a linear colour into [0, 1]
+glm::vec3 toneMap(glm::vec3 colour, ToneMapping toneMapping);
+
+// Whether the file's extension is one of the float formats above
+bool isFloatImageFile(std::string const &fileName);
+
+// Saves the width x height image to fileName, in the format its extension
+// names (anything other than the float formats is saved as PNG). Logs and
+// returns false if it can't be written.
+bool writeImage(std::string const &fileName, int width, int height, glm::vec3 const* pixels,
+	ToneMapping toneMapping = ToneMapping::Clamp);
@@ -0,0 +1,103 @@
+#include "Instance.h"
+
+#include <stdexcept>
+
+Prototype::Prototype(std::shared_ptr<Shape> shape)
+	: shape(shape)
+{
+	if (!shape->isBounded()) {
+		throw std::runtime_error("Only bounded shapes can be instanced");
+	}
+	bvh.build({ shape });
+}
+
+Instance::Instance(std::shared_ptr<Prototype const> prototype, glm::mat4 const &objectToWorld, int ID)
+	: shared(prototype)
+	, objectToWorld(objectToWorld)
+	, worldToObject(glm::inverse(objectToWorld))
+	, normalToWorld(glm::transpose(glm::mat3(worldToObject)))
+{
+	id = ID;
+	material = prototype->shape->material;
+	castsShadows = prototype->shape->castsShadows;
+
+	// Box around the corners of the prototype's box
+	AABB local = prototype->bvh.bounds();
+	for (int corner = 0; corner < 8; corner++) {
+		vec3 p(
+			corner & 1 ? local.max.x : local.min.x,
+			corner & 2 ? local.max.y : local.min.y,
+			corner & 4 ? local.max.z : local.min.z
+		);
+		worldBounds.extend(vec3(objectToWorld*vec4(p, 1.f)));
+	}
+}
+
+Ray Instance::toObjectSpace(Ray const &ray) const {
+	return Ray(vec3(worldToObject*vec4(ray.origin, 1.f)), vec3(worldToObject*vec4(ray.direction, 0.f)));
+}
+
+bool Instance::hitPrimitive(Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const {
+	// -1 skips nothing: the prototype's own shape id is never used to skip.
+	// t is the same in both spaces, so the range carries over.
+	Hit inside = shared->bvh.closestHit(toObjectSpace(ray), -1, tMin, tMax);
+	if (!inside.shape) {
+		return false;
+	}
+	hit.t = inside.t;
+	hit.primitive = inside.primitive;
+	hit.u = inside.u;
+	hit.v = inside.v;
+	return true;
+}
+
+Intersection Instance::resolveHit(Ray const &ray, Hit const &hit) const {
+	Hit inside = hit;
+	inside.shape = shared->shape.get();
+	Intersection result = inside.shape->resolveHit(toObjectSpace(ray), inside);
+	// Found on the world ray, rather than moved there
+	result.point = ray.origin + hit.t*ray.direction;
+	result.normal = normalToWorld*result.normal;
+	result.id = id;
+	result.hit = hit;
+	if (overridesMaterial) {
+		result.material = &material;
+	}
+	return result;
+}
+
+SurfaceCoordinates Instance::surfaceCoordinates(Ray const &ray, Hit const &hit) const {
+	Hit inside = hit;
+	inside.shape = shared->shape.get();
+	SurfaceCoordinates result = inside.shape->surfaceCoordinates(toObjectSpace(ray), inside);
+	result.dpdu = vec3(objectToWorld*vec4(result.dpdu, 0.f));
+	result.dpdv = vec3(objectToWorld*vec4(result.dpdv, 0.f));
+	return result;
+}
+
+void Instance::intersectPacket(PacketKernels const &kernels, RayPacket &packet, int id) const {
+	Ray rays[MAX_PACKET_WIDTH];
+	for (int i = 0; i < packet.size; i++) {
+		rays[i] = toObjectSpace(Ray(
+			vec3(packet.originX[i], packet.originY[i], packet.originZ[i]),
+			vec3(packet.directionX[i], packet.directionY[i], packet.directionZ[i])
+		));
+	}
+
+	// Continues from the packet's closest hits so far, including the padding
+	// lanes that can't hit anything
+	RayPacket local;
+	setRayPacket(local, rays, packet.size, kernels.width);
+	local.tMin = packet.tMin;
+	for (int i = 0; i < packet.size; i++) {
+		local.tMax[i] = packet.tMax[i];
+	}
+
+	shared->bvh.closestIntersections(kernels, local, -1);
+	for (int i = 0; i < packet.size; i++) {
+		if (local.hit[i] != -1) {
+			packet.tMax[i] = local.tMax[i];
+			packet.hit[i] = id;
+		}
+	}
+}
@@ -0,0 +1,67 @@
+//------------------------------------------------------------------------------
+// Copies of a shape placed around the scene without copying its geometry.
+//
+// The shape (the prototype) gets a BVH of its own, built once. Each Instance
+// only holds a transform, and is a single primitive in the scene's BVH: when
+// a ray reaches it, the ray is moved into the prototype's own space and
+// traced through the prototype's BVH. So a thousand copies of a mesh cost a
+// thousand transforms, not a thousand copies of its triangles.
+//
+// The ray direction is transformed without normalizing it, so the ray
+// parameter t of a hit is the same in both spaces and hits from instances
+// and other shapes can be compared directly.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <memory>
+
+#include "BVH.h"
+#include "RayTrace.h"
+
+// A shape and the BVH over it, shared by all of its instances
+struct Prototype {
+	// Builds the BVH over the shape, which must be bounded. Throws
+	// std::runtime_error if it isn't.
+	explicit Prototype(std::shared_ptr<Shape> shape);
+	// For filling in by hand, e.g. with a BVH borrowed from a scene cache
+	Prototype() = default;
+
+	std::shared_ptr<Shape> shape;
+	BVH bvh;
+};
+
+class Instance : public Shape {
+public:
+	// objectToWorld places the prototype in the scene, and must be
+	// invertible. The instance uses the prototype's material unless
+	// overridesMaterial is set, then its own.
+	Instance(std::shared_ptr<Prototype const> prototype, glm::mat4 const &objectToWorld, int ID);
+
+	bool overridesMaterial = false;
+
+	std::shared_ptr<Prototype const> const &prototype() const { return shared; }
+	glm::mat4 const &transform() const { return objectToWorld; }
+
+	Intersection getIntersection(Ray ray) { return intersectPrimitive(ray, 0); }
+	AABB primitiveBounds(int primitive) const { return worldBounds; }
+	// The hit keeps the primitive and coordinates of what was hit inside the
+	// prototype, for resolveHit() to hand back to the prototype's shape
+	bool hitPrimitive(Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const;
+	Intersection resolveHit(Ray const &ray, Hit const &hit) const;
+	SurfaceCoordinates surfaceCoordinates(Ray const &ray, Hit const &hit) const;
+
+	// Traces the packet through the prototype's BVH with the SIMD kernels.
+	// Lanes that hit it closer than their tMax get their tMax and hit set to
+	// t and id.
+	void intersectPacket(PacketKernels const &kernels, RayPacket &packet, int id) const;
+
+private:
+	Ray toObjectSpace(Ray const &ray) const;
+
+	std::shared_ptr<Prototype const> shared;
+	glm::mat4 objectToWorld;
+	glm::mat4 worldToObject;
+	// Normals go to world space with the inverse transpose
+	glm::mat3 normalToWorld;
+	AABB worldBounds;
+};
@@ -0,0 +1,17 @@
+#include "Integrator.h"
+
+#include <algorithm>
+
+#include "PathTracer.h"
+#include "WhittedIntegrator.h"
+
+std::shared_ptr<Integrator const> createIntegrator(std::string const &name, IntegratorSettings const &settings) {
+	if (name == "whitted") return std::make_shared<WhittedIntegrator>(settings);
+	if (name == "path") return std::make_shared<PathTracer>(settings);
+	return nullptr;
+}
+
+glm::vec3 offsetFromSurface(glm::vec3 point, glm::vec3 normal) {
+	glm::vec3 size = glm::abs(point);
+	return point + 1e-4f*std::max({1.f, size.x, size.y, size.z})*normal;
+}
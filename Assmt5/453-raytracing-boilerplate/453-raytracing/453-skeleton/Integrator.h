@@ -0,0 +1,78 @@
+//------------------------------------------------------------------------------
+// Integrators: what colour a camera ray sees, given the shape it hit.
+//
+// The renderer finds the closest hits of the primary rays itself (as SIMD
+// packets where it can) and hands each one to the render's integrator, which
+// shades it and traces whatever other rays it needs. Every integrator traces
+// through the scene's BVH and runs inside the same tiles, so they differ only
+// in the light transport they compute:
+//
+//   whitted  the assignment's ray tracer: Phong shading, shadows, mirror
+//            reflections and an ambient term standing in for everything else
+//   path     a path tracer, for global illumination (see PathTracer.h)
+//
+// Integrators are immutable once made, so one can be shared by all of the
+// threads of a render, and each render can use a different one.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <glm/glm.hpp>
+
+#include "RayDifferential.h"
+#include "RayStatistics.h"
+#include "RayTrace.h"
+#include "Sampler.h"
+#include "Scene.h"
+
+struct IntegratorSettings {
+	// Most bounces a path can take, at most RayStatistics::MAX_DEPTH
+	int maxDepth = 5;
+	// Once a path carries less than this much light (the largest channel of
+	// the product of the reflectances along it), Russian roulette starts
+	// ending it early. Surviving paths are weighted up to make up for the
+	// ones that ended, so the image stays correct on average. 0 turns
+	// Russian roulette off.
+	float rouletteThreshold = 0.1f;
+	// Shadow rays per hit. Scenes with at most this many lights have every
+	// light sampled at every hit; scenes with more have this many picked at
+	// random, in proportion to their power.
+	int lightSamplesPerHit = 1;
+};
+
+// State carried down the rays of one sample
+struct PathContext {
+	Sampler &sampler;
+	RayStatistics &statistics;
+	// Of the ray being shaded, for filtering textures. Integrators update
+	// it as they bounce.
+	RayDifferential differential;
+};
+
+class Integrator {
+public:
+	explicit Integrator(IntegratorSettings const &settings) : settings(settings) {}
+	virtual ~Integrator() = default;
+
+	virtual const char* name() const = 0;
+
+	// Colour seen along the camera ray, which has already been traced and
+	// hit `hit` (numberOfIntersections is 0 if it hit nothing). The ray
+	// itself is counted by the caller, anything traced from here on by the
+	// integrator.
+	virtual glm::vec3 shade(Scene const &scene, Ray const &ray, Intersection const &hit, PathContext &path) const = 0;
+
+	IntegratorSettings const settings;
+};
+
+// Where rays leaving a hit at point start: a little off the surface along
+// normal, which must face the side they leave by. Offsetting rather than
+// skipping the whole shape lets a mesh shadow and reflect itself. The error
+// in the hit point grows with its size, and so does the offset.
+glm::vec3 offsetFromSurface(glm::vec3 point, glm::vec3 normal);
+
+// The integrator called name ("whitted" or "path"), or nullptr if there's
+// no such integrator
+std::shared_ptr<Integrator const> createIntegrator(std::string const &name, IntegratorSettings const &settings);
@@ -0,0 +1,190 @@
+#include "Light.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+float Light::power() const {
+	// Lights don't fall off with distance, so every point a light reaches
+	// gets its whole colour, and what tells lights apart is how bright they
+	// are and how much of the scene they reach
+	float brightness = (colour.r + colour.g + colour.b)/3.f;
+	switch (type) {
+	case Spot:
+		// Only reaches the share of directions inside its outer cone. Picked
+		// in proportion to the square root of that rather than the share
+		// itself: the noise from a light is its colour squared over how
+		// likely it is to be picked, summed over the points it reaches, and
+		// that's least when the chance goes with the root of how many those
+		// are. Picking a spot as rarely as it reaches points would leave its
+		// cone full of fireflies.
+		return brightness*std::sqrt((1.f - cosOuter)/2.f);
+	case Rectangle:
+	case Sphere:
+		// Lighting a point a unit away, facing it, like a point light of
+		// this colour times area/pi. The path tracer's area lights do fall
+		// off, so that's as bright as they are for nearby surfaces.
+		return brightness*area()/3.14159265f;
+	default:
+		return brightness;
+	}
+}
+
+float Light::area() const {
+	if (type == Rectangle) {
+		return glm::length(glm::cross(edge1, edge2));
+	}
+	if (type == Sphere) {
+		return 4.f*3.14159265f*radius*radius;
+	}
+	return 0;
+}
+
+LightSample sampleLight(Light const &light, glm::vec3 point, Sampler &sampler) {
+	LightSample sample;
+	sample.atInfinity = false;
+	sample.colour = light.colour;
+	sample.normal = glm::vec3(0);
+	sample.areaDensity = 0;
+
+	if (light.isArea() && !light.hasArea()) {
+		// Nothing to sample a point on, so it gives no light
+		sample.position = light.position;
+		sample.toLight = glm::normalize(light.position - point);
+		sample.colour = glm::vec3(0);
+		return sample;
+	}
+
+	switch (light.type) {
+	case Light::Point:
+	case Light::Spot:
+		sample.position = light.position;
+		break;
+	case Light::Directional:
+		sample.toLight = -light.direction;
+		sample.position = point;
+		sample.atInfinity = true;
+		return sample;
+	case Light::Rectangle: {
+		float u = sampler.nextFloat();
+		float v = sampler.nextFloat();
+		sample.position = light.position + u*light.edge1 + v*light.edge2;
+		sample.normal = glm::normalize(glm::cross(light.edge1, light.edge2));
+		sample.areaDensity = 1.f/light.area();
+		break;
+	}
+	case Light::Sphere: {
+		// Uniform on the sphere, then moved to the half facing the point,
+		// since the far half is never what lights it
+		float z = 1.f - 2.f*sampler.nextFloat();
+		float phi = 2.f*3.14159265f*sampler.nextFloat();
+		float r = std::sqrt(std::max(0.f, 1.f - z*z));
+		glm::vec3 d(r*std::cos(phi), r*std::sin(phi), z);
+		if (glm::dot(d, point - light.position) < 0) {
+			d = -d;
+		}
+		sample.position = light.position + light.radius*d;
+		sample.normal = d;
+		sample.areaDensity = 2.f/light.area();
+		break;
+	}
+	}
+
+	sample.toLight = glm::normalize(sample.position - point);
+	if (light.type == Light::Spot) {
+		// Full inside the inner cone, fading smoothly to nothing at the outer
+		float cosAngle = glm::dot(-sample.toLight, light.direction);
+		float fade = light.cosInner > light.cosOuter
+			? glm::smoothstep(light.cosOuter, light.cosInner, cosAngle)
+			: (cosAngle >= light.cosOuter ? 1.f : 0.f);
+		sample.colour *= fade;
+	}
+	return sample;
+}
+
+float intersectAreaLight(Light const &light, Ray const &ray) {
+	const float NONE = std::numeric_limits<float>::infinity();
+	if (light.type == Light::Rectangle) {
+		glm::vec3 normal = glm::cross(light.edge1, light.edge2);
+		float facing = glm::dot(normal, ray.direction);
+		if (facing == 0) {
+			return NONE;
+		}
+		float t = glm::dot(normal, light.position - ray.origin)/facing;
+		if (t <= 0) {
+			return NONE;
+		}
+		// Where the hit is along each edge, as a fraction of it
+		glm::vec3 offset = ray.origin + t*ray.direction - light.position;
+		float u = glm::dot(offset, light.edge1)/glm::dot(light.edge1, light.edge1);
+		float v = glm::dot(offset, light.edge2)/glm::dot(light.edge2, light.edge2);
+		return u >= 0 && u <= 1 && v >= 0 && v <= 1 ? t : NONE;
+	}
+	if (light.type == Light::Sphere) {
+		glm::vec3 offset = ray.origin - light.position;
+		float a = glm::dot(ray.direction, ray.direction);
+		float b = glm::dot(offset, ray.direction);
+		float c = glm::dot(offset, offset) - light.radius*light.radius;
+		float discriminant = b*b - a*c;
+		if (discriminant < 0) {
+			return NONE;
+		}
+		float root = std::sqrt(discriminant);
+		float t = (-b - root)/a;
+		if (t <= 0) {
+			t = (-b + root)/a;
+		}
+		return t > 0 ? t : NONE;
+	}
+	return NONE;
+}
+
+void LightDistribution::build(std::vector<Light> const &lights) {
+	cumulative.clear();
+	float total = 0;
+	int usable = 0;
+	for (Light const &light : lights) {
+		total += std::max(0.f, light.power());
+		cumulative.push_back(total);
+		if (!light.isArea() || light.hasArea()) {
+			usable++;
+		}
+	}
+	// All dark: pick them uniformly instead, except for area lights without
+	// an area, which give no light however bright they are
+	if (total <= 0 && usable > 0) {
+		int seen = 0;
+		for (size_t i = 0; i < lights.size(); i++) {
+			if (!lights[i].isArea() || lights[i].hasArea()) {
+				seen++;
+			}
+			cumulative[i] = float(seen);
+		}
+		total = float(usable);
+	}
+	for (size_t i = 0; i < cumulative.size(); i++) {
+		cumulative[i] = total > 0 ? cumulative[i]/total : float(i + 1)/cumulative.size();
+	}
+	if (!cumulative.empty()) {
+		cumulative.back() = 1;
+	}
+}
+
+int LightDistribution::pick(Sampler &sampler, float &probability) const {
+	if (cumulative.size() == 1) {
+		probability = 1;
+		return 0;
+	}
+	// The first light whose running total passes the random number. Lights
+	// without power have the same total as the one before and are never
+	// picked.
+	float u = sampler.nextFloat();
+	int index = int(std::upper_bound(cumulative.begin(), cumulative.end(), u) - cumulative.begin());
+	index = std::min(index, int(cumulative.size()) - 1);
+	probability = this->probability(index);
+	return index;
+}
+
+float LightDistribution::probability(int light) const {
+	return cumulative[light] - (light > 0 ? cumulative[light - 1] : 0.f);
+}
@@ -0,0 +1,102 @@
+//------------------------------------------------------------------------------
+// The lights of a scene, and picking which of them to sample at a hit.
+//
+// Lights follow the assignment's model: a light's colour is what it shines
+// on every point it reaches, without falling off with distance, and its
+// ambient factor adds that much of its colour everywhere regardless of
+// shadows. Besides points there are directional lights (infinitely far
+// away, like the sun), spot lights (a point shining in a cone) and area
+// lights (rectangles and spheres). An area light is sampled at a random
+// point on it for every shadow ray, which softens its shadows as samples
+// accumulate. Lights aren't shapes, so rays never hit them.
+//
+// Tracing a shadow ray to every light at every hit gets expensive with many
+// lights, so each hit instead samples a few of them, picked at random in
+// proportion to their power, and weights what they give by how unlikely
+// they were to be picked. The image is the same on average, at the cost of
+// some noise that more samples per pixel smooth out.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "RayTrace.h"
+#include "Sampler.h"
+
+struct Light {
+	enum Type { Point, Directional, Spot, Rectangle, Sphere };
+	Type type = Point;
+
+	glm::vec3 colour = glm::vec3(1);
+	float ambient = 0;
+
+	// Point and spot lights: where the light is. Rectangles: a corner.
+	// Spheres: the centre.
+	glm::vec3 position = glm::vec3(0);
+	// Directional and spot lights: which way the light shines. Normalized.
+	glm::vec3 direction = glm::vec3(0, -1, 0);
+	// Spot lights: cosines of the angles from the direction where the light
+	// starts fading out and where it's gone
+	float cosInner = 1;
+	float cosOuter = 0;
+	// Rectangles: the edges from the corner
+	glm::vec3 edge1 = glm::vec3(0);
+	glm::vec3 edge2 = glm::vec3(0);
+	// Spheres
+	float radius = 0;
+
+	// How much the light contributes, for picking lights in proportion to it
+	float power() const;
+
+	// Rectangles and spheres have a surface that rays can hit
+	bool isArea() const { return type == Rectangle || type == Sphere; }
+	float area() const;
+	// Area lights with no area (a rectangle without edges, a sphere without
+	// a radius) give no light, are never picked and can't be hit
+	bool hasArea() const { return area() > 0; }
+};
+
+// Light arriving at a point from one light
+struct LightSample {
+	// Unit vector from the point towards the light
+	glm::vec3 toLight;
+	// Where the light came from, unless it's at infinity
+	glm::vec3 position;
+	bool atInfinity;
+	// The light's colour, after the spot light's falloff
+	glm::vec3 colour;
+	// Area lights: the surface normal at position, and the probability
+	// density of having picked position, per unit area
+	glm::vec3 normal;
+	float areaDensity;
+};
+
+// Samples the light as seen from point. Point, directional and spot lights
+// draw no random numbers, so a scene with one point light renders exactly
+// as it would without sampling.
+LightSample sampleLight(Light const &light, glm::vec3 point, Sampler &sampler);
+
+// The ray parameter where the ray hits the area light, or infinity if it
+// doesn't (or the light isn't an area light). Rectangles light both sides.
+float intersectAreaLight(Light const &light, Ray const &ray);
+
+// Picks lights at random in proportion to their power
+class LightDistribution {
+public:
+	void build(std::vector<Light> const &lights);
+
+	// The index of the light picked and the probability of picking it. With
+	// a single light that's always it, and no random number is drawn.
+	int pick(Sampler &sampler, float &probability) const;
+
+	// The probability of pick() returning the light
+	float probability(int light) const;
+
+	bool empty() const { return cumulative.empty(); }
+
+private:
+	// Running totals of the lights' power, the last one being 1
+	std::vector<float> cumulative;
+};
@@ -5,39 +5,42 @@
 
 #include <glm/glm.hpp>
 
-#include "Scene.h"
+#include "RayTrace.h"
 #include "Material.h"
 
 struct PhongReflection {
 	// Information about the point we're shading
 	Intersection intersection;
 
-	// The point's material parameters
-	ObjectMaterial material;
+	// The point's material parameters, owned by the shape
+	ObjectMaterial const* material = nullptr;
 
 	// Information about the ray being used.
 	Ray ray;
 
-	// Information about the scene
-	Scene scene;
+	// The light being shaded with, see sampleLight()
+	glm::vec3 toLight;
+	glm::vec3 lightColour;
+	// Ambient light from all of the scene's lights
+	glm::vec3 ambientLight;
 
 
 	// Helper methods to name things the same as lecture
-	glm::vec3 l() const { return glm::normalize(scene.lightPosition - p()); } // light vector
+	glm::vec3 l() const { return toLight; } // light vector
 	glm::vec3 n() const { return glm::normalize(intersection.normal); } // normal
 	glm::vec3 p() const { return intersection.point; } // point
 	glm::vec3 v() const { return glm::normalize(ray.origin - p()); } // view direction
 	glm::vec3 r() const { return -glm::reflect(l(), n()); } // reflected light vector
 
-	glm::vec3 La() const { return scene.ambientFactor*scene.lightColor; } // Light ambient
-	glm::vec3 Ld() const { return scene.lightColor; } // Light diffuse
-	glm::vec3 Ls() const { return scene.lightColor; } // Light specular
+	glm::vec3 La() const { return ambientLight; } // Light ambient
+	glm::vec3 Ld() const { return lightColour; } // Light diffuse
+	glm::vec3 Ls() const { return lightColour; } // Light specular
 
-	glm::vec3 Ka() const { return material.ambient; } // Material ambient
-	glm::vec3 Kd() const { return material.diffuse; } // Material diffuse
-	glm::vec3 Ks() const { return material.specular; } // Material specular
+	glm::vec3 Ka() const { return material->ambient; } // Material ambient
+	glm::vec3 Kd() const { return material->diffuse; } // Material diffuse
+	glm::vec3 Ks() const { return material->specular; } // Material specular
 
-	float alpha() const { return material.specularCoefficient; }
+	float alpha() const { return material->specularCoefficient; }
 
 	// Calculate the ambient factor.
 	glm::vec3 Ia() const {
@@ -73,5 +76,10 @@ struct PhongReflection {
 	glm::vec3 I() const {
 		return Id() + Is() + Ia();
 	}
+
+	// Just the light's own part, without the ambient that every light adds
+	glm::vec3 direct() const {
+		return Id() + Is();
+	}
 };
 
@@ -0,0 +1,89 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(std::string const &path) {
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		file = nullptr;
+		throw std::runtime_error("Can't open " + path);
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		throw std::runtime_error("Can't get the size of " + path);
+	}
+	length = std::size_t(fileSize.QuadPart);
+	if (length == 0) {
+		return; // can't map an empty file, and there's nothing to read anyway
+	}
+
+	mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping) {
+		bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	}
+	if (!bytes) {
+		if (mapping) CloseHandle(mapping);
+		CloseHandle(file);
+		throw std::runtime_error("Can't map " + path + " into memory");
+	}
+}
+
+MappedFile::~MappedFile() {
+	if (bytes) UnmapViewOfFile(bytes);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+}
+
+#else
+
+MappedFile::MappedFile(std::string const &path) {
+	int descriptor = open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		throw std::runtime_error("Can't open " + path);
+	}
+
+	struct stat status;
+	if (fstat(descriptor, &status) != 0) {
+		close(descriptor);
+		throw std::runtime_error("Can't get the size of " + path);
+	}
+	length = std::size_t(status.st_size);
+	if (length == 0) {
+		close(descriptor);
+		return; // can't map an empty file, and there's nothing to read anyway
+	}
+
+	void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+	// The mapping keeps the file alive on its own
+	close(descriptor);
+	if (address == MAP_FAILED) {
+		throw std::runtime_error("Can't map " + path + " into memory");
+	}
+	// It's about to be read from start to end, by several threads
+	madvise(address, length, MADV_WILLNEED);
+	bytes = static_cast<const char*>(address);
+}
+
+MappedFile::~MappedFile() {
+	if (bytes) {
+		munmap(const_cast<char*>(bytes), length);
+	}
+}
+
+#endif
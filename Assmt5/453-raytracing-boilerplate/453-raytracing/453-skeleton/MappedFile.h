@@ -0,0 +1,32 @@
+//------------------------------------------------------------------------------
+// A read-only file mapped into memory.
+//
+// The operating system pages the file in as it is read, straight from its
+// cache, so big files can be parsed in place (and by several threads at
+// once) without first being copied into a buffer.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+class MappedFile {
+public:
+	// Throws std::runtime_error if the file can't be opened or mapped
+	explicit MappedFile(std::string const &path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile operator=(const MappedFile&) = delete;
+
+	const char* data() const { return bytes; }
+	std::size_t size() const { return length; }
+
+private:
+	const char* bytes = nullptr;
+	std::size_t length = 0;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* mapping = nullptr;
+#endif
+};
@@ -3,8 +3,12 @@
 //------------------------------------------------------------------------------
 #pragma once
 
+#include <memory>
+
 #include <glm/glm.hpp>
 
+class SurfaceTexture;
+
 // This object represents the "material" that is covering an object.
 // Like its colour, reflection parameter and its specular parameters
 struct ObjectMaterial {
@@ -14,6 +18,13 @@ struct ObjectMaterial {
 	glm::vec3 reflectionStrength;
 	float specularCoefficient = 0;
 
+	// Varies the diffuse and ambient colours over the surface, multiplying
+	// them, or nullptr for plain colours. See SurfaceTexture.h for looking
+	// up the material at a hit.
+	std::shared_ptr<SurfaceTexture const> diffuseTexture;
+
+	bool isTextured() const { return diffuseTexture != nullptr; }
+
 	ObjectMaterial()
 		: ambient(0.0, 0.0, 0.0)
 		, diffuse(0, 0, 0)
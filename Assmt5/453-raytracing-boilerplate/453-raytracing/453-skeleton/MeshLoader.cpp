@@ -0,0 +1,821 @@
+#include "MeshLoader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "Log.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+namespace {
+	// Text is parsed in chunks of about this many bytes, and binary faces
+	// this many at a time, each chunk on its own thread
+	const std::size_t CHUNK_BYTES = 1 << 20;
+	const std::size_t CHUNK_FACES = 1 << 16;
+
+	// Runs task(i) for i = 0 .. count-1 on the thread pool. If any of them
+	// throws, the exception of the first one (in file order) is rethrown.
+	void forEachChunk(int count, std::function<void(int)> const &task) {
+		std::vector<std::exception_ptr> errors(count);
+		ThreadPool::global().parallelFor(count, [&](int i) {
+			try {
+				task(i);
+			}
+			catch (...) {
+				errors[i] = std::current_exception();
+			}
+		});
+		for (std::exception_ptr const &error : errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+	}
+
+	//--------------------------------------------------------------------------
+	// Wavefront OBJ
+
+	bool isDigit(char c) { return c >= '0' && c <= '9'; }
+	bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	const char* skipBlanks(const char* p, const char* end) {
+		while (p < end && isBlank(*p)) p++;
+		return p;
+	}
+
+	const char* endOfLine(const char* p, const char* end) {
+		const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+		return newline ? newline : end;
+	}
+
+	// Parses a decimal number like -1.25e-3. Done by hand because strtof
+	// needs a terminated string, depends on the locale and is slow.
+	bool parseFloat(const char* &p, const char* end, float &value) {
+		static const double powersOfTen[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+
+		const char* q = skipBlanks(p, end);
+		bool negative = false;
+		if (q < end && (*q == '-' || *q == '+')) {
+			negative = *q == '-';
+			q++;
+		}
+
+		// Up to 19 significant digits fit in the mantissa, the rest only
+		// move the decimal point
+		uint64_t mantissa = 0;
+		int digits = 0;
+		int exponent = 0;
+		bool any = false;
+		for (; q < end && isDigit(*q); q++) {
+			any = true;
+			if (digits < 19) {
+				mantissa = mantissa*10 + uint64_t(*q - '0');
+				digits += mantissa != 0;
+			}
+			else {
+				exponent++;
+			}
+		}
+		if (q < end && *q == '.') {
+			for (q++; q < end && isDigit(*q); q++) {
+				any = true;
+				if (digits < 19) {
+					mantissa = mantissa*10 + uint64_t(*q - '0');
+					digits += mantissa != 0;
+					exponent--;
+				}
+			}
+		}
+		if (!any) {
+			return false;
+		}
+		if (q < end && (*q == 'e' || *q == 'E')) {
+			const char* e = q + 1;
+			bool negativeExponent = false;
+			if (e < end && (*e == '-' || *e == '+')) {
+				negativeExponent = *e == '-';
+				e++;
+			}
+			if (e < end && isDigit(*e)) {
+				int value = 0;
+				for (; e < end && isDigit(*e); e++) {
+					value = std::min(value*10 + (*e - '0'), 100000);
+				}
+				exponent += negativeExponent ? -value : value;
+				q = e;
+			}
+		}
+
+		double result = double(mantissa);
+		if (exponent >= 0 && exponent <= 22) result *= powersOfTen[exponent];
+		else if (exponent < 0 && exponent >= -22) result /= powersOfTen[-exponent];
+		else result *= std::pow(10.0, double(exponent));
+		value = float(negative ? -result : result);
+		p = q;
+		return true;
+	}
+
+	bool parseInteger(const char* &p, const char* end, long long &value) {
+		const char* q = p;
+		bool negative = false;
+		if (q < end && (*q == '-' || *q == '+')) {
+			negative = *q == '-';
+			q++;
+		}
+		if (q == end || !isDigit(*q)) {
+			return false;
+		}
+		long long result = 0;
+		for (; q < end && isDigit(*q); q++) {
+			result = result*10 + (*q - '0');
+		}
+		value = negative ? -result : result;
+		p = q;
+		return true;
+	}
+
+	// What a line of the file defines
+	enum class OBJLine { Position, Normal, UV, Face, Other };
+
+	// Advances p past the keyword
+	OBJLine objLineType(const char* &p, const char* end) {
+		p = skipBlanks(p, end);
+		if (p + 1 >= end) {
+			return OBJLine::Other;
+		}
+		if (p[0] == 'v') {
+			if (isBlank(p[1])) { p += 1; return OBJLine::Position; }
+			if (p + 2 < end && p[1] == 'n' && isBlank(p[2])) { p += 2; return OBJLine::Normal; }
+			if (p + 2 < end && p[1] == 't' && isBlank(p[2])) { p += 2; return OBJLine::UV; }
+		}
+		else if (p[0] == 'f' && isBlank(p[1])) {
+			p += 1;
+			return OBJLine::Face;
+		}
+		return OBJLine::Other;
+	}
+
+	struct OBJChunk {
+		const char* begin;
+		const char* end;
+
+		// Counts of what the chunk defines, and then the totals over all the
+		// chunks before it, i.e. where its items go in the arrays
+		std::size_t lines = 0, positions = 0, normals = 0, uvs = 0, triangles = 0;
+		std::size_t firstLine = 0, firstPosition = 0, firstNormal = 0, firstUV = 0, firstTriangle = 0;
+	};
+
+	// One corner of a face: indices into the position, normal and uv arrays,
+	// -1 if not given
+	struct OBJCorner {
+		long long position;
+		long long uv;
+		long long normal;
+	};
+
+	std::runtime_error objError(std::string const &path, std::size_t line, std::string const &message) {
+		return std::runtime_error(path + ":" + std::to_string(line) + ": " + message);
+	}
+
+	// Turns a 1-based (or, if negative, relative to the end so far) index
+	// into a 0-based one, checking it exists
+	long long resolveIndex(long long index, std::size_t definedSoFar, std::size_t total) {
+		long long resolved = index > 0 ? index - 1 : (long long)definedSoFar + index;
+		return index != 0 && resolved >= 0 && resolved < (long long)total ? resolved : -2;
+	}
+}
+
+void loadOBJ(std::string const &path, TriangleMesh &mesh) {
+	MappedFile file(path);
+	const char* fileEnd = file.data() + file.size();
+
+	// Split into chunks of whole lines
+	std::vector<OBJChunk> chunks;
+	for (const char* p = file.data(); p < fileEnd;) {
+		const char* end = p + std::min(CHUNK_BYTES, std::size_t(fileEnd - p));
+		if (end < fileEnd) {
+			end = endOfLine(end, fileEnd);
+			end += end < fileEnd;
+		}
+		OBJChunk chunk;
+		chunk.begin = p;
+		chunk.end = end;
+		chunks.push_back(chunk);
+		p = end;
+	}
+	int chunkCount = int(chunks.size());
+
+	// Pass 1: count everything, to know where each chunk's items go
+	forEachChunk(chunkCount, [&](int i) {
+		OBJChunk &chunk = chunks[i];
+		for (const char* line = chunk.begin; line < chunk.end;) {
+			const char* lineEnd = endOfLine(line, chunk.end);
+			const char* p = line;
+			switch (objLineType(p, lineEnd)) {
+			case OBJLine::Position: chunk.positions++; break;
+			case OBJLine::Normal: chunk.normals++; break;
+			case OBJLine::UV: chunk.uvs++; break;
+			case OBJLine::Face: {
+				std::size_t corners = 0;
+				while ((p = skipBlanks(p, lineEnd)) < lineEnd && *p != '#') {
+					corners++;
+					while (p < lineEnd && !isBlank(*p)) p++;
+				}
+				chunk.triangles += corners >= 3 ? corners - 2 : 0;
+				break;
+			}
+			case OBJLine::Other: break;
+			}
+			chunk.lines++;
+			line = lineEnd + 1;
+		}
+	});
+
+	OBJChunk totals{};
+	for (OBJChunk &chunk : chunks) {
+		chunk.firstLine = totals.lines;
+		chunk.firstPosition = totals.positions;
+		chunk.firstNormal = totals.normals;
+		chunk.firstUV = totals.uvs;
+		chunk.firstTriangle = totals.triangles;
+		totals.lines += chunk.lines;
+		totals.positions += chunk.positions;
+		totals.normals += chunk.normals;
+		totals.uvs += chunk.uvs;
+		totals.triangles += chunk.triangles;
+	}
+	if (totals.triangles > std::size_t(std::numeric_limits<int>::max())) {
+		throw std::runtime_error(path + ": too many triangles");
+	}
+
+	// Pass 2: the vertex attributes
+	std::vector<vec3> positions(totals.positions);
+	std::vector<vec3> normals(totals.normals);
+	std::vector<vec2> uvs(totals.uvs);
+	forEachChunk(chunkCount, [&](int i) {
+		OBJChunk const &chunk = chunks[i];
+		std::size_t line = chunk.firstLine;
+		vec3* position = positions.data() + chunk.firstPosition;
+		vec3* normal = normals.data() + chunk.firstNormal;
+		vec2* uv = uvs.data() + chunk.firstUV;
+		for (const char* p = chunk.begin; p < chunk.end; line++) {
+			const char* lineEnd = endOfLine(p, chunk.end);
+			switch (objLineType(p, lineEnd)) {
+			case OBJLine::Position: {
+				vec3 &v = *position++;
+				if (!parseFloat(p, lineEnd, v.x) || !parseFloat(p, lineEnd, v.y) || !parseFloat(p, lineEnd, v.z)) {
+					throw objError(path, line + 1, "bad vertex position");
+				}
+				break;
+			}
+			case OBJLine::Normal: {
+				vec3 &n = *normal++;
+				if (!parseFloat(p, lineEnd, n.x) || !parseFloat(p, lineEnd, n.y) || !parseFloat(p, lineEnd, n.z)) {
+					throw objError(path, line + 1, "bad vertex normal");
+				}
+				break;
+			}
+			case OBJLine::UV: {
+				// The second coordinate is optional
+				vec2 &t = *uv++;
+				if (!parseFloat(p, lineEnd, t.x)) {
+					throw objError(path, line + 1, "bad texture coordinate");
+				}
+				if (!parseFloat(p, lineEnd, t.y)) {
+					t.y = 0;
+				}
+				break;
+			}
+			default: break;
+			}
+			p = lineEnd + 1;
+		}
+	});
+
+	// Pass 3: the faces, split into fans of triangles
+	mesh.resize(int(totals.triangles), !normals.empty(), !uvs.empty());
+	forEachChunk(chunkCount, [&](int i) {
+		OBJChunk const &chunk = chunks[i];
+		std::size_t line = chunk.firstLine;
+		std::size_t positionsSoFar = chunk.firstPosition;
+		std::size_t normalsSoFar = chunk.firstNormal;
+		std::size_t uvsSoFar = chunk.firstUV;
+		int triangle = int(chunk.firstTriangle);
+		std::vector<OBJCorner> corners;
+
+		for (const char* p = chunk.begin; p < chunk.end; line++) {
+			const char* lineEnd = endOfLine(p, chunk.end);
+			OBJLine type = objLineType(p, lineEnd);
+			if (type == OBJLine::Position) positionsSoFar++;
+			else if (type == OBJLine::Normal) normalsSoFar++;
+			else if (type == OBJLine::UV) uvsSoFar++;
+			if (type != OBJLine::Face) {
+				p = lineEnd + 1;
+				continue;
+			}
+
+			// Corners are v, v/vt, v//vn or v/vt/vn
+			corners.clear();
+			while ((p = skipBlanks(p, lineEnd)) < lineEnd && *p != '#') {
+				OBJCorner corner{ -1, -1, -1 };
+				long long index;
+				if (!parseInteger(p, lineEnd, index)) {
+					throw objError(path, line + 1, "bad face");
+				}
+				corner.position = resolveIndex(index, positionsSoFar, positions.size());
+				if (p < lineEnd && *p == '/') {
+					p++;
+					if (parseInteger(p, lineEnd, index)) {
+						corner.uv = resolveIndex(index, uvsSoFar, uvs.size());
+					}
+					if (p < lineEnd && *p == '/') {
+						p++;
+						if (!parseInteger(p, lineEnd, index)) {
+							throw objError(path, line + 1, "bad face");
+						}
+						corner.normal = resolveIndex(index, normalsSoFar, normals.size());
+					}
+				}
+				if (corner.position < 0 || corner.uv < -1 || corner.normal < -1) {
+					throw objError(path, line + 1, "face refers to a vertex that doesn't exist");
+				}
+				if (p < lineEnd && !isBlank(*p)) {
+					throw objError(path, line + 1, "bad face");
+				}
+				corners.push_back(corner);
+			}
+
+			for (std::size_t c = 1; c + 1 < corners.size(); c++, triangle++) {
+				OBJCorner const &a = corners[0];
+				OBJCorner const &b = corners[c];
+				OBJCorner const &d = corners[c + 1];
+				mesh.set(triangle, positions[a.position], positions[b.position], positions[d.position]);
+				if (mesh.hasNormals()) {
+					// Corners without a normal get the triangle's own
+					vec3 n = mesh.normal(triangle);
+					mesh.setNormals(triangle,
+						a.normal >= 0 ? normals[a.normal] : n,
+						b.normal >= 0 ? normals[b.normal] : n,
+						d.normal >= 0 ? normals[d.normal] : n);
+				}
+				if (mesh.hasUVs()) {
+					mesh.setUVs(triangle,
+						a.uv >= 0 ? uvs[a.uv] : vec2(0),
+						b.uv >= 0 ? uvs[b.uv] : vec2(0),
+						d.uv >= 0 ? uvs[d.uv] : vec2(0));
+				}
+			}
+			p = lineEnd + 1;
+		}
+	});
+}
+
+//------------------------------------------------------------------------------
+// Binary PLY (http://paulbourke.net/dataformats/ply/)
+
+namespace {
+	enum class PLYType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+	bool parsePLYType(std::string const &name, PLYType &type) {
+		if (name == "char" || name == "int8") type = PLYType::Int8;
+		else if (name == "uchar" || name == "uint8") type = PLYType::UInt8;
+		else if (name == "short" || name == "int16") type = PLYType::Int16;
+		else if (name == "ushort" || name == "uint16") type = PLYType::UInt16;
+		else if (name == "int" || name == "int32") type = PLYType::Int32;
+		else if (name == "uint" || name == "uint32") type = PLYType::UInt32;
+		else if (name == "float" || name == "float32") type = PLYType::Float32;
+		else if (name == "double" || name == "float64") type = PLYType::Float64;
+		else return false;
+		return true;
+	}
+
+	std::size_t plyTypeSize(PLYType type) {
+		switch (type) {
+		case PLYType::Int8: case PLYType::UInt8: return 1;
+		case PLYType::Int16: case PLYType::UInt16: return 2;
+		case PLYType::Int32: case PLYType::UInt32: case PLYType::Float32: return 4;
+		case PLYType::Float64: return 8;
+		}
+		return 0;
+	}
+
+	// Reads one value of the given type, swapping its bytes if the file's
+	// byte order isn't ours
+	double readPLYValue(const char* p, PLYType type, bool swapBytes) {
+		char bytes[8];
+		std::size_t size = plyTypeSize(type);
+		for (std::size_t i = 0; i < size; i++) {
+			bytes[i] = p[swapBytes ? size - 1 - i : i];
+		}
+		switch (type) {
+		case PLYType::Int8: { int8_t v; std::memcpy(&v, bytes, 1); return v; }
+		case PLYType::UInt8: { uint8_t v; std::memcpy(&v, bytes, 1); return v; }
+		case PLYType::Int16: { int16_t v; std::memcpy(&v, bytes, 2); return v; }
+		case PLYType::UInt16: { uint16_t v; std::memcpy(&v, bytes, 2); return v; }
+		case PLYType::Int32: { int32_t v; std::memcpy(&v, bytes, 4); return v; }
+		case PLYType::UInt32: { uint32_t v; std::memcpy(&v, bytes, 4); return v; }
+		case PLYType::Float32: { float v; std::memcpy(&v, bytes, 4); return v; }
+		case PLYType::Float64: { double v; std::memcpy(&v, bytes, 8); return v; }
+		}
+		return 0;
+	}
+
+	struct PLYProperty {
+		std::string name;
+		PLYType type;
+		// Lists are a count of type countType followed by that many values
+		bool isList;
+		PLYType countType;
+	};
+
+	struct PLYElement {
+		std::string name;
+		std::size_t count;
+		std::vector<PLYProperty> properties;
+
+		// Size of each item in bytes, or 0 if it varies (it has lists)
+		std::size_t fixedSize() const {
+			std::size_t size = 0;
+			for (PLYProperty const &property : properties) {
+				if (property.isList) return 0;
+				size += plyTypeSize(property.type);
+			}
+			return size;
+		}
+
+		int findProperty(std::string const &name) const {
+			for (std::size_t i = 0; i < properties.size(); i++) {
+				if (properties[i].name == name) return int(i);
+			}
+			return -1;
+		}
+	};
+
+	// Walks over one item of the element. Returns its size, and calls
+	// onList(property index, count, first value) for every list in it.
+	template <class OnList>
+	std::size_t walkPLYItem(PLYElement const &element, const char* p, const char* end, bool swapBytes, OnList onList) {
+		const char* start = p;
+		for (std::size_t i = 0; i < element.properties.size(); i++) {
+			PLYProperty const &property = element.properties[i];
+			if (!property.isList) {
+				p += plyTypeSize(property.type);
+				continue;
+			}
+			std::size_t countSize = plyTypeSize(property.countType);
+			if (p + countSize > end) {
+				throw std::runtime_error("file ends in the middle of " + element.name + " data");
+			}
+			double count = readPLYValue(p, property.countType, swapBytes);
+			if (count < 0) {
+				throw std::runtime_error("negative list length in " + element.name + " data");
+			}
+			p += countSize;
+			onList(i, std::size_t(count), p);
+			p += std::size_t(count)*plyTypeSize(property.type);
+		}
+		if (p > end) {
+			throw std::runtime_error("file ends in the middle of " + element.name + " data");
+		}
+		return std::size_t(p - start);
+	}
+
+	bool isLittleEndian() {
+		uint16_t one = 1;
+		char first;
+		std::memcpy(&first, &one, 1);
+		return first == 1;
+	}
+}
+
+void loadPLY(std::string const &path, TriangleMesh &mesh) {
+	MappedFile file(path);
+	const char* fileEnd = file.data() + file.size();
+	auto error = [&](std::string const &message) {
+		return std::runtime_error(path + ": " + message);
+	};
+
+	// The header is text, up to an "end_header" line
+	const char* p = file.data();
+	std::vector<PLYElement> elements;
+	bool littleEndian = true;
+	bool first = true;
+	while (true) {
+		if (p >= fileEnd) {
+			throw error("no end_header line");
+		}
+		const char* lineEnd = endOfLine(p, fileEnd);
+		std::istringstream line(std::string(p, lineEnd));
+		p = lineEnd + 1;
+
+		std::string keyword;
+		line >> keyword;
+		if (first) {
+			if (keyword != "ply") throw error("not a PLY file");
+			first = false;
+		}
+		else if (keyword == "format") {
+			std::string format;
+			line >> format;
+			if (format == "binary_little_endian") littleEndian = true;
+			else if (format == "binary_big_endian") littleEndian = false;
+			else throw error("only binary PLY files are supported, not " + format);
+		}
+		else if (keyword == "element") {
+			PLYElement element;
+			if (!(line >> element.name >> element.count)) throw error("bad element line");
+			elements.push_back(element);
+		}
+		else if (keyword == "property") {
+			if (elements.empty()) throw error("property outside of an element");
+			PLYProperty property;
+			std::string type;
+			line >> type;
+			property.isList = type == "list";
+			if (property.isList) {
+				std::string countType;
+				line >> countType >> type;
+				if (!parsePLYType(countType, property.countType)) throw error("unknown type " + countType);
+			}
+			if (!parsePLYType(type, property.type)) throw error("unknown type " + type);
+			if (!(line >> property.name)) throw error("bad property line");
+			elements.back().properties.push_back(property);
+		}
+		else if (keyword == "end_header") {
+			break;
+		}
+		// comment, obj_info and blank lines are skipped
+	}
+	bool swapBytes = littleEndian != isLittleEndian();
+
+	// Find the vertices and faces. Elements before them have to be skipped,
+	// which for elements with lists means walking over every item.
+	std::vector<vec3> positions, normals;
+	std::vector<vec2> uvs;
+	PLYElement const* faces = nullptr;
+	const char* faceData = nullptr;
+	for (PLYElement const &element : elements) {
+		std::size_t itemSize = element.fixedSize();
+		const char* elementStart = p;
+		if (element.name == "vertex") {
+			if (itemSize == 0) throw error("vertices with list properties aren't supported");
+			if (std::size_t(fileEnd - p) / itemSize < element.count) throw error("file ends in the middle of the vertices");
+
+			// Offsets of the properties we want within an item, -1 if missing
+			std::vector<std::size_t> offsets;
+			std::size_t offset = 0;
+			for (PLYProperty const &property : element.properties) {
+				offsets.push_back(offset);
+				offset += plyTypeSize(property.type);
+			}
+			auto find = [&](std::initializer_list<const char*> names) {
+				for (const char* name : names) {
+					int i = element.findProperty(name);
+					if (i >= 0) return i;
+				}
+				return -1;
+			};
+			int x = find({ "x" }), y = find({ "y" }), z = find({ "z" });
+			int nx = find({ "nx" }), ny = find({ "ny" }), nz = find({ "nz" });
+			int u = find({ "u", "s", "texture_u", "texture_s" });
+			int v = find({ "v", "t", "texture_v", "texture_t" });
+			if (x < 0 || y < 0 || z < 0) throw error("vertices have no x, y and z");
+			bool hasNormals = nx >= 0 && ny >= 0 && nz >= 0;
+			bool hasUVs = u >= 0 && v >= 0;
+
+			positions.resize(element.count);
+			normals.resize(hasNormals ? element.count : 0);
+			uvs.resize(hasUVs ? element.count : 0);
+			auto read = [&](const char* item, int property) {
+				return float(readPLYValue(item + offsets[property], element.properties[property].type, swapBytes));
+			};
+			int chunkCount = int((element.count + CHUNK_FACES - 1) / CHUNK_FACES);
+			forEachChunk(chunkCount, [&](int chunk) {
+				std::size_t end = std::min(element.count, (chunk + 1)*CHUNK_FACES);
+				for (std::size_t i = chunk*CHUNK_FACES; i < end; i++) {
+					const char* item = elementStart + i*itemSize;
+					positions[i] = vec3(read(item, x), read(item, y), read(item, z));
+					if (hasNormals) normals[i] = vec3(read(item, nx), read(item, ny), read(item, nz));
+					if (hasUVs) uvs[i] = vec2(read(item, u), read(item, v));
+				}
+			});
+			p += element.count*itemSize;
+		}
+		else if (element.name == "face") {
+			faces = &element;
+			faceData = p;
+			break; // nothing after the faces is needed
+		}
+		else if (itemSize > 0) {
+			if (std::size_t(fileEnd - p) / itemSize < element.count) throw error("file ends in the middle of " + element.name + " data");
+			p += element.count*itemSize;
+		}
+		else {
+			try {
+				for (std::size_t i = 0; i < element.count; i++) {
+					p += walkPLYItem(element, p, fileEnd, swapBytes, [](std::size_t, std::size_t, const char*) {});
+				}
+			}
+			catch (std::runtime_error const &e) {
+				throw error(e.what());
+			}
+		}
+	}
+	if (!faces) {
+		throw error("no faces");
+	}
+	if (faces->count > 0 && positions.empty()) {
+		throw error("faces come before the vertices");
+	}
+	int indices = faces->findProperty("vertex_indices");
+	if (indices < 0) indices = faces->findProperty("vertex_index");
+	if (indices < 0 || !faces->properties[indices].isList) {
+		throw error("faces have no vertex_indices list");
+	}
+	PLYType indexType = faces->properties[indices].type;
+	std::size_t indexSize = plyTypeSize(indexType);
+
+	// Faces vary in size, so one quick pass finds where each chunk of them
+	// starts in the file and in the mesh
+	struct FaceChunk {
+		const char* data;
+		std::size_t firstTriangle;
+	};
+	std::vector<FaceChunk> chunks;
+	std::size_t triangleCount = 0;
+	try {
+		const char* face = faceData;
+		for (std::size_t i = 0; i < faces->count; i++) {
+			if (i % CHUNK_FACES == 0) {
+				chunks.push_back(FaceChunk{ face, triangleCount });
+			}
+			face += walkPLYItem(*faces, face, fileEnd, swapBytes, [&](std::size_t property, std::size_t count, const char*) {
+				if (int(property) == indices && count >= 3) triangleCount += count - 2;
+			});
+		}
+	}
+	catch (std::runtime_error const &e) {
+		throw error(e.what());
+	}
+	if (triangleCount > std::size_t(std::numeric_limits<int>::max())) {
+		throw error("too many triangles");
+	}
+
+	mesh.resize(int(triangleCount), !normals.empty(), !uvs.empty());
+	forEachChunk(int(chunks.size()), [&](int chunk) {
+		const char* face = chunks[chunk].data;
+		int triangle = int(chunks[chunk].firstTriangle);
+		std::size_t end = std::min(faces->count, (chunk + 1)*CHUNK_FACES);
+		for (std::size_t i = chunk*CHUNK_FACES; i < end; i++) {
+			face += walkPLYItem(*faces, face, fileEnd, swapBytes, [&](std::size_t property, std::size_t count, const char* values) {
+				// Faces of fewer than 3 corners make no triangles, and a
+				// count of 0 has no corners to read
+				if (int(property) != indices || count < 3) {
+					return;
+				}
+				auto vertex = [&](std::size_t corner) {
+					double index = readPLYValue(values + corner*indexSize, indexType, swapBytes);
+					if (index < 0 || index >= double(positions.size())) {
+						throw error("face " + std::to_string(i) + " refers to a vertex that doesn't exist");
+					}
+					return std::size_t(index);
+				};
+				std::size_t a = vertex(0);
+				for (std::size_t c = 1; c + 1 < count; c++, triangle++) {
+					std::size_t b = vertex(c), d = vertex(c + 1);
+					mesh.set(triangle, positions[a], positions[b], positions[d]);
+					if (mesh.hasNormals()) mesh.setNormals(triangle, normals[a], normals[b], normals[d]);
+					if (mesh.hasUVs()) mesh.setUVs(triangle, uvs[a], uvs[b], uvs[d]);
+				}
+			});
+		}
+	});
+}
+
+//------------------------------------------------------------------------------
+
+namespace {
+	// Spreads the low 10 bits of x out to every third bit
+	uint32_t spreadBits(uint32_t x) {
+		x &= 0x3ff;
+		x = (x | (x << 16)) & 0x30000ff;
+		x = (x | (x << 8)) & 0x300f00f;
+		x = (x | (x << 4)) & 0x30c30c3;
+		x = (x | (x << 2)) & 0x9249249;
+		return x;
+	}
+
+	// Puts the triangles in the Morton order of their centroids, a curve
+	// through the mesh's bounds that keeps nearby points together. Triangles
+	// that are close in space end up close in memory, so the few that a BVH
+	// leaf holds are read from the same cache lines. Codes are worked out and
+	// sorted a chunk at a time on the thread pool, then the chunks merged.
+	void sortAlongCurve(TriangleMesh &mesh) {
+		int count = mesh.size();
+		if (count < 2) {
+			return;
+		}
+		int chunkCount = int((std::size_t(count) + CHUNK_FACES - 1) / CHUNK_FACES);
+		auto chunkBegin = [&](int chunk) { return int(std::min(std::size_t(count), chunk*CHUNK_FACES)); };
+		auto centroid = [&](int i) { return mesh.vertex(i) + (mesh.edge1(i) + mesh.edge2(i))/3.f; };
+
+		std::vector<AABB> chunkBounds(chunkCount);
+		forEachChunk(chunkCount, [&](int chunk) {
+			for (int i = chunkBegin(chunk); i < chunkBegin(chunk + 1); i++) {
+				chunkBounds[chunk].extend(centroid(i));
+			}
+		});
+		AABB bounds;
+		for (AABB const &b : chunkBounds) {
+			bounds.extend(b);
+		}
+		glm::vec3 scale = 1023.f/glm::max(bounds.extent(), glm::vec3(1e-30f));
+
+		// The code in the high half, the triangle in the low half
+		std::vector<uint64_t> keys(count);
+		forEachChunk(chunkCount, [&](int chunk) {
+			for (int i = chunkBegin(chunk); i < chunkBegin(chunk + 1); i++) {
+				glm::uvec3 cell = glm::uvec3((centroid(i) - bounds.min)*scale);
+				uint32_t code = (spreadBits(cell.x) << 2) | (spreadBits(cell.y) << 1) | spreadBits(cell.z);
+				keys[i] = uint64_t(code) << 32 | uint32_t(i);
+			}
+			std::sort(keys.begin() + chunkBegin(chunk), keys.begin() + chunkBegin(chunk + 1));
+		});
+		for (int width = 1; width < chunkCount; width *= 2) {
+			forEachChunk((chunkCount + 2*width - 1)/(2*width), [&](int pair) {
+				int first = 2*width*pair;
+				auto begin = keys.begin();
+				std::inplace_merge(begin + chunkBegin(first), begin + chunkBegin(std::min(first + width, chunkCount)),
+					begin + chunkBegin(std::min(first + 2*width, chunkCount)));
+			});
+		}
+
+		std::vector<int> order(count);
+		for (int i = 0; i < count; i++) {
+			order[i] = int(keys[i] & 0xffffffffu);
+		}
+		// The keys go before the triangles are copied into their new order,
+		// so the two don't take memory at the same time
+		std::vector<uint64_t>().swap(keys);
+		mesh.reorder(order);
+	}
+}
+
+std::shared_ptr<TriangleMesh> loadMesh(std::string const &path) {
+	std::string extension = path.substr(std::min(path.size(), path.find_last_of('.')));
+	std::transform(extension.begin(), extension.end(), extension.begin(),
+		[](char c) { return char(std::tolower((unsigned char)c)); });
+
+	auto start = std::chrono::steady_clock::now();
+	std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>();
+	if (extension == ".obj") {
+		loadOBJ(path, *mesh);
+	}
+	else if (extension == ".ply") {
+		loadPLY(path, *mesh);
+	}
+	else {
+		throw std::runtime_error(path + ": unknown mesh format, expected .obj or .ply");
+	}
+	sortAlongCurve(*mesh);
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	Log::info("Loaded {} triangles from {} in {:.2f} seconds", mesh->size(), path, elapsed.count());
+	return mesh;
+}
+
+std::shared_ptr<TriangleMesh> MeshCache::get(std::string const &path) {
+	FileVersion file = fileVersion(path);
+
+	// Loading happens under the lock too: two threads asking for the same
+	// new mesh shouldn't both load it
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = meshes.find(file.key);
+	if (found != meshes.end() && file.unchanged(found->second.file)) {
+		return found->second.mesh;
+	}
+	std::shared_ptr<TriangleMesh> mesh = loadMesh(path);
+	meshes[file.key] = Entry{ file, mesh };
+	return mesh;
+}
+
+void MeshCache::prune() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto i = meshes.begin(); i != meshes.end();) {
+		i = i->second.mesh.use_count() == 1 ? meshes.erase(i) : std::next(i);
+	}
+}
@@ -0,0 +1,51 @@
+//------------------------------------------------------------------------------
+// Loads triangle meshes from Wavefront OBJ and binary PLY files.
+//
+// Meshes with tens of millions of triangles are common, so the loaders are
+// built for speed: the file is memory mapped rather than read through a
+// stream, split into chunks that are parsed in parallel on the ThreadPool,
+// and the triangles are written straight into a TriangleMesh sized up front
+// (a first quick pass over the file counts them).
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "FileVersion.h"
+#include "RayTrace.h"
+
+// Loads the file into a new mesh, choosing the format from the extension
+// (.obj or .ply). Polygons are split into triangles, and the vertex normals
+// and texture coordinates are kept if the file has them. The triangles are
+// then sorted so that ones close in space are close in memory (see
+// TriangleMesh). Throws std::runtime_error if the file can't be loaded.
+std::shared_ptr<TriangleMesh> loadMesh(std::string const &path);
+
+// The loaders for each format, replacing whatever the mesh held before.
+// Only binary PLY files (either byte order) are supported.
+void loadOBJ(std::string const &path, TriangleMesh &mesh);
+void loadPLY(std::string const &path, TriangleMesh &mesh);
+
+// Keeps the meshes loaded so far, so reloading a scene (or loading another
+// that uses the same files) doesn't parse them again. A file is loaded again
+// once it has been modified.
+class MeshCache {
+public:
+	// The mesh in the file, loaded if it isn't already. Safe to call from
+	// several threads at once. Throws like loadMesh().
+	std::shared_ptr<TriangleMesh> get(std::string const &path);
+
+	// Forgets the meshes that no shape uses any more
+	void prune();
+
+private:
+	struct Entry {
+		FileVersion file;
+		std::shared_ptr<TriangleMesh> mesh;
+	};
+	std::unordered_map<std::string, Entry> meshes;
+	std::mutex mutex;
+};
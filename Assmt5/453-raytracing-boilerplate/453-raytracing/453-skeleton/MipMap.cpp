@@ -0,0 +1,133 @@
+#include "MipMap.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+	// Linear value of each 8 bit sRGB value
+	float const* srgbToLinear() {
+		static const std::vector<float> table = [] {
+			std::vector<float> values(256);
+			for (int i = 0; i < 256; i++) {
+				float c = i/255.f;
+				values[i] = c <= 0.04045f ? c/12.92f : std::pow((c + 0.055f)/1.055f, 2.4f);
+			}
+			return values;
+		}();
+		return table.data();
+	}
+
+	uint32_t linearToSRGB(float c) {
+		c = glm::clamp(c, 0.f, 1.f);
+		c = c <= 0.0031308f ? 12.92f*c : 1.055f*std::pow(c, 1.f/2.4f) - 0.055f;
+		return uint32_t(c*255.f + 0.5f);
+	}
+
+	uint32_t pack(glm::vec3 linear) {
+		return linearToSRGB(linear.r) | linearToSRGB(linear.g) << 8 | linearToSRGB(linear.b) << 16 | 0xff000000u;
+	}
+
+	glm::vec3 unpack(uint32_t texel) {
+		float const* table = srgbToLinear();
+		return glm::vec3(table[texel & 0xff], table[(texel >> 8) & 0xff], table[(texel >> 16) & 0xff]);
+	}
+
+	int wrap(int i, int size) {
+		i %= size;
+		return i < 0 ? i + size : i;
+	}
+}
+
+MipMap::MipMap(int width, int height, unsigned char const* rgba) {
+	// The level being stored, in linear colours, starting from the image
+	std::vector<glm::vec3> linear(std::size_t(width)*height);
+	float const* table = srgbToLinear();
+	for (std::size_t i = 0; i < linear.size(); i++) {
+		linear[i] = glm::vec3(table[rgba[4*i]], table[rgba[4*i + 1]], table[rgba[4*i + 2]]);
+	}
+
+	std::size_t offset = 0;
+	for (int w = width, h = height;; w = std::max(w/2, 1), h = std::max(h/2, 1)) {
+		int tilesAcross = (w + TILE_SIZE - 1)/TILE_SIZE;
+		int tilesDown = (h + TILE_SIZE - 1)/TILE_SIZE;
+		levelInfo.push_back(Level{ w, h, tilesAcross, offset });
+		offset += std::size_t(tilesAcross)*tilesDown*TILE_SIZE*TILE_SIZE;
+		if (w == 1 && h == 1) {
+			break;
+		}
+	}
+	texels.resize(offset);
+
+	for (std::size_t l = 0; l < levelInfo.size(); l++) {
+		Level const &level = levelInfo[l];
+		for (int y = 0; y < level.height; y++) {
+			for (int x = 0; x < level.width; x++) {
+				std::size_t tile = std::size_t(y/TILE_SIZE)*level.tilesAcross + x/TILE_SIZE;
+				texels[level.offset + tile*TILE_SIZE*TILE_SIZE + (y%TILE_SIZE)*TILE_SIZE + x%TILE_SIZE] =
+					pack(linear[std::size_t(y)*level.width + x]);
+			}
+		}
+		if (l + 1 == levelInfo.size()) {
+			break;
+		}
+
+		// Box filter down to the next level. An odd texel out at the edge
+		// of a level is left out of the one above.
+		Level const &next = levelInfo[l + 1];
+		std::vector<glm::vec3> smaller(std::size_t(next.width)*next.height);
+		for (int y = 0; y < next.height; y++) {
+			int y0 = std::min(2*y, level.height - 1);
+			int y1 = std::min(2*y + 1, level.height - 1);
+			for (int x = 0; x < next.width; x++) {
+				int x0 = std::min(2*x, level.width - 1);
+				int x1 = std::min(2*x + 1, level.width - 1);
+				smaller[std::size_t(y)*next.width + x] = 0.25f*(
+					linear[std::size_t(y0)*level.width + x0] + linear[std::size_t(y0)*level.width + x1] +
+					linear[std::size_t(y1)*level.width + x0] + linear[std::size_t(y1)*level.width + x1]);
+			}
+		}
+		linear.swap(smaller);
+	}
+}
+
+uint32_t MipMap::texel(Level const &level, int x, int y) const {
+	std::size_t tile = std::size_t(y/TILE_SIZE)*level.tilesAcross + x/TILE_SIZE;
+	return texels[level.offset + tile*TILE_SIZE*TILE_SIZE + (y%TILE_SIZE)*TILE_SIZE + x%TILE_SIZE];
+}
+
+glm::vec3 MipMap::bilinear(int level, glm::vec2 uv) const {
+	Level const &l = levelInfo[level];
+	// In texels from the top left, with texel centres at half integers
+	float x = uv.x*l.width - 0.5f;
+	float y = (1.f - uv.y)*l.height - 0.5f;
+	if (!std::isfinite(x) || !std::isfinite(y)) {
+		return unpack(texel(l, 0, 0));
+	}
+	float xFloor = std::floor(x);
+	float yFloor = std::floor(y);
+	float fx = x - xFloor;
+	float fy = y - yFloor;
+	// Far out texture coordinates lose their fraction before they overflow
+	int x0 = wrap(int(std::fmod(xFloor, float(l.width))), l.width);
+	int y0 = wrap(int(std::fmod(yFloor, float(l.height))), l.height);
+	int x1 = x0 + 1 == l.width ? 0 : x0 + 1;
+	int y1 = y0 + 1 == l.height ? 0 : y0 + 1;
+
+	glm::vec3 top = glm::mix(unpack(texel(l, x0, y0)), unpack(texel(l, x1, y0)), fx);
+	glm::vec3 bottom = glm::mix(unpack(texel(l, x0, y1)), unpack(texel(l, x1, y1)), fx);
+	return glm::mix(top, bottom, fy);
+}
+
+glm::vec3 MipMap::trilinear(glm::vec2 uv, float width) const {
+	// The level whose texels are width across
+	float level = std::log2(width*std::max(levelInfo[0].width, levelInfo[0].height));
+	int last = levels() - 1;
+	if (!(level > 0)) {
+		return bilinear(0, uv);
+	}
+	if (level >= last) {
+		return bilinear(last, uv);
+	}
+	int below = int(level);
+	return glm::mix(bilinear(below, uv), bilinear(below + 1, uv), level - below);
+}
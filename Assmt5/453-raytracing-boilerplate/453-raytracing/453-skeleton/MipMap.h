@@ -0,0 +1,60 @@
+//------------------------------------------------------------------------------
+// An image texture laid out for filtering on the CPU.
+//
+// The image and its mip levels (each half the size of the one before, down
+// to a single texel, each texel the average of four below it) are kept as
+// 8 bit sRGB, four bytes a texel, in tiles of 4x4 texels. A tile is 64
+// bytes, one cache line, so the four texels a bilinear lookup reads are
+// nearly always in one line, and lookups near each other (the neighbouring
+// pixels of a tile of the image) share lines far more often than they would
+// reading rows of a big image. Averaging and filtering is done on linear
+// colours, decoded through a table.
+//
+// Texture coordinates wrap around, so a texture repeats outside [0, 1], and
+// have v = 0 at the bottom of the image, like OBJ files expect.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "AlignedAllocator.h"
+
+class MipMap {
+public:
+	static const int TILE_SIZE = 4;
+
+	// From width*height texels of RGBA, a byte per channel, row by row from
+	// the top of the image, as stb_image loads them. Alpha is ignored.
+	MipMap(int width, int height, unsigned char const* rgba);
+
+	int width() const { return levelInfo[0].width; }
+	int height() const { return levelInfo[0].height; }
+	int levels() const { return int(levelInfo.size()); }
+	// Memory taken by all of the levels
+	std::size_t bytes() const { return texels.size()*sizeof(uint32_t); }
+
+	// The colour at uv, interpolated between the four nearest texels of one
+	// level (0 is the image itself)
+	glm::vec3 bilinear(int level, glm::vec2 uv) const;
+	// The colour over an area of the texture about width across (in texture
+	// coordinates), from the two levels whose texels are nearest that size
+	glm::vec3 trilinear(glm::vec2 uv, float width) const;
+
+private:
+	struct Level {
+		int width;
+		int height;
+		int tilesAcross;
+		// Where its tiles start in texels
+		std::size_t offset;
+	};
+
+	uint32_t texel(Level const &level, int x, int y) const;
+
+	std::vector<Level> levelInfo;
+	AlignedVector<uint32_t> texels;
+};
@@ -0,0 +1,180 @@
+//------------------------------------------------------------------------------
+// The packet kernels, written once for any SIMD width.
+//
+// Only included by the PacketKernels*.cpp files. Each of them defines a type V
+// wrapping its instruction set (in an anonymous namespace, so nothing compiled
+// with e.g. AVX-512 enabled is shared with the rest of the program) and
+// instantiates PacketKernelsImpl<V> with it. V provides:
+//
+//	V::F, V::M             float vector and comparison mask types, with the
+//	                       usual arithmetic, comparison and &, | operators
+//	V::width               number of lanes
+//	V::load/store/set1     aligned load/store and broadcast
+//	V::min/max/sqrt        per lane
+//	V::select(m, a, b)     m ? a : b per lane
+//	V::bits(m)             the mask as an integer, lane i in bit i
+//
+// The arithmetic is done in the same order as the scalar code in RayTrace.cpp
+// and AABB::intersect, so both paths agree on which primitive is hit.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "RayPacket.h"
+
+template <class V>
+struct PacketKernelsImpl {
+	typedef typename V::F F;
+	typedef typename V::M M;
+
+	static void recordHits(RayPacket &packet, int base, M valid, F t, F tMax, int id) {
+		unsigned bits = V::bits(valid);
+		if (bits == 0) {
+			return;
+		}
+		V::store(packet.tMax + base, V::select(valid, t, tMax));
+		for (int i = 0; i < V::width; i++) {
+			if (bits & (1u << i)) {
+				packet.hit[base + i] = id;
+			}
+		}
+	}
+
+	static unsigned intersectBox(RayPacket const &packet, const float* boxMin, const float* boxMax) {
+		F minX = V::set1(boxMin[0]), minY = V::set1(boxMin[1]), minZ = V::set1(boxMin[2]);
+		F maxX = V::set1(boxMax[0]), maxY = V::set1(boxMax[1]), maxZ = V::set1(boxMax[2]);
+		F tMin = V::set1(packet.tMin);
+
+		unsigned result = 0;
+		for (int base = 0; base < packet.size; base += V::width) {
+			F ox = V::load(packet.originX + base);
+			F oy = V::load(packet.originY + base);
+			F oz = V::load(packet.originZ + base);
+			F ix = V::load(packet.inverseX + base);
+			F iy = V::load(packet.inverseY + base);
+			F iz = V::load(packet.inverseZ + base);
+
+			F t0x = (minX - ox)*ix, t1x = (maxX - ox)*ix;
+			F t0y = (minY - oy)*iy, t1y = (maxY - oy)*iy;
+			F t0z = (minZ - oz)*iz, t1z = (maxZ - oz)*iz;
+
+			F tNear = V::max(V::max(V::min(t0x, t1x), V::min(t0y, t1y)), V::max(V::min(t0z, t1z), tMin));
+			F tFar = V::min(V::min(V::max(t0x, t1x), V::max(t0y, t1y)), V::min(V::max(t0z, t1z), V::load(packet.tMax + base)));
+			result |= V::bits(tNear <= tFar) << base;
+		}
+		return result;
+	}
+
+	static void intersectTriangle(RayPacket &packet, TriangleArrays const &mesh, int triangle, int id) {
+		const F epsilon = V::set1(0.0000001f);
+		const F negativeEpsilon = V::set1(-0.0000001f);
+		const F zero = V::set1(0.f);
+		const F one = V::set1(1.f);
+		const F tMin = V::set1(packet.tMin);
+
+		F v0x = V::set1(mesh.vertex[0][triangle]), v0y = V::set1(mesh.vertex[1][triangle]), v0z = V::set1(mesh.vertex[2][triangle]);
+		F e1x = V::set1(mesh.edge1[0][triangle]), e1y = V::set1(mesh.edge1[1][triangle]), e1z = V::set1(mesh.edge1[2][triangle]);
+		F e2x = V::set1(mesh.edge2[0][triangle]), e2y = V::set1(mesh.edge2[1][triangle]), e2z = V::set1(mesh.edge2[2][triangle]);
+
+		for (int base = 0; base < packet.size; base += V::width) {
+			F dx = V::load(packet.directionX + base);
+			F dy = V::load(packet.directionY + base);
+			F dz = V::load(packet.directionZ + base);
+
+			// h = cross(direction, edge2)
+			F hx = dy*e2z - e2y*dz;
+			F hy = dz*e2x - e2z*dx;
+			F hz = dx*e2y - e2x*dy;
+			F a = e1x*hx + e1y*hy + e1z*hz;
+			M valid = (a <= negativeEpsilon) | (a >= epsilon);
+			F f = one/a;
+
+			F sx = V::load(packet.originX + base) - v0x;
+			F sy = V::load(packet.originY + base) - v0y;
+			F sz = V::load(packet.originZ + base) - v0z;
+			F u = f*(sx*hx + sy*hy + sz*hz);
+			valid = valid & (u >= zero) & (u <= one);
+
+			// q = cross(s, edge1)
+			F qx = sy*e1z - e1y*sz;
+			F qy = sz*e1x - e1z*sx;
+			F qz = sx*e1y - e1x*sy;
+			F v = f*(dx*qx + dy*qy + dz*qz);
+			valid = valid & (v >= zero) & (u + v <= one);
+
+			F t = f*(e2x*qx + e2y*qy + e2z*qz);
+			F tMax = V::load(packet.tMax + base);
+			valid = valid & (t > epsilon) & (t > tMin) & (t < tMax);
+			recordHits(packet, base, valid, t, tMax, id);
+		}
+	}
+
+	static void intersectSphere(RayPacket &packet, const float* centre, float radius, int id) {
+		const F epsilon = V::set1(0.00001f);
+		const F zero = V::set1(0.f);
+		const F tMin = V::set1(packet.tMin);
+		F cx = V::set1(centre[0]), cy = V::set1(centre[1]), cz = V::set1(centre[2]);
+		F radiusSquared = V::set1(radius*radius);
+
+		for (int base = 0; base < packet.size; base += V::width) {
+			F dx = V::load(packet.directionX + base);
+			F dy = V::load(packet.directionY + base);
+			F dz = V::load(packet.directionZ + base);
+			F offsetX = cx - V::load(packet.originX + base);
+			F offsetY = cy - V::load(packet.originY + base);
+			F offsetZ = cz - V::load(packet.originZ + base);
+
+			F a = dx*dx + dy*dy + dz*dz;
+			F b = dx*offsetX + dy*offsetY + dz*offsetZ;
+			F c = (offsetX*offsetX + offsetY*offsetY + offsetZ*offsetZ) - radiusSquared;
+			F delta = b*b - a*c;
+			M valid = (delta >= zero) & (a > zero);
+
+			F root = V::sqrt(V::max(delta, zero));
+			F nearT = (b - root)/a;
+			F farT = (b + root)/a;
+			F t = V::select(nearT > epsilon, nearT, farT);
+
+			F tMax = V::load(packet.tMax + base);
+			valid = valid & (t > epsilon) & (t > tMin) & (t < tMax);
+			recordHits(packet, base, valid, t, tMax, id);
+		}
+	}
+
+	static void intersectPlane(RayPacket &packet, const float* point, const float* normal, int id) {
+		const F epsilon = V::set1(0.00001f);
+		const F zero = V::set1(0.f);
+		const F tMin = V::set1(packet.tMin);
+		F px = V::set1(point[0]), py = V::set1(point[1]), pz = V::set1(point[2]);
+		F nx = V::set1(normal[0]), ny = V::set1(normal[1]), nz = V::set1(normal[2]);
+
+		for (int base = 0; base < packet.size; base += V::width) {
+			F dx = V::load(packet.directionX + base);
+			F dy = V::load(packet.directionY + base);
+			F dz = V::load(packet.directionZ + base);
+
+			// Only planes facing the ray are hit
+			F denominator = nx*dx + ny*dy + nz*dz;
+			M valid = denominator < zero;
+
+			F t = ((px - V::load(packet.originX + base))*nx
+				+ (py - V::load(packet.originY + base))*ny
+				+ (pz - V::load(packet.originZ + base))*nz) / denominator;
+
+			F tMax = V::load(packet.tMax + base);
+			valid = valid & (t >= epsilon) & (t > tMin) & (t < tMax);
+			recordHits(packet, base, valid, t, tMax, id);
+		}
+	}
+
+	static PacketKernels const* table(const char* name) {
+		static const PacketKernels kernels = {
+			name,
+			V::width,
+			&intersectBox,
+			&intersectTriangle,
+			&intersectSphere,
+			&intersectPlane,
+		};
+		return &kernels;
+	}
+};
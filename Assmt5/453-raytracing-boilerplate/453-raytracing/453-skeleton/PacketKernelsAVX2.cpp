@@ -0,0 +1,57 @@
+//------------------------------------------------------------------------------
+// 8 wide packet kernels using AVX2.
+//
+// The build compiles this file (and only this file) with AVX2 enabled. It is
+// only ever called after selectPacketKernels() checked the CPU supports it.
+//------------------------------------------------------------------------------
+#include "RayPacket.h"
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#include "PacketKernels.h"
+
+namespace {
+	struct Float8 { __m256 v; };
+	struct Mask8 { __m256 v; };
+
+	inline Float8 operator+(Float8 a, Float8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+	inline Float8 operator-(Float8 a, Float8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+	inline Float8 operator*(Float8 a, Float8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+	inline Float8 operator/(Float8 a, Float8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+
+	inline Mask8 operator<(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Mask8 operator<=(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+	inline Mask8 operator>(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+	inline Mask8 operator>=(Float8 a, Float8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+	inline Mask8 operator&(Mask8 a, Mask8 b) { return { _mm256_and_ps(a.v, b.v) }; }
+	inline Mask8 operator|(Mask8 a, Mask8 b) { return { _mm256_or_ps(a.v, b.v) }; }
+
+	struct AVX2 {
+		typedef Float8 F;
+		typedef Mask8 M;
+		static const int width = 8;
+
+		static F load(const float* p) { return { _mm256_load_ps(p) }; }
+		static void store(float* p, F a) { _mm256_store_ps(p, a.v); }
+		static F set1(float x) { return { _mm256_set1_ps(x) }; }
+		static F min(F a, F b) { return { _mm256_min_ps(a.v, b.v) }; }
+		static F max(F a, F b) { return { _mm256_max_ps(a.v, b.v) }; }
+		static F sqrt(F a) { return { _mm256_sqrt_ps(a.v) }; }
+		static F select(M m, F a, F b) { return { _mm256_blendv_ps(b.v, a.v, m.v) }; }
+		static unsigned bits(M m) { return unsigned(_mm256_movemask_ps(m.v)); }
+	};
+}
+
+PacketKernels const* getPacketKernelsAVX2() {
+	return PacketKernelsImpl<AVX2>::table("AVX2");
+}
+
+#else
+
+PacketKernels const* getPacketKernelsAVX2() {
+	return nullptr;
+}
+
+#endif
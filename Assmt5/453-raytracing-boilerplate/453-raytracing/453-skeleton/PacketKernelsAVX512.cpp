@@ -0,0 +1,65 @@
+//------------------------------------------------------------------------------
+// 16 wide packet kernels using AVX-512F.
+//
+// The build compiles this file (and only this file) with AVX-512 enabled. It
+// is only ever called after selectPacketKernels() checked the CPU supports it.
+//------------------------------------------------------------------------------
+#include "RayPacket.h"
+
+#if defined(__AVX512F__)
+
+// GCC 12 warns that the undefined vector each of _mm512_min_ps, _mm512_max_ps
+// and _mm512_sqrt_ps starts from (for the lanes a mask would keep) may be
+// used uninitialized. With the full mask none of it is, so the warnings are
+// turned off here, for this file alone.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include <immintrin.h>
+
+#include "PacketKernels.h"
+
+namespace {
+	struct Float16 { __m512 v; };
+	struct Mask16 { __mmask16 m; };
+
+	inline Float16 operator+(Float16 a, Float16 b) { return { _mm512_add_ps(a.v, b.v) }; }
+	inline Float16 operator-(Float16 a, Float16 b) { return { _mm512_sub_ps(a.v, b.v) }; }
+	inline Float16 operator*(Float16 a, Float16 b) { return { _mm512_mul_ps(a.v, b.v) }; }
+	inline Float16 operator/(Float16 a, Float16 b) { return { _mm512_div_ps(a.v, b.v) }; }
+
+	inline Mask16 operator<(Float16 a, Float16 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) }; }
+	inline Mask16 operator<=(Float16 a, Float16 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) }; }
+	inline Mask16 operator>(Float16 a, Float16 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) }; }
+	inline Mask16 operator>=(Float16 a, Float16 b) { return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) }; }
+	inline Mask16 operator&(Mask16 a, Mask16 b) { return { __mmask16(a.m & b.m) }; }
+	inline Mask16 operator|(Mask16 a, Mask16 b) { return { __mmask16(a.m | b.m) }; }
+
+	struct AVX512 {
+		typedef Float16 F;
+		typedef Mask16 M;
+		static const int width = 16;
+
+		static F load(const float* p) { return { _mm512_load_ps(p) }; }
+		static void store(float* p, F a) { _mm512_store_ps(p, a.v); }
+		static F set1(float x) { return { _mm512_set1_ps(x) }; }
+		static F min(F a, F b) { return { _mm512_min_ps(a.v, b.v) }; }
+		static F max(F a, F b) { return { _mm512_max_ps(a.v, b.v) }; }
+		static F sqrt(F a) { return { _mm512_sqrt_ps(a.v) }; }
+		static F select(M m, F a, F b) { return { _mm512_mask_blend_ps(m.m, b.v, a.v) }; }
+		static unsigned bits(M m) { return unsigned(m.m); }
+	};
+}
+
+PacketKernels const* getPacketKernelsAVX512() {
+	return PacketKernelsImpl<AVX512>::table("AVX-512");
+}
+
+#else
+
+PacketKernels const* getPacketKernelsAVX512() {
+	return nullptr;
+}
+
+#endif
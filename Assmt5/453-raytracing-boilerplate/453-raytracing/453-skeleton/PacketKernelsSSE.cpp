@@ -0,0 +1,54 @@
+//------------------------------------------------------------------------------
+// 4 wide packet kernels using SSE2, which every x86-64 CPU has.
+//------------------------------------------------------------------------------
+#include "RayPacket.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+
+#include "PacketKernels.h"
+
+namespace {
+	struct Float4 { __m128 v; };
+	struct Mask4 { __m128 v; };
+
+	inline Float4 operator+(Float4 a, Float4 b) { return { _mm_add_ps(a.v, b.v) }; }
+	inline Float4 operator-(Float4 a, Float4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+	inline Float4 operator*(Float4 a, Float4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+	inline Float4 operator/(Float4 a, Float4 b) { return { _mm_div_ps(a.v, b.v) }; }
+
+	inline Mask4 operator<(Float4 a, Float4 b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+	inline Mask4 operator<=(Float4 a, Float4 b) { return { _mm_cmple_ps(a.v, b.v) }; }
+	inline Mask4 operator>(Float4 a, Float4 b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+	inline Mask4 operator>=(Float4 a, Float4 b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+	inline Mask4 operator&(Mask4 a, Mask4 b) { return { _mm_and_ps(a.v, b.v) }; }
+	inline Mask4 operator|(Mask4 a, Mask4 b) { return { _mm_or_ps(a.v, b.v) }; }
+
+	struct SSE {
+		typedef Float4 F;
+		typedef Mask4 M;
+		static const int width = 4;
+
+		static F load(const float* p) { return { _mm_load_ps(p) }; }
+		static void store(float* p, F a) { _mm_store_ps(p, a.v); }
+		static F set1(float x) { return { _mm_set1_ps(x) }; }
+		static F min(F a, F b) { return { _mm_min_ps(a.v, b.v) }; }
+		static F max(F a, F b) { return { _mm_max_ps(a.v, b.v) }; }
+		static F sqrt(F a) { return { _mm_sqrt_ps(a.v) }; }
+		static F select(M m, F a, F b) { return { _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)) }; }
+		static unsigned bits(M m) { return unsigned(_mm_movemask_ps(m.v)); }
+	};
+}
+
+PacketKernels const* getPacketKernelsSSE() {
+	return PacketKernelsImpl<SSE>::table("SSE2");
+}
+
+#else
+
+PacketKernels const* getPacketKernelsSSE() {
+	return nullptr;
+}
+
+#endif
@@ -0,0 +1,274 @@
+#include "PathTracer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "SurfaceTexture.h"
+
+namespace {
+	const float PI = 3.14159265f;
+
+	float maxComponent(glm::vec3 v) {
+		return glm::max(glm::max(v.x, v.y), v.z);
+	}
+
+	float average(glm::vec3 v) {
+		return (v.x + v.y + v.z)/3.f;
+	}
+
+	// Power heuristic for multiple importance sampling: the weight of a
+	// sample taken with density pdf, when other could have taken it too
+	float powerHeuristic(float pdf, float other) {
+		float a = pdf*pdf;
+		float b = other*other;
+		return a + b > 0 ? a/(a + b) : 0.f;
+	}
+
+	// Any two unit vectors perpendicular to n and each other
+	void basis(glm::vec3 n, glm::vec3 &tangent, glm::vec3 &bitangent) {
+		tangent = glm::normalize(std::abs(n.x) > 0.9f ? glm::cross(n, glm::vec3(0, 1, 0)) : glm::cross(n, glm::vec3(1, 0, 0)));
+		bitangent = glm::cross(n, tangent);
+	}
+
+	// Direction around axis with density proportional to cos^exponent of the
+	// angle from it: 1 for cosine weighted, the shininess for a Phong lobe
+	glm::vec3 sampleAround(glm::vec3 axis, float exponent, Sampler &sampler) {
+		float cosTheta = std::pow(sampler.nextFloat(), 1.f/(exponent + 1.f));
+		float sinTheta = std::sqrt(std::max(0.f, 1.f - cosTheta*cosTheta));
+		float phi = 2.f*PI*sampler.nextFloat();
+		glm::vec3 tangent, bitangent;
+		basis(axis, tangent, bitangent);
+		return sinTheta*std::cos(phi)*tangent + sinTheta*std::sin(phi)*bitangent + cosTheta*axis;
+	}
+
+	// The material at one hit, as the three lobes described in PathTracer.h
+	struct Surface {
+		ObjectMaterial const &material;
+		// Facing the incoming ray
+		glm::vec3 normal;
+		// Back along the incoming ray
+		glm::vec3 out;
+		// The mirror direction of out
+		glm::vec3 mirror;
+		// How likely each lobe is to be picked. They add up to 1.
+		float diffuseChance;
+		float glossyChance;
+		float mirrorChance;
+
+		Surface(Intersection const &hit, Ray const &ray, ObjectMaterial const &material)
+			: material(material)
+		{
+			out = -glm::normalize(ray.direction);
+			normal = glm::normalize(hit.normal);
+			if (glm::dot(normal, out) < 0) {
+				normal = -normal;
+			}
+			mirror = glm::reflect(-out, normal);
+
+			diffuseChance = std::max(0.f, average(material.diffuse));
+			glossyChance = std::max(0.f, average(material.specular));
+			mirrorChance = std::max(0.f, average(material.reflectionStrength));
+			float total = diffuseChance + glossyChance + mirrorChance;
+			if (total > 0) {
+				diffuseChance /= total;
+				glossyChance /= total;
+				mirrorChance /= total;
+			}
+		}
+
+		bool reflects() const { return diffuseChance + glossyChance + mirrorChance > 0; }
+
+		// The diffuse and glossy lobes, light from direction in to out
+		glm::vec3 evaluate(glm::vec3 in) const {
+			float n = material.specularCoefficient;
+			float cosAlpha = std::max(0.f, glm::dot(mirror, in));
+			return material.diffuse/PI + material.specular*((n + 2.f)/(2.f*PI))*std::pow(cosAlpha, n);
+		}
+
+		// Density of sampling direction in by picking the diffuse or glossy
+		// lobe, per unit solid angle
+		float density(glm::vec3 in) const {
+			float cosTheta = glm::dot(normal, in);
+			if (cosTheta <= 0) {
+				return 0;
+			}
+			float n = material.specularCoefficient;
+			float cosAlpha = std::max(0.f, glm::dot(mirror, in));
+			return diffuseChance*cosTheta/PI + glossyChance*((n + 1.f)/(2.f*PI))*std::pow(cosAlpha, n);
+		}
+	};
+
+	// The area light's normal at a point on it
+	glm::vec3 areaLightNormal(Light const &light, glm::vec3 point) {
+		if (light.type == Light::Sphere) {
+			return glm::normalize(point - light.position);
+		}
+		return glm::normalize(glm::cross(light.edge1, light.edge2));
+	}
+
+	// The density of sampleLight() picking any one point on the area light
+	// that can be seen, per unit area
+	float areaLightDensity(Light const &light) {
+		// Spheres are only sampled on the half facing the point
+		return (light.type == Light::Sphere ? 2.f : 1.f)/light.area();
+	}
+}
+
+float PathTracer::lightSelection(Scene const &scene, int light) const {
+	int lightCount = int(scene.lights.size());
+	if (lightCount <= settings.lightSamplesPerHit) {
+		return 1;
+	}
+	return settings.lightSamplesPerHit*scene.lightDistribution.probability(light);
+}
+
+glm::vec3 PathTracer::shade(Scene const &scene, Ray const &cameraRay, Intersection const &cameraHit, PathContext &path) const {
+	glm::vec3 radiance(0);
+	glm::vec3 throughput(1);
+	Ray ray = cameraRay;
+	Intersection hit = cameraHit;
+	// Camera rays and mirror bounces can't be importance sampled against the
+	// lights, so the area lights they see count in full
+	bool mirrorBounce = true;
+	// Density of the direction of the last bounce otherwise
+	float bounceDensity = 0;
+
+	for (int depth = 0;; depth++) {
+		// Area lights in front of whatever the ray hit
+		float closest = hit.numberOfIntersections > 0 ? hit.t : std::numeric_limits<float>::infinity();
+		int seen = -1;
+		for (int l : scene.areaLights) {
+			float t = intersectAreaLight(scene.lights[l], ray);
+			if (t < closest) {
+				closest = t;
+				seen = l;
+			}
+		}
+		if (seen != -1) {
+			Light const &light = scene.lights[seen];
+			float weight = 1;
+			if (!mirrorBounce) {
+				glm::vec3 point = ray.origin + closest*ray.direction;
+				glm::vec3 toLight = point - ray.origin;
+				float distanceSquared = glm::dot(toLight, toLight);
+				toLight = glm::normalize(toLight);
+				float cosLight = std::abs(glm::dot(areaLightNormal(light, point), toLight));
+				float lightDensity = lightSelection(scene, seen)*areaLightDensity(light)*distanceSquared/std::max(cosLight, 1e-8f);
+				weight = powerHeuristic(bounceDensity, lightDensity);
+			}
+			radiance += throughput*weight*light.colour;
+			break;
+		}
+		if (hit.numberOfIntersections == 0) {
+			break;
+		}
+
+		ObjectMaterial textured;
+		Surface surface(hit, ray, materialAt(ray, path.differential, hit, textured));
+		if (!surface.reflects()) {
+			break;
+		}
+
+		// Next event estimation
+		if (surface.diffuseChance + surface.glossyChance > 0) {
+			glm::vec3 origin = offsetFromSurface(hit.point, surface.normal);
+			int lightCount = int(scene.lights.size());
+			bool everyLight = lightCount <= settings.lightSamplesPerHit;
+			int samples = everyLight ? lightCount : settings.lightSamplesPerHit;
+			for (int s = 0; s < samples; s++) {
+				float probability;
+				int l = everyLight ? s : scene.lightDistribution.pick(path.sampler, probability);
+				Light const &light = scene.lights[l];
+				float selection = lightSelection(scene, l);
+				LightSample sample = sampleLight(light, hit.point, path.sampler);
+				float cosSurface = glm::dot(surface.normal, sample.toLight);
+				if (cosSurface <= 0 || maxComponent(sample.colour) <= 0) {
+					continue;
+				}
+
+				glm::vec3 contribution;
+				if (light.isArea()) {
+					glm::vec3 toLight = sample.position - hit.point;
+					float distanceSquared = glm::dot(toLight, toLight);
+					// Rectangles light both sides. The far side of a sphere is
+					// hidden behind its near side.
+					float cosLight = glm::dot(sample.normal, -sample.toLight);
+					if (light.type == Light::Rectangle) {
+						cosLight = std::abs(cosLight);
+					}
+					if (cosLight <= 0 || distanceSquared <= 0) {
+						continue;
+					}
+					// Per unit solid angle, to compare with the bounce
+					float lightDensity = selection*sample.areaDensity*distanceSquared/cosLight;
+					// The last bounce is never taken, so then this is the only way
+					// to the light
+					float weight = depth < settings.maxDepth ? powerHeuristic(lightDensity, surface.density(sample.toLight)) : 1.f;
+					contribution = surface.evaluate(sample.toLight)*sample.colour*cosSurface*weight/lightDensity;
+				}
+				else {
+					// Scaled by pi so a white diffuse surface facing the light
+					// is the light's colour, as with Whitted
+					contribution = PI*surface.evaluate(sample.toLight)*sample.colour*cosSurface/selection;
+				}
+				if (maxComponent(contribution) <= 0) {
+					continue;
+				}
+
+				path.statistics.shadowRays[depth]++;
+				bool shadowed = sample.atInfinity
+					? scene.occludedTowards(origin, sample.toLight, -1)
+					: scene.occluded(origin, sample.position, -1);
+				if (!shadowed) {
+					radiance += throughput*contribution;
+				}
+			}
+		}
+
+		if (depth >= settings.maxDepth) {
+			break;
+		}
+
+		// Pick a lobe and bounce off it
+		glm::vec3 in;
+		float pick = path.sampler.nextFloat();
+		if (pick < surface.diffuseChance + surface.glossyChance) {
+			in = pick < surface.diffuseChance
+				? sampleAround(surface.normal, 1.f, path.sampler)
+				: sampleAround(surface.mirror, surface.material.specularCoefficient, path.sampler);
+			bounceDensity = surface.density(in);
+			if (bounceDensity <= 0) {
+				break; // into the surface
+			}
+			throughput *= surface.evaluate(in)*glm::dot(surface.normal, in)/bounceDensity;
+			mirrorBounce = false;
+		}
+		else {
+			in = surface.mirror;
+			throughput *= surface.material.reflectionStrength/surface.mirrorChance;
+			mirrorBounce = true;
+		}
+
+		// Russian roulette, as for the Whitted integrator
+		float carried = maxComponent(throughput);
+		if (carried <= 0) {
+			break;
+		}
+		if (carried < settings.rouletteThreshold) {
+			float survival = carried/settings.rouletteThreshold;
+			if (path.sampler.nextFloat() >= survival) {
+				path.statistics.rouletteKills[depth]++;
+				break;
+			}
+			throughput /= survival;
+		}
+
+		// Every bounce goes out on the side the normal faces
+		path.differential = bounceDifferential(ray, path.differential, hit, mirrorBounce);
+		ray = Ray(offsetFromSurface(hit.point, surface.normal), in);
+		path.statistics.rays[depth + 1]++;
+		hit = scene.bvh->closestIntersection(ray, -1);
+	}
+	return radiance;
+}
@@ -0,0 +1,39 @@
+//------------------------------------------------------------------------------
+// A unidirectional path tracer, for global illumination: light bouncing off
+// every surface onto the others, not just off mirrors.
+//
+// The Phong materials are read as a physically based reflectance model, a
+// mix of three lobes: Lambertian diffuse (diffuse), a normalized Phong
+// glossy lobe around the mirror direction (specular and shininess), and a
+// perfect mirror (reflection). Each bounce picks one lobe in proportion to
+// its strength and samples a direction from it: cosine weighted for
+// diffuse, around the mirror direction for glossy.
+//
+// At every bounce one or more lights are sampled directly (next event
+// estimation), picked as for the Whitted integrator. Rays that bounce into
+// an area light see it too, so area lights are reached both ways, and the
+// two are combined with multiple importance sampling (the power heuristic)
+// so each counts most where it has less noise. Point, directional and spot
+// lights can only be sampled directly.
+//
+// Lights keep the meaning they have for the Whitted integrator where they
+// can: a white diffuse surface facing a point light of colour c is c, and an
+// area light has radiance equal to its colour. Ambient light isn't used;
+// the bounced light takes its place.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "Integrator.h"
+
+class PathTracer : public Integrator {
+public:
+	using Integrator::Integrator;
+
+	const char* name() const { return "path"; }
+
+	glm::vec3 shade(Scene const &scene, Ray const &ray, Intersection const &hit, PathContext &path) const;
+
+private:
+	// How many samples a hit takes of the light, on average
+	float lightSelection(Scene const &scene, int light) const;
+};
@@ -0,0 +1,43 @@
+//------------------------------------------------------------------------------
+// A small, fast random number generator: PCG32 (https://www.pcg-random.org/).
+//
+// Generators are cheap to create, so the random sampler (see Sampler.h) makes
+// one per pixel sample, seeded from the pixel and sample index. The random
+// numbers used for a sample then don't depend on which thread traced it or in
+// which order, and neither does the image.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+
+class PCG32 {
+public:
+	// Generators with different sequence numbers give independent streams
+	// even with the same seed
+	PCG32(uint64_t seed = 0, uint64_t sequence = 0)
+		: state(0), increment((sequence << 1u) | 1u)
+	{
+		next();
+		state += seed;
+		next();
+	}
+
+	uint32_t next() {
+		uint64_t old = state;
+		state = old*6364136223846793005ULL + increment;
+		uint32_t xorShifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+		uint32_t rotation = uint32_t(old >> 59u);
+		return (xorShifted >> rotation) | (xorShifted << ((-rotation) & 31));
+	}
+
+	// Uniform in [0, 1)
+	float nextFloat() {
+		// The top 24 bits fill a float's mantissa exactly, so this can't
+		// round up to 1
+		return float(next() >> 8) * (1.f / 16777216.f);
+	}
+
+private:
+	uint64_t state;
+	uint64_t increment;
+};
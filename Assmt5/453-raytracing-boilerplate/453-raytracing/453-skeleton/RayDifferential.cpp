@@ -0,0 +1,31 @@
+#include "RayDifferential.h"
+
+void hitDifferential(Ray const &ray, RayDifferential const &differential, float t, glm::vec3 normal,
+		glm::vec3 &dPdx, glm::vec3 &dPdy) {
+	// P = O + tD moves with O and D, and t moves to keep P on the plane
+	// through the hit (Igehy's transfer equation)
+	float along = glm::dot(ray.direction, normal);
+	glm::vec3 dx = differential.dOdx + t*differential.dDdx;
+	glm::vec3 dy = differential.dOdy + t*differential.dDdy;
+	if (along == 0) {
+		// Grazing: the footprint is unbounded, so leave it as it would be
+		// without the surface
+		dPdx = dx;
+		dPdy = dy;
+		return;
+	}
+	dPdx = dx - (glm::dot(dx, normal)/along)*ray.direction;
+	dPdy = dy - (glm::dot(dy, normal)/along)*ray.direction;
+}
+
+RayDifferential bounceDifferential(Ray const &ray, RayDifferential const &differential, Intersection const &hit, bool mirror) {
+	glm::vec3 normal = glm::normalize(hit.normal);
+	RayDifferential result;
+	hitDifferential(ray, differential, hit.t, normal, result.dOdx, result.dOdy);
+	if (mirror) {
+		// The derivative of reflect(D, n) with n held still
+		result.dDdx = glm::reflect(differential.dDdx, normal);
+		result.dDdy = glm::reflect(differential.dDdy, normal);
+	}
+	return result;
+}
@@ -0,0 +1,38 @@
+//------------------------------------------------------------------------------
+// Ray differentials (Igehy, "Tracing Ray Differentials"): how a ray's origin
+// and direction change from its pixel to the next one across (x) and up (y)
+// the image. Carried along to where the ray hits something, they give the
+// area of the surface the pixel covers there, which texture lookups filter
+// over so that textures far away or seen edge on don't alias.
+//
+// Camera rays get theirs from the camera. Mirror reflections carry them on,
+// treating the surface as flat where it's hit, so a texture seen in a flat
+// mirror is filtered as if it were seen directly. Other bounces (the path
+// tracer's diffuse and glossy ones) keep the area at the bounce but stop it
+// spreading any further, since rays scattered every which way have no
+// neighbouring pixel to follow.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "RayTrace.h"
+
+struct RayDifferential {
+	glm::vec3 dOdx = glm::vec3(0);
+	glm::vec3 dOdy = glm::vec3(0);
+	glm::vec3 dDdx = glm::vec3(0);
+	glm::vec3 dDdy = glm::vec3(0);
+
+	// The same for pixels s times as wide
+	RayDifferential scaled(float s) const { return RayDifferential{ s*dOdx, s*dOdy, s*dDdx, s*dDdy }; }
+};
+
+// How the hit point of the ray moves from pixel to pixel, for a hit at
+// parameter t on a surface with the given normal
+void hitDifferential(Ray const &ray, RayDifferential const &differential, float t, glm::vec3 normal,
+	glm::vec3 &dPdx, glm::vec3 &dPdy);
+
+// The differential of a ray leaving the hit: reflected if mirror is set,
+// otherwise only starting from the area around the hit
+RayDifferential bounceDifferential(Ray const &ray, RayDifferential const &differential, Intersection const &hit, bool mirror);
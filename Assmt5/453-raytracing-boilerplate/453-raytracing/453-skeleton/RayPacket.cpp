@@ -0,0 +1,129 @@
+#include "RayPacket.h"
+
+#include <cmath>
+#include <cstring>
+
+#include "RayTrace.h"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PACKET_X86
+#elif defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define PACKET_X86
+#endif
+
+namespace {
+	struct CpuFeatures {
+		bool sse2 = false;
+		bool avx2 = false;
+		bool avx512 = false;
+	};
+
+#ifdef PACKET_X86
+	void cpuid(unsigned leaf, unsigned subleaf, unsigned registers[4]) {
+#ifdef _MSC_VER
+		int r[4];
+		__cpuidex(r, int(leaf), int(subleaf));
+		for (int i = 0; i < 4; i++) registers[i] = unsigned(r[i]);
+#else
+		__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+	}
+
+	// Which register states the OS saves on a context switch
+	unsigned long long xgetbv() {
+#ifdef _MSC_VER
+		return _xgetbv(0);
+#else
+		unsigned low, high;
+		__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+		return (unsigned long long)high << 32 | low;
+#endif
+	}
+#endif
+
+	CpuFeatures detectCpuFeatures() {
+		CpuFeatures features;
+#ifdef PACKET_X86
+		unsigned r[4]; // eax, ebx, ecx, edx
+		cpuid(0, 0, r);
+		unsigned maxLeaf = r[0];
+
+		cpuid(1, 0, r);
+		features.sse2 = (r[3] & (1u << 26)) != 0;
+		bool osxsave = (r[2] & (1u << 27)) != 0;
+		bool avx = (r[2] & (1u << 28)) != 0;
+		if (!osxsave || !avx || maxLeaf < 7) {
+			return features;
+		}
+
+		// The CPU having AVX isn't enough, the OS must also save the wider registers
+		unsigned long long xcr0 = xgetbv();
+		bool ymmSaved = (xcr0 & 0x6) == 0x6;
+		bool zmmSaved = (xcr0 & 0xe6) == 0xe6;
+
+		cpuid(7, 0, r);
+		features.avx2 = ymmSaved && (r[1] & (1u << 5)) != 0;
+		features.avx512 = zmmSaved && (r[1] & (1u << 16)) != 0;
+#endif
+		return features;
+	}
+
+	CpuFeatures const &cpuFeatures() {
+		static const CpuFeatures features = detectCpuFeatures();
+		return features;
+	}
+}
+
+PacketKernels const* findPacketKernels(const char* name) {
+	CpuFeatures const &cpu = cpuFeatures();
+	if (std::strcmp(name, "AVX-512") == 0) {
+		return cpu.avx512 ? getPacketKernelsAVX512() : nullptr;
+	}
+	if (std::strcmp(name, "AVX2") == 0) {
+		return cpu.avx2 ? getPacketKernelsAVX2() : nullptr;
+	}
+	if (std::strcmp(name, "SSE2") == 0) {
+		return cpu.sse2 ? getPacketKernelsSSE() : nullptr;
+	}
+	return nullptr;
+}
+
+PacketKernels const* selectPacketKernels() {
+	static PacketKernels const* best = []() -> PacketKernels const* {
+		for (const char* name : { "AVX-512", "AVX2", "SSE2" }) {
+			if (PacketKernels const* kernels = findPacketKernels(name)) {
+				return kernels;
+			}
+		}
+		return nullptr;
+	}();
+	return best;
+}
+
+void setRayPacket(RayPacket &packet, Ray const* rays, int count, int width) {
+	const float tiny = 1e-20f;
+	auto safeInverse = [&](float d) {
+		// Same as the scalar BVH traversal: no 0 * inf = NaN in the box test
+		return 1.f/(std::abs(d) > tiny ? d : std::copysign(tiny, d));
+	};
+
+	packet.size = (count + width - 1) / width * width;
+	packet.tMin = 0.f;
+	for (int i = 0; i < packet.size; i++) {
+		// Padding lanes repeat the first ray, but can never hit anything
+		Ray const &ray = rays[i < count ? i : 0];
+		packet.originX[i] = ray.origin.x;
+		packet.originY[i] = ray.origin.y;
+		packet.originZ[i] = ray.origin.z;
+		packet.directionX[i] = ray.direction.x;
+		packet.directionY[i] = ray.direction.y;
+		packet.directionZ[i] = ray.direction.z;
+		packet.inverseX[i] = safeInverse(ray.direction.x);
+		packet.inverseY[i] = safeInverse(ray.direction.y);
+		packet.inverseZ[i] = safeInverse(ray.direction.z);
+		packet.tMax[i] = i < count ? std::numeric_limits<float>::max() : -1.f;
+		packet.hit[i] = -1;
+	}
+}
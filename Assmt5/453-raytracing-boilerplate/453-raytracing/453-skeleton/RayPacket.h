@@ -0,0 +1,84 @@
+//------------------------------------------------------------------------------
+// Bundles of rays traced together with SIMD instructions.
+//
+// Neighbouring primary rays go through nearly the same BVH nodes and hit the
+// same primitives, so they can be tested as a group: every box or primitive
+// test is done for 4 (SSE), 8 (AVX2) or 16 (AVX-512) rays at once.
+//
+// The kernels for each instruction set live in their own PacketKernels*.cpp
+// file, compiled with that instruction set enabled. selectPacketKernels()
+// picks the widest one the CPU we're running on supports.
+//
+// This header is shared by those files, so it must not pull in anything
+// (like glm) with inline functions: those could end up compiled with AVX
+// instructions and then be called on a CPU without AVX.
+//------------------------------------------------------------------------------
+#pragma once
+
+struct Ray;
+
+const int MAX_PACKET_WIDTH = 16;
+
+// Structure of arrays layout, one entry per ray ("lane")
+struct alignas(64) RayPacket {
+	float originX[MAX_PACKET_WIDTH];
+	float originY[MAX_PACKET_WIDTH];
+	float originZ[MAX_PACKET_WIDTH];
+	float directionX[MAX_PACKET_WIDTH];
+	float directionY[MAX_PACKET_WIDTH];
+	float directionZ[MAX_PACKET_WIDTH];
+	// 1/direction for the box tests
+	float inverseX[MAX_PACKET_WIDTH];
+	float inverseY[MAX_PACKET_WIDTH];
+	float inverseZ[MAX_PACKET_WIDTH];
+
+	// Closest hit so far: ray parameter and the caller's id for the
+	// primitive (-1 if nothing was hit yet). Lanes past `size` are padding
+	// with tMax < 0 so they can never hit anything.
+	float tMax[MAX_PACKET_WIDTH];
+	int hit[MAX_PACKET_WIDTH];
+
+	float tMin;
+	int size;
+};
+
+// A mesh's triangles in structure of arrays layout, as stored by TriangleMesh:
+// the first vertex and the two edges from it, one array per component
+struct TriangleArrays {
+	const float* vertex[3];
+	const float* edge1[3];
+	const float* edge2[3];
+};
+
+// One set of kernels per instruction set. The packet size must be a
+// multiple of `width`. Vectors are passed as pointers to 3 floats.
+struct PacketKernels {
+	const char* name;
+	int width;
+
+	// Bitmask of the lanes whose ray overlaps the box within [tMin, tMax]
+	unsigned (*intersectBox)(RayPacket const &packet, const float* boxMin, const float* boxMax);
+
+	// Möller–Trumbore against triangle number `triangle` of the mesh. Lanes
+	// with a closer hit get their tMax and hit updated to t and id.
+	void (*intersectTriangle)(RayPacket &packet, TriangleArrays const &mesh, int triangle, int id);
+	void (*intersectSphere)(RayPacket &packet, const float* centre, float radius, int id);
+	void (*intersectPlane)(RayPacket &packet, const float* point, const float* normal, int id);
+};
+
+// Each returns nullptr if the instruction set wasn't enabled at compile time
+PacketKernels const* getPacketKernelsSSE();
+PacketKernels const* getPacketKernelsAVX2();
+PacketKernels const* getPacketKernelsAVX512();
+
+// The widest kernels usable on this CPU, or nullptr if there are none (then
+// only the scalar path is available). Decided once, on the first call.
+PacketKernels const* selectPacketKernels();
+
+// The kernels with the given name ("SSE2", "AVX2" or "AVX-512"), or nullptr
+// if they weren't compiled in or this CPU can't run them
+PacketKernels const* findPacketKernels(const char* name);
+
+// Fills the packet with count rays, padded up to a multiple of width with
+// lanes that never hit anything, and clears the hits
+void setRayPacket(RayPacket &packet, Ray const* rays, int count, int width);
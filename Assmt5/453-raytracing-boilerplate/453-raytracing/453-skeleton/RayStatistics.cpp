@@ -0,0 +1,145 @@
+#include "RayStatistics.h"
+
+#include <algorithm>
+
+#include "Log.h"
+
+namespace {
+	double ratio(uint64_t count, uint64_t per) {
+		return per == 0 ? 0.0 : double(count)/double(per);
+	}
+
+	std::string jsonArray(uint64_t const* values, int count) {
+		std::string result = "[";
+		for (int i = 0; i < count; i++) {
+			result += fmt::format("{}{}", i > 0 ? ", " : "", values[i]);
+		}
+		return result + "]";
+	}
+}
+
+void TraversalCounters::add(TraversalCounters const &other) {
+	rayQueries += other.rayQueries;
+	nodeVisits += other.nodeVisits;
+	primitiveTests += other.primitiveTests;
+	packetQueries += other.packetQueries;
+	packetRays += other.packetRays;
+	packetNodeVisits += other.packetNodeVisits;
+	packetPrimitiveTests += other.packetPrimitiveTests;
+}
+
+void TraversalCounters::subtract(TraversalCounters const &other) {
+	rayQueries -= other.rayQueries;
+	nodeVisits -= other.nodeVisits;
+	primitiveTests -= other.primitiveTests;
+	packetQueries -= other.packetQueries;
+	packetRays -= other.packetRays;
+	packetNodeVisits -= other.packetNodeVisits;
+	packetPrimitiveTests -= other.packetPrimitiveTests;
+}
+
+double TraversalCounters::nodesPerQuery() const {
+	return ratio(nodeVisits, rayQueries);
+}
+
+double TraversalCounters::primitivesPerQuery() const {
+	return ratio(primitiveTests, rayQueries);
+}
+
+double TraversalCounters::nodesPerPacket() const {
+	return ratio(packetNodeVisits, packetQueries);
+}
+
+double TraversalCounters::primitivesPerPacket() const {
+	return ratio(packetPrimitiveTests, packetQueries);
+}
+
+double TraversalCounters::raysPerPacket() const {
+	return ratio(packetRays, packetQueries);
+}
+
+TraversalCounters &threadTraversalCounters() {
+	thread_local TraversalCounters counters;
+	return counters;
+}
+
+void RayStatistics::add(RayStatistics const &other) {
+	for (int i = 0; i <= MAX_DEPTH; i++) {
+		rays[i] += other.rays[i];
+		shadowRays[i] += other.shadowRays[i];
+		rouletteKills[i] += other.rouletteKills[i];
+	}
+	traversal.add(other.traversal);
+	tiles += other.tiles;
+	tileSeconds += other.tileSeconds;
+	slowestTileSeconds = std::max(slowestTileSeconds, other.slowestTileSeconds);
+	seconds += other.seconds;
+}
+
+uint64_t RayStatistics::totalRays() const {
+	uint64_t total = 0;
+	for (int i = 0; i <= MAX_DEPTH; i++) {
+		total += rays[i] + shadowRays[i];
+	}
+	return total;
+}
+
+double RayStatistics::megaraysPerSecond() const {
+	return seconds > 0 ? totalRays()/seconds/1e6 : 0.0;
+}
+
+void RayStatistics::log() const {
+	for (int i = 0; i <= MAX_DEPTH; i++) {
+		if (rays[i] == 0) {
+			continue;
+		}
+		Log::info("Depth {}: {} rays, {} shadow rays, {} paths ended by Russian roulette",
+			i, rays[i], shadowRays[i], rouletteKills[i]);
+	}
+	Log::info("{} rays in {:.2f} seconds, {:.2f} Mrays/s", totalRays(), seconds, megaraysPerSecond());
+	Log::info("Single rays: {:.1f} nodes and {:.1f} primitives per query; packets: {:.1f} nodes and {:.1f} primitives per packet of {:.1f} rays",
+		traversal.nodesPerQuery(), traversal.primitivesPerQuery(),
+		traversal.nodesPerPacket(), traversal.primitivesPerPacket(), traversal.raysPerPacket());
+	if (tiles > 0) {
+		Log::info("{} tiles, {:.2f} ms each on average, {:.2f} ms at most",
+			tiles, 1000*tileSeconds/tiles, 1000*slowestTileSeconds);
+	}
+}
+
+std::string RayStatistics::toJSON() const {
+	return fmt::format(
+		"{{\n"
+		"  \"seconds\": {},\n"
+		"  \"totalRays\": {},\n"
+		"  \"megaraysPerSecond\": {},\n"
+		"  \"rays\": {},\n"
+		"  \"shadowRays\": {},\n"
+		"  \"rouletteKills\": {},\n"
+		"  \"traversal\": {{\n"
+		"    \"rayQueries\": {},\n"
+		"    \"nodeVisits\": {},\n"
+		"    \"primitiveTests\": {},\n"
+		"    \"nodesPerQuery\": {},\n"
+		"    \"primitivesPerQuery\": {},\n"
+		"    \"packetQueries\": {},\n"
+		"    \"packetRays\": {},\n"
+		"    \"packetNodeVisits\": {},\n"
+		"    \"packetPrimitiveTests\": {},\n"
+		"    \"nodesPerPacket\": {},\n"
+		"    \"primitivesPerPacket\": {}\n"
+		"  }},\n"
+		"  \"tiles\": {{\n"
+		"    \"count\": {},\n"
+		"    \"seconds\": {},\n"
+		"    \"averageSeconds\": {},\n"
+		"    \"slowestSeconds\": {}\n"
+		"  }}\n"
+		"}}\n",
+		seconds, totalRays(), megaraysPerSecond(),
+		jsonArray(rays, MAX_DEPTH + 1), jsonArray(shadowRays, MAX_DEPTH + 1), jsonArray(rouletteKills, MAX_DEPTH + 1),
+		traversal.rayQueries, traversal.nodeVisits, traversal.primitiveTests,
+		traversal.nodesPerQuery(), traversal.primitivesPerQuery(),
+		traversal.packetQueries, traversal.packetRays, traversal.packetNodeVisits, traversal.packetPrimitiveTests,
+		traversal.nodesPerPacket(), traversal.primitivesPerPacket(),
+		tiles, tileSeconds, tiles > 0 ? tileSeconds/tiles : 0.0, slowestTileSeconds);
+}
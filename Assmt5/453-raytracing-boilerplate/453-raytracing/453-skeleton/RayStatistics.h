@@ -0,0 +1,84 @@
+//------------------------------------------------------------------------------
+// Counts of the rays traced at each depth of the ray tree (0 for primary
+// rays, 1 for their reflections and so on), to see where the ray budget goes
+// and tune the reflection depth and Russian roulette against it, and of the
+// work the BVH and the tiles did for them, to see how fast the tracer is
+// and catch it getting slower.
+//
+// Counting is done per tile into a local RayStatistics, which is then added
+// to the render's total, so threads don't contend on shared counters. The
+// BVH can't be handed a RayStatistics without threading it through every
+// query, so it counts into TraversalCounters of its own, one per thread,
+// which the tiles read before and after to take their share.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Work done by BVH queries. Single rays and SIMD packets are counted apart,
+// since a packet visits a node once for all of its rays.
+struct TraversalCounters {
+	// Queries for single rays, including those into the BVHs of instances
+	uint64_t rayQueries = 0;
+	// Bounding boxes those tested, and the primitives in the leaves they
+	// reached
+	uint64_t nodeVisits = 0;
+	uint64_t primitiveTests = 0;
+
+	// The same for packets, and the rays in them
+	uint64_t packetQueries = 0;
+	uint64_t packetRays = 0;
+	uint64_t packetNodeVisits = 0;
+	uint64_t packetPrimitiveTests = 0;
+
+	void add(TraversalCounters const &other);
+	void subtract(TraversalCounters const &other);
+
+	// Averages of the above, 0 where there were no queries
+	double nodesPerQuery() const;
+	double primitivesPerQuery() const;
+	double nodesPerPacket() const;
+	double primitivesPerPacket() const;
+	double raysPerPacket() const;
+};
+
+// The counters of the calling thread. Only ever touched by that thread, so
+// counting needs no locks or atomics.
+TraversalCounters &threadTraversalCounters();
+
+struct RayStatistics {
+	static const int MAX_DEPTH = 16;
+
+	// Rays looking for the closest hit, i.e. primary and reflected rays
+	uint64_t rays[MAX_DEPTH + 1] = {};
+	// Shadow rays from the hits of those
+	uint64_t shadowRays[MAX_DEPTH + 1] = {};
+	// Paths that Russian roulette ended at this depth instead of reflecting
+	uint64_t rouletteKills[MAX_DEPTH + 1] = {};
+
+	TraversalCounters traversal;
+
+	// Tiles traced (counting every pass over a tile), the time they took on
+	// their threads altogether, and the slowest one
+	uint64_t tiles = 0;
+	double tileSeconds = 0;
+	double slowestTileSeconds = 0;
+
+	// Wall clock time of the render
+	double seconds = 0;
+
+	void add(RayStatistics const &other);
+
+	// Every ray of every kind and depth
+	uint64_t totalRays() const;
+	// Millions of rays per second of wall clock time
+	double megaraysPerSecond() const;
+
+	// One line per depth that saw any rays, then the totals, speed,
+	// traversal cost and tile times
+	void log() const;
+
+	// Everything above as a JSON object, for scripts that track performance
+	std::string toJSON() const;
+};
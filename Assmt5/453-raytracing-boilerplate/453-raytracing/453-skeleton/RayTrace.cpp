@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <iostream>
 #include <glm/common.hpp>
+#include <glm/gtc/constants.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "RayTrace.h"
@@ -14,52 +16,61 @@ Sphere::Sphere(vec3 c, float r, int ID){
 	id = ID;
 }
 
-//------------------------------------------------------------------------------
-// This is part 2 of your assignment. At the moment, the spheres are not showing
-// up. Implement this method to make them show up.
-//
-// Make sure you set all of the appropriate fields in the Intersection object.
-//------------------------------------------------------------------------------
-Intersection Sphere::getIntersection(Ray ray){
-	Intersection i{};
-	i.id = id;
-	i.material = material;
-
-	glm::vec3 sphereOffset = centre - ray.origin;
-	float delta = (pow(glm::dot(ray.direction, sphereOffset), 2) - pow(glm::length(sphereOffset), 2) + pow(radius, 2))/pow(glm::length(ray.direction), 2);
-
-	if (delta < 0)
-	{
-		i.numberOfIntersections = 0;
-		i.normal = { 0.0f, 0.0f, 0.0f };
-		i.point = { 0.0f, 0.0f, 0.0f };
-	}
-	else if (delta == 0)
-	{
-		float parameter = 1 * glm::dot(ray.direction, sphereOffset);
-
-		i.numberOfIntersections = 1;
-		i.point = parameter * ray.direction + ray.origin;
-		i.normal = i.point - centre;
-	}
-	else if (delta > 0)
-	{
-		float parameterOne = 1 * glm::dot(ray.direction, sphereOffset) + sqrt(delta);
-		float parameterTwo = 1 * glm::dot(ray.direction, sphereOffset) - sqrt(delta);
-
-		float parameterToUse = parameterOne;
-		if (abs(parameterTwo) < abs(parameterOne))
-		{
-			parameterToUse = parameterTwo;
-		}
+Intersection Shape::intersectPrimitive(Ray const &ray, int primitive) const {
+	Hit hit;
+	if (!hitPrimitive(ray, primitive, 0.f, std::numeric_limits<float>::max(), hit)) {
+		return Intersection();
+	}
+	hit.shape = this;
+	return resolveHit(ray, hit);
+}
+
+float Sphere::intersect(Ray const &ray) const {
+	return intersectSphere(centre, radius, ray);
+}
 
-		i.numberOfIntersections = 1;
-		i.point = parameterToUse * ray.direction + ray.origin;
-		i.normal =  i.point - centre ;
+bool Sphere::hitPrimitive(Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const {
+	float t = intersect(ray);
+	if (t == 0 || t <= tMin || t >= tMax) {
+		return false;
 	}
+	hit.t = t;
+	hit.primitive = primitive;
+	return true;
+}
+
+Intersection Sphere::resolveHit(Ray const &ray, Hit const &hit) const {
+	Intersection i;
+	i.numberOfIntersections = 1;
+	i.id = id;
+	i.material = &material;
+	i.t = hit.t;
+	i.point = hit.t * ray.direction + ray.origin;
+	i.normal = i.point - centre;
+	i.hit = hit;
 	return i;
 }
 
+SurfaceCoordinates Sphere::surfaceCoordinates(Ray const &ray, Hit const &hit) const {
+	// u goes once around the y axis, from and back to -z, and v from the
+	// bottom (-y) to the top
+	vec3 n = glm::clamp((ray.origin + hit.t*ray.direction - centre)/radius, vec3(-1), vec3(1));
+	float phi = std::atan2(n.x, n.z);
+	float theta = std::asin(n.y);
+	float cosTheta = std::cos(theta);
+	float sinTheta = n.y;
+
+	SurfaceCoordinates result;
+	result.uv = vec2(0.5f + phi*glm::one_over_two_pi<float>(), 0.5f + theta*glm::one_over_pi<float>());
+	result.dpdu = glm::two_pi<float>()*radius*cosTheta*vec3(std::cos(phi), 0, -std::sin(phi));
+	result.dpdv = glm::pi<float>()*radius*vec3(-sinTheta*std::sin(phi), cosTheta, -sinTheta*std::cos(phi));
+	return result;
+}
+
+AABB Sphere::primitiveBounds(int primitive) const {
+	return AABB(centre - vec3(radius), centre + vec3(radius));
+}
+
 Plane::Plane(vec3 p, vec3 n, int ID){
 	point = p;
 	normal = n;
@@ -75,89 +86,300 @@ void debug(char* str, vec3 a){
 	cout << "debug:" << str << ": " << a.x <<", " << a.y <<", " << a.z << endl;
 }
 // --------------------------------------------------------------------------
+void TriangleMesh::reserve(int count){
+	copyBorrowedArrays();
+	for (AlignedVector<float> &column : ownColumns) {
+		column.reserve(count);
+	}
+	if (hasNormals()) ownCornerNormals.reserve(3*count);
+	if (hasUVs()) ownCornerUVs.reserve(3*count);
+	useOwnArrays();
+}
+
+void TriangleMesh::add(vec3 a, vec3 b, vec3 c){
+	copyBorrowedArrays();
+	// Appended, so the arrays grow a little ahead of what's added rather
+	// than being copied for every triangle
+	vec3 e1 = b - a;
+	vec3 e2 = c - a;
+	vec3 n = glm::normalize(glm::cross(e1, e2));
+	float values[COLUMN_COUNT] = { a.x, a.y, a.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z, n.x, n.y, n.z };
+	for (int c = 0; c < COLUMN_COUNT; c++) {
+		ownColumns[c].push_back(values[c]);
+	}
+	if (!ownCornerNormals.empty()) {
+		ownCornerNormals.insert(ownCornerNormals.end(), 3, n);
+	}
+	if (!ownCornerUVs.empty()) {
+		ownCornerUVs.insert(ownCornerUVs.end(), 3, vec2(0));
+	}
+	count++;
+	useOwnArrays();
+}
+
+void TriangleMesh::resize(int count, bool withNormals, bool withUVs){
+	copyBorrowedArrays();
+	for (AlignedVector<float> &column : ownColumns) {
+		column.resize(count);
+	}
+	ownCornerNormals.resize(withNormals ? 3*count : 0);
+	ownCornerUVs.resize(withUVs ? 3*count : 0, vec2(0));
+	this->count = count;
+	useOwnArrays();
+}
+
+void TriangleMesh::reorder(std::vector<int> const &order){
+	copyBorrowedArrays();
+	// The columns are gathered into a new array one at a time, so only one
+	// extra column is needed at once
+	AlignedVector<float> permuted(count);
+	for (AlignedVector<float> &column : ownColumns) {
+		for (int i = 0; i < count; i++) {
+			permuted[i] = column[order[i]];
+		}
+		column.swap(permuted);
+	}
+
+	// The corner arrays are each as big as several columns, so they're put in
+	// order in place instead, one cycle of the permutation at a time
+	auto permuteInPlace = [&](auto &corners) {
+		std::vector<bool> placed(count);
+		for (int start = 0; start < count; start++) {
+			if (placed[start]) {
+				continue;
+			}
+			auto first = corners[3*start], second = corners[3*start + 1], third = corners[3*start + 2];
+			int i = start;
+			for (; order[i] != start; i = order[i]) {
+				std::copy_n(&corners[3*order[i]], 3, &corners[3*i]);
+				placed[i] = true;
+			}
+			corners[3*i] = first;
+			corners[3*i + 1] = second;
+			corners[3*i + 2] = third;
+			placed[i] = true;
+		}
+	};
+	if (!ownCornerNormals.empty()) permuteInPlace(ownCornerNormals);
+	if (!ownCornerUVs.empty()) permuteInPlace(ownCornerUVs);
+	useOwnArrays();
+}
+
+void TriangleMesh::useOwnArrays(){
+	for (int c = 0; c < COLUMN_COUNT; c++) {
+		columns[c] = ownColumns[c].data();
+	}
+	cornerNormals = ownCornerNormals.empty() ? nullptr : ownCornerNormals.data();
+	cornerUVs = ownCornerUVs.empty() ? nullptr : ownCornerUVs.data();
+}
+
+void TriangleMesh::copyBorrowedArrays(){
+	if (!borrowedFrom) {
+		return;
+	}
+	for (int c = 0; c < COLUMN_COUNT; c++) {
+		ownColumns[c].assign(columns[c], columns[c] + count);
+	}
+	if (cornerNormals) ownCornerNormals.assign(cornerNormals, cornerNormals + 3*count);
+	if (cornerUVs) ownCornerUVs.assign(cornerUVs, cornerUVs + 3*count);
+	borrowedFrom.reset();
+	useOwnArrays();
+}
+
+void TriangleMesh::borrow(int count, const float* const columns[COLUMN_COUNT],
+		const vec3* cornerNormals, const vec2* cornerUVs, std::shared_ptr<const void> owner){
+	for (int c = 0; c < COLUMN_COUNT; c++) {
+		ownColumns[c] = AlignedVector<float>();
+		this->columns[c] = columns[c];
+	}
+	ownCornerNormals = AlignedVector<vec3>();
+	ownCornerUVs = AlignedVector<vec2>();
+	this->count = count;
+	this->cornerNormals = cornerNormals;
+	this->cornerUVs = cornerUVs;
+	borrowedFrom = owner;
+}
+
+// The setters write the mesh's own arrays, which resize() made sure it has
+void TriangleMesh::set(int i, vec3 a, vec3 b, vec3 c){
+	vec3 e1 = b - a;
+	vec3 e2 = c - a;
+	vec3 n = glm::normalize(glm::cross(e1, e2));
+	float values[COLUMN_COUNT] = { a.x, a.y, a.z, e1.x, e1.y, e1.z, e2.x, e2.y, e2.z, n.x, n.y, n.z };
+	for (int c = 0; c < COLUMN_COUNT; c++) {
+		ownColumns[c][i] = values[c];
+	}
+}
+
+void TriangleMesh::setNormals(int i, vec3 a, vec3 b, vec3 c){
+	ownCornerNormals[3*i] = a;
+	ownCornerNormals[3*i + 1] = b;
+	ownCornerNormals[3*i + 2] = c;
+}
+
+void TriangleMesh::setUVs(int i, vec2 a, vec2 b, vec2 c){
+	ownCornerUVs[3*i] = a;
+	ownCornerUVs[3*i + 1] = b;
+	ownCornerUVs[3*i + 2] = c;
+}
+
+vec3 TriangleMesh::shadingNormal(int i, float u, float v) const {
+	if (!hasNormals()) {
+		return normal(i);
+	}
+	vec3 n = (1.f - u - v)*cornerNormals[3*i] + u*cornerNormals[3*i + 1] + v*cornerNormals[3*i + 2];
+	float length = glm::length(n);
+	return length > 0.f ? n/length : normal(i);
+}
+
+vec2 TriangleMesh::uv(int i, float u, float v) const {
+	if (!hasUVs()) {
+		return vec2(u, v);
+	}
+	return (1.f - u - v)*cornerUVs[3*i] + u*cornerUVs[3*i + 1] + v*cornerUVs[3*i + 2];
+}
+
+AABB TriangleMesh::bounds(int i) const {
+	vec3 a = vertex(i);
+	AABB bounds;
+	bounds.extend(a);
+	bounds.extend(a + edge1(i));
+	bounds.extend(a + edge2(i));
+	// vertex + edge may round differently from the corner it was made from,
+	// so leave a little room
+	vec3 pad = 1e-6f*(glm::abs(bounds.min) + glm::abs(bounds.max));
+	return AABB(bounds.min - pad, bounds.max + pad);
+}
+
+TriangleArrays TriangleMesh::arrays() const {
+	return TriangleArrays{
+		{ columns[VertexX], columns[VertexY], columns[VertexZ] },
+		{ columns[Edge1X], columns[Edge1Y], columns[Edge1Z] },
+		{ columns[Edge2X], columns[Edge2Y], columns[Edge2Z] },
+	};
+}
+
 void Triangles::initTriangles(int num, vec3 * t, int ID){
 	id = ID;
+	mesh->reserve(mesh->size() + num);
 	for(int i = 0; i< num; i++){
-		triangles.push_back(Triangle(*t, *(t+1), *(t+2)));
+		mesh->add(*t, *(t+1), *(t+2));
 		t+=3;
 	}
 }
 
-Intersection Triangles::intersectTriangle(Ray ray, Triangle triangle){
-	// From https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
-	const float EPSILON = 0.0000001;
-	auto vertex0 = triangle.p1;
-	auto vertex1 = triangle.p2;
-	auto vertex2 = triangle.p3;
-
-	glm::vec3 edge1, edge2, h, s, q;
-	float a,f,u,v;
-	edge1 = vertex1 - vertex0;
-	edge2 = vertex2 - vertex0;
-	h = glm::cross(ray.direction, edge2);
-	a = glm::dot(edge1, h);
-	if (a > -EPSILON && a < EPSILON) {
-		return Intersection{}; // no intersection
-	}
-	f = 1.0/a;
-	s = ray.origin - vertex0;
-	u = f * glm::dot(s, h);
-	if (u < 0.0 || u > 1.0) {
-		return Intersection{}; // no intersection
-	}
-	q = glm::cross(s, edge1);
-	v = f * glm::dot(ray.direction, q);
-	if (v < 0.0 || u + v > 1.0) {
-		return Intersection{}; // no intersection
-	}
-	// At this stage we can compute t to find out where the intersection point is on the line.
-	float t = f * glm::dot(edge2, q);
-	// ray intersection
-	if (t > EPSILON) {
-		Intersection p;
-		p.point = ray.origin + ray.direction * t;
-		p.normal = glm::normalize(glm::cross(edge1, edge2));
-		p.material = material;
-		p.numberOfIntersections = 1;
-		p.id = id;
-		return p;
-	} else {
-		// This means that there is a line intersection but not a ray intersection.
-		return Intersection{}; // no intersection
+bool Triangles::hitPrimitive(Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const {
+	float u, v;
+	float t = mesh->intersect(ray, primitive, u, v);
+	if (t == 0 || t <= tMin || t >= tMax) {
+		return false;
 	}
+	hit.t = t;
+	hit.primitive = primitive;
+	hit.u = u;
+	hit.v = v;
+	return true;
+}
+
+Intersection Triangles::resolveHit(Ray const &ray, Hit const &hit) const {
+	Intersection p;
+	p.point = ray.origin + ray.direction * hit.t;
+	p.normal = mesh->shadingNormal(hit.primitive, hit.u, hit.v);
+	p.uv = mesh->uv(hit.primitive, hit.u, hit.v);
+	p.material = &material;
+	p.numberOfIntersections = 1;
+	p.id = id;
+	p.t = hit.t;
+	p.hit = hit;
+	return p;
+}
+
+SurfaceCoordinates Triangles::surfaceCoordinates(Ray const &ray, Hit const &hit) const {
+	int i = hit.primitive;
+	SurfaceCoordinates result;
+	result.uv = mesh->uv(i, hit.u, hit.v);
+	result.dpdu = mesh->edge1(i);
+	result.dpdv = mesh->edge2(i);
+	if (!mesh->hasUVs()) {
+		// (u, v) are the barycentric coordinates, which run along the edges
+		return result;
+	}
+
+	// Solve edge = dpdu*du + dpdv*dv for both edges
+	const vec2* corners = mesh->cornerUVData() + 3*i;
+	vec2 duv1 = corners[1] - corners[0];
+	vec2 duv2 = corners[2] - corners[0];
+	float determinant = duv1.x*duv2.y - duv1.y*duv2.x;
+	if (std::abs(determinant) < 1e-12f) {
+		// The corners share texture coordinates, so there's nothing to
+		// filter over; the edges will do
+		return result;
+	}
+	vec3 edge1 = result.dpdu;
+	vec3 edge2 = result.dpdv;
+	result.dpdu = (duv2.y*edge1 - duv1.y*edge2)/determinant;
+	result.dpdv = (duv1.x*edge2 - duv2.x*edge1)/determinant;
+	return result;
 }
 
 
 Intersection Triangles::getIntersection(Ray ray){
 	Intersection result{};
-	result.material = material;
-	result.id = id;
-	float min = 9999;
-	result = intersectTriangle(ray, triangles.at(0));
-	if(result.numberOfIntersections!=0)min = glm::distance(result.point, ray.origin);
-	for(int i = 1; i<triangles.size() ;i++){
-		Intersection p = intersectTriangle(ray, triangles.at(i));
-		if(p.numberOfIntersections !=0 && glm::distance(p.point, ray.origin) < min){
-			min = glm::distance(p.point, ray.origin);
+	for(int i = 0; i < mesh->size(); i++){
+		Intersection p = intersectTriangle(ray, i);
+		if(p.numberOfIntersections != 0 && p.t < result.t){
 			result = p;
 		}
 	}
 
-	result.material = material;
+	result.material = &material;
 	result.id = id;
 	return result;
 }
 
-Intersection Plane::getIntersection(Ray ray){
+AABB Triangles::primitiveBounds(int primitive) const {
+	return mesh->bounds(primitive);
+}
+
+float Plane::intersect(Ray const &ray) const {
+	return intersectPlane(point, normal, ray);
+}
+
+bool Plane::hitPrimitive(Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const {
+	float t = intersect(ray);
+	if (t == 0 || t <= tMin || t >= tMax) {
+		return false;
+	}
+	hit.t = t;
+	hit.primitive = primitive;
+	return true;
+}
+
+Intersection Plane::resolveHit(Ray const &ray, Hit const &hit) const {
 	Intersection result;
-	result.material = material;
+	result.material = &material;
 	result.id = id;
 	result.normal = normal;
-	if(dot(normal, ray.direction)>=0)return result;
-	float s = dot(point - ray.origin, normal)/dot(ray.direction, normal);
-	//if(s<0.00001)return result;
 	result.numberOfIntersections = 1;
-	result.point = ray.origin + s*ray.direction;
+	result.t = hit.t;
+	result.point = ray.origin + hit.t*ray.direction;
+	result.hit = hit;
+	return result;
+}
+
+SurfaceCoordinates Plane::surfaceCoordinates(Ray const &ray, Hit const &hit) const {
+	// Axes in the plane, from whichever world axis is furthest from the
+	// normal, so a floor gets x and z
+	vec3 n = glm::normalize(normal);
+	vec3 axis = std::abs(n.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+	vec3 dpdv = glm::normalize(glm::cross(axis, n));
+	vec3 dpdu = glm::cross(n, dpdv);
+
+	vec3 offset = ray.origin + hit.t*ray.direction - point;
+	SurfaceCoordinates result;
+	result.uv = vec2(glm::dot(offset, dpdu), glm::dot(offset, dpdv));
+	result.dpdu = dpdu;
+	result.dpdv = dpdv;
 	return result;
 }
 
@@ -15,8 +15,12 @@
 #include <string>
 #include <glm/glm.hpp>
 #include <iostream>
+#include <limits>
+#include <memory>
 
+#include "AlignedAllocator.h"
 #include "Material.h"
+#include "RayPacket.h"
 
 using namespace std;
 using namespace glm;
@@ -35,55 +39,339 @@ struct Ray {
 	{}
 };
 
+class Shape;
+
+// What a BVH query finds before anything else about the hit is worked out:
+// which primitive of which shape, where along the ray, and where on the
+// primitive (barycentric coordinates, for triangles). The BVH passes many
+// hits on the way to the closest one, so it only keeps these few words, and
+// only the closest is turned into an Intersection with Shape::resolveHit().
+struct Hit {
+	float t = std::numeric_limits<float>::max();
+	Shape const* shape = nullptr;
+	int primitive = -1;
+	float u = 0;
+	float v = 0;
+};
+
+// Texture coordinates at a point on a surface, and how the point moves as
+// they change, for filtering textures over the area a ray's pixel covers
+struct SurfaceCoordinates {
+	vec2 uv = vec2(0);
+	vec3 dpdu = vec3(0);
+	vec3 dpdv = vec3(0);
+};
+
 struct Intersection{
 	int numberOfIntersections;
 	vec3 point;
 	vec3 normal;
 	int id;
 
-	ObjectMaterial material;
+	// Texture coordinates of the hit point, for shapes that have them
+	vec2 uv;
+
+	// What the BVH found, kept for working out more about the hit when it
+	// turns out to be needed, like Shape::surfaceCoordinates() for textures
+	Hit hit;
+
+	// Ray parameter of the hit, i.e. point = ray.origin + t*ray.direction.
+	// Used to order hits along a ray without recomputing distances.
+	float t;
+
+	// The material of the shape hit, which outlives the intersection.
+	// nullptr if nothing was hit.
+	ObjectMaterial const* material;
 
 	Intersection(int no, vec3 n, vec3 f, vec3 nor, int ID){
 		numberOfIntersections = no;
 		point = n;
 		normal = nor;
 		id = ID;
+		uv = vec2(0);
+		t = std::numeric_limits<float>::max();
+		material = nullptr;
 	}
-	Intersection(): numberOfIntersections(0), point(0,0,0), normal(0,0,0), id(-1), material()
+	Intersection(): numberOfIntersections(0), point(0,0,0), normal(0,0,0), id(-1), uv(0,0), t(std::numeric_limits<float>::max()), material(nullptr)
 	{}
 };
 
-struct Triangle{
-	vec3 p1, p2, p3;
-	Triangle(vec3 a, vec3 b, vec3 c){
-		p1 = a;
-		p2 = b;
-		p3 = c;
+// Axis aligned bounding box, used by the acceleration structure in BVH.h
+struct AABB {
+	vec3 min;
+	vec3 max;
+
+	AABB()
+		: min(std::numeric_limits<float>::max())
+		, max(-std::numeric_limits<float>::max())
+	{}
+	AABB(vec3 a, vec3 b): min(a), max(b)
+	{}
+
+	void extend(vec3 p) { min = glm::min(min, p); max = glm::max(max, p); }
+	void extend(AABB const &b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+
+	vec3 centre() const { return 0.5f*(min + max); }
+	vec3 extent() const { return max - min; }
+	bool isEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+	float surfaceArea() const {
+		if (isEmpty()) return 0.f;
+		vec3 e = extent();
+		return 2.f*(e.x*e.y + e.y*e.z + e.z*e.x);
 	}
-	Triangle(vec3 t[3]){
-		p1 = t[0];
-		p2 = t[1];
-		p3 = t[2];
+
+	// Slab test. invDirection is 1/ray.direction, precomputed once per ray.
+	// On a hit, tNear is the parameter where the ray enters the box.
+	bool intersect(Ray const &ray, vec3 const &invDirection, float tMin, float tMax, float &tNear) const {
+		vec3 t0 = (min - ray.origin)*invDirection;
+		vec3 t1 = (max - ray.origin)*invDirection;
+		vec3 tSmall = glm::min(t0, t1);
+		vec3 tBig = glm::max(t0, t1);
+		tNear = glm::max(glm::max(tSmall.x, tSmall.y), glm::max(tSmall.z, tMin));
+		float tFar = glm::min(glm::min(tBig.x, tBig.y), glm::min(tBig.z, tMax));
+		return tNear <= tFar;
 	}
 };
 
+// Ray tests for single spheres and planes. They're inline, and take the
+// geometry rather than a shape, so the BVH can run them straight over its
+// own packed arrays of spheres and planes. Each returns the ray parameter of
+// the hit, or 0 if the ray misses.
+
+//------------------------------------------------------------------------------
+// This is part 2 of your assignment. At the moment, the spheres are not showing
+// up. Implement this method to make them show up.
+//
+// Make sure Sphere::resolveHit() in RayTrace.cpp sets all of the appropriate
+// fields in the Intersection object.
+//------------------------------------------------------------------------------
+inline float intersectSphere(vec3 const &centre, float radius, Ray const &ray) {
+	// Solve |origin + t*direction - centre|^2 = radius^2 for t. The direction
+	// is not assumed to be normalized (shadow rays aren't).
+	const float EPSILON = 0.00001;
+	glm::vec3 sphereOffset = centre - ray.origin;
+	float a = glm::dot(ray.direction, ray.direction);
+	float b = glm::dot(ray.direction, sphereOffset);
+	float c = glm::dot(sphereOffset, sphereOffset) - radius*radius;
+	float delta = b*b - a*c;
+
+	if (delta < 0 || a == 0)
+	{
+		return 0; // no intersection
+	}
+
+	float root = std::sqrt(delta);
+	float parameterOne = (b - root)/a;
+	float parameterTwo = (b + root)/a;
+
+	// Use the nearest hit in front of the ray origin. When the origin is
+	// inside the sphere that is the far one.
+	float parameterToUse = parameterOne > EPSILON ? parameterOne : parameterTwo;
+	if (parameterToUse <= EPSILON)
+	{
+		return 0; // sphere is behind the ray
+	}
+	return parameterToUse;
+}
+
+// Only hits from the side the normal points to count
+inline float intersectPlane(vec3 const &point, vec3 const &normal, Ray const &ray) {
+	if(dot(normal, ray.direction)>=0)return 0;
+	float s = dot(point - ray.origin, normal)/dot(ray.direction, normal);
+	if(s<0.00001)return 0;
+	return s;
+}
+
+// The triangles of a mesh in structure of arrays layout: one cache line
+// aligned array per component, so the SIMD kernels can read them directly and
+// a ray test only touches what it needs. Each triangle is stored as its first
+// vertex and the two edges from it, which is what Möller–Trumbore works with,
+// plus its unit normal, which is only read once a hit is found. Meshes loaded
+// from files are sorted along a space filling curve (see loadMesh()), so the
+// triangles a BVH leaf holds are close together in every array.
+//
+// Meshes loaded from files may also have a normal and texture coordinates at
+// each corner, interpolated over the triangle.
+//
+// The arrays are normally the mesh's own, but can also be borrowed from
+// somewhere else, like a scene cache mapped into memory.
+class TriangleMesh {
+public:
+	// The arrays, one float per triangle each
+	enum Column {
+		VertexX, VertexY, VertexZ,
+		Edge1X, Edge1Y, Edge1Z,
+		Edge2X, Edge2Y, Edge2Z,
+		NormalX, NormalY, NormalZ,
+		COLUMN_COUNT
+	};
+
+	TriangleMesh() { useOwnArrays(); }
+	// Copies would point at the original's arrays
+	TriangleMesh(const TriangleMesh&) = delete;
+	TriangleMesh& operator=(const TriangleMesh&) = delete;
+
+	void reserve(int count);
+	void add(vec3 a, vec3 b, vec3 c);
+	int size() const { return count; }
+
+	// Makes room for count triangles, to be filled in with set() (and
+	// setNormals()/setUVs() if asked for). Different triangles can be set
+	// from different threads at the same time.
+	void resize(int count, bool withNormals = false, bool withUVs = false);
+	void set(int i, vec3 a, vec3 b, vec3 c);
+	void setNormals(int i, vec3 a, vec3 b, vec3 c);
+	void setUVs(int i, vec2 a, vec2 b, vec2 c);
+
+	// Puts the triangles in a new order: triangle i becomes what triangle
+	// order[i] was. order must hold every triangle once.
+	void reorder(std::vector<int> const &order);
+
+	bool hasNormals() const { return cornerNormals != nullptr; }
+	bool hasUVs() const { return cornerUVs != nullptr; }
+
+	vec3 vertex(int i) const { return vec3(columns[VertexX][i], columns[VertexY][i], columns[VertexZ][i]); }
+	vec3 edge1(int i) const { return vec3(columns[Edge1X][i], columns[Edge1Y][i], columns[Edge1Z][i]); }
+	vec3 edge2(int i) const { return vec3(columns[Edge2X][i], columns[Edge2Y][i], columns[Edge2Z][i]); }
+	vec3 normal(int i) const { return vec3(columns[NormalX][i], columns[NormalY][i], columns[NormalZ][i]); }
+	AABB bounds(int i) const;
+
+	// Interpolated at barycentric coordinates (u, v) of the triangle. The
+	// normal is the triangle's own without per-corner normals, and the
+	// texture coordinates are (u, v) without per-corner ones.
+	vec3 shadingNormal(int i, float u, float v) const;
+	vec2 uv(int i, float u, float v) const;
+
+	// Möller–Trumbore. Returns the ray parameter of the hit, or 0 if the ray
+	// misses (hits at t <= epsilon don't count), and the barycentric
+	// coordinates of the hit in u and v. Inline, defined below the class, as
+	// it's the innermost loop of every BVH query.
+	float intersect(Ray const &ray, int i, float &u, float &v) const;
+	float intersect(Ray const &ray, int i) const { float u, v; return intersect(ray, i, u, v); }
+
+	// The arrays, for the packet kernels
+	TriangleArrays arrays() const;
+
+	// The raw arrays, for saving the mesh: size() floats per column, and
+	// 3*size() corner normals and texture coordinates (nullptr if none)
+	const float* column(Column c) const { return columns[c]; }
+	const vec3* cornerNormalData() const { return cornerNormals; }
+	const vec2* cornerUVData() const { return cornerUVs; }
+
+	// Reads arrays laid out as above from memory owned by something else,
+	// without copying them. They must stay as they are, and are expected to
+	// be aligned like the mesh's own. owner is kept alive while they're used.
+	void borrow(int count, const float* const columns[COLUMN_COUNT],
+		const vec3* cornerNormals, const vec2* cornerUVs, std::shared_ptr<const void> owner);
+
+private:
+	// Points the arrays that are read at the mesh's own
+	void useOwnArrays();
+	// Before changing a mesh with borrowed arrays, makes them its own
+	void copyBorrowedArrays();
+
+	// What the accessors read
+	int count = 0;
+	const float* columns[COLUMN_COUNT];
+	const vec3* cornerNormals = nullptr;
+	const vec2* cornerUVs = nullptr;
+	std::shared_ptr<const void> borrowedFrom;
+
+	// The mesh's own arrays
+	AlignedVector<float> ownColumns[COLUMN_COUNT];
+	// Three per triangle, if any
+	AlignedVector<vec3> ownCornerNormals;
+	AlignedVector<vec2> ownCornerUVs;
+};
+
+inline float TriangleMesh::intersect(Ray const &ray, int i, float &u, float &v) const {
+	// From https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
+	const float EPSILON = 0.0000001;
+	vec3 edge1 = this->edge1(i);
+	vec3 edge2 = this->edge2(i);
+
+	glm::vec3 h, s, q;
+	float a,f;
+	h = glm::cross(ray.direction, edge2);
+	a = glm::dot(edge1, h);
+	if (a > -EPSILON && a < EPSILON) {
+		return 0; // no intersection
+	}
+	f = 1.0/a;
+	s = ray.origin - vertex(i);
+	u = f * glm::dot(s, h);
+	if (u < 0.0 || u > 1.0) {
+		return 0; // no intersection
+	}
+	q = glm::cross(s, edge1);
+	v = f * glm::dot(ray.direction, q);
+	if (v < 0.0 || u + v > 1.0) {
+		return 0; // no intersection
+	}
+	// At this stage we can compute t to find out where the intersection point is on the line.
+	float t = f * glm::dot(edge2, q);
+	// This means that there is a line intersection but not a ray intersection.
+	return t > EPSILON ? t : 0;
+}
+
 class Shape{
 public:
 	virtual Intersection getIntersection(Ray ray) = 0;
 
+	// Per-primitive interface used to build and traverse the BVH. A shape is
+	// made of primitiveCount() pieces (e.g. the triangles of a mesh), each of
+	// which can be bounded and intersected on its own.
+	virtual int primitiveCount() const { return 1; }
+	virtual AABB primitiveBounds(int primitive) const = 0;
+
+	// Whether the ray hits the primitive with tMin < t < tMax. If it does,
+	// fills in the hit's t, primitive, u and v (the caller knows the shape).
+	// Called for every primitive a query reaches, so it works out nothing
+	// that's only needed to shade the hit.
+	virtual bool hitPrimitive(Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const = 0;
+	// The rest of a hit that hitPrimitive() found on the same ray: point,
+	// normal, texture coordinates and material
+	virtual Intersection resolveHit(Ray const &ray, Hit const &hit) const = 0;
+	// The texture coordinates of the hit and their derivatives. Only
+	// textured materials need them, so resolveHit() leaves them out.
+	// Spheres are mapped by longitude and latitude, planes by distance
+	// along two axes in the plane, and triangles by their corners' texture
+	// coordinates (or barycentric coordinates without them).
+	virtual SurfaceCoordinates surfaceCoordinates(Ray const &ray, Hit const &hit) const = 0;
+
+	// Both at once, for any t
+	Intersection intersectPrimitive(Ray const &ray, int primitive) const;
+
+	// Infinite shapes (planes) can't be put in a BVH and are tested separately
+	virtual bool isBounded() const { return true; }
+
 	int id;
 	ObjectMaterial material;
 
-	Shape(): material()
+	// Whether the shape blocks light from reaching other shapes, i.e. is
+	// tested by shadow rays. Turned off for things like the walls of a room
+	// that the light would otherwise be boxed in by.
+	bool castsShadows;
+
+	Shape(): material(), castsShadows(true)
 	{}
 };
 
 class Triangles: public Shape{
 public:
-	vector<Triangle> triangles;
+	// Shared, so several shapes (and the scenes reloaded from a file) can use
+	// one copy of a mesh, each with its own material
+	std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>();
 	Intersection getIntersection(Ray ray);
-	Intersection intersectTriangle(Ray ray, Triangle t);
+	Intersection intersectTriangle(Ray const &ray, int triangle) const { return intersectPrimitive(ray, triangle); }
 	void initTriangles(int num, vec3* t, int ID);
+
+	int primitiveCount() const { return mesh->size(); }
+	AABB primitiveBounds(int primitive) const;
+	bool hitPrimitive(Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const;
+	Intersection resolveHit(Ray const &ray, Hit const &hit) const;
+	SurfaceCoordinates surfaceCoordinates(Ray const &ray, Hit const &hit) const;
 };
 
 class Sphere: public Shape{
@@ -91,7 +379,15 @@ public:
 	vec3 centre;
 	float radius;
 	Sphere(vec3 c, float r, int ID);
-	Intersection getIntersection(Ray ray);
+	Intersection getIntersection(Ray ray) { return intersectPrimitive(ray, 0); }
+	// The ray parameter of the nearest hit in front of the ray, or 0 if
+	// there's none (see intersectSphere())
+	float intersect(Ray const &ray) const;
+
+	AABB primitiveBounds(int primitive) const;
+	bool hitPrimitive(Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const;
+	Intersection resolveHit(Ray const &ray, Hit const &hit) const;
+	SurfaceCoordinates surfaceCoordinates(Ray const &ray, Hit const &hit) const;
 };
 
 class Plane: public Shape{
@@ -99,6 +395,14 @@ public:
 	vec3 point;
 	vec3 normal;
 	Plane(vec3 p, vec3 n, int ID);
-	Intersection getIntersection(Ray ray);
+	Intersection getIntersection(Ray ray) { return intersectPrimitive(ray, 0); }
+	// The ray parameter of the hit from the front, or 0 if there's none
+	float intersect(Ray const &ray) const;
+
+	bool isBounded() const { return false; }
+	AABB primitiveBounds(int primitive) const { return AABB(); }
+	bool hitPrimitive(Ray const &ray, int primitive, float tMin, float tMax, Hit &hit) const;
+	Intersection resolveHit(Ray const &ray, Hit const &hit) const;
+	SurfaceCoordinates surfaceCoordinates(Ray const &ray, Hit const &hit) const;
 };
 
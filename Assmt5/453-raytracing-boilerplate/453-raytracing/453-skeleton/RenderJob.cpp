@@ -0,0 +1,23 @@
+#include "RenderJob.h"
+
+RenderJob::RenderJob(std::function<void(std::atomic<bool> const &cancelled)> work) {
+	thread = std::thread([this, work]() {
+		work(cancelled);
+		done = true;
+	});
+}
+
+RenderJob::~RenderJob() {
+	cancel();
+}
+
+void RenderJob::cancel() {
+	cancelled = true;
+	wait();
+}
+
+void RenderJob::wait() {
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
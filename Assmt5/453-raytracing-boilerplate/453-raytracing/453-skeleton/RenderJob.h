@@ -0,0 +1,45 @@
+//------------------------------------------------------------------------------
+// Runs a render in the background so the window stays responsive.
+//
+// The work function runs on its own thread (and typically fans out to the
+// ThreadPool from there). It is handed a cancel flag which it should check
+// regularly, e.g. before each tile, and return early once it is set.
+//
+// Example:
+//	RenderJob job([&](std::atomic<bool> const &cancelled) {
+//		raytraceImage(scene, integrator, image, scene.camera, target, &cancelled);
+//	});
+//	...
+//	job.cancel(); // and/or job.wait()
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+class RenderJob {
+public:
+	explicit RenderJob(std::function<void(std::atomic<bool> const &cancelled)> work);
+	RenderJob(const RenderJob&) = delete;
+	RenderJob operator=(const RenderJob&) = delete;
+
+	// Cancels the job and waits for it to stop
+	~RenderJob();
+
+	// Asks the job to stop and waits until it has. Anything the job already
+	// published stays published.
+	void cancel();
+
+	// Waits for the job to finish (or stop, if cancelled)
+	void wait();
+
+	// True once the work function has returned
+	bool isDone() const { return done.load(); }
+	bool isCancelled() const { return cancelled.load(); }
+
+private:
+	std::atomic<bool> cancelled{false};
+	std::atomic<bool> done{false};
+	std::thread thread;
+};
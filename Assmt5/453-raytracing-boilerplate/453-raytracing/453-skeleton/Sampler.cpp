@@ -0,0 +1,278 @@
+#include "Sampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace {
+	// 24 bits fill a float's mantissa exactly, so this can't round up to 1
+	float toFloat(uint32_t bits) {
+		return float(bits >> 8) * (1.f / 16777216.f);
+	}
+
+	uint32_t hash(uint32_t x) {
+		// From https://github.com/skeeto/hash-prospector
+		x ^= x >> 16;
+		x *= 0x7feb352du;
+		x ^= x >> 15;
+		x *= 0x846ca68bu;
+		x ^= x >> 16;
+		return x;
+	}
+
+	uint32_t hash(uint32_t a, uint32_t b) {
+		return hash(a ^ hash(b + 0x9e3779b9u));
+	}
+
+	uint32_t reverseBits(uint32_t x) {
+		x = (x << 16) | (x >> 16);
+		x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+		x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+		x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+		x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+		return x;
+	}
+
+	// --------------------------------------------------------------------------
+	// Sobol
+
+	// Owen scrambling: each bit flipped or not depending on all the bits
+	// above it, with a hash that does that for every bit at once
+	uint32_t owenScramble(uint32_t x, uint32_t seed) {
+		x = reverseBits(x);
+		x += seed;
+		x ^= x*0x6c50b47cu;
+		x ^= x*0xb82f1e52u;
+		x ^= x*0xc7afe638u;
+		x ^= x*0x8d22f6e6u;
+		return reverseBits(x);
+	}
+
+	// The first Sobol dimension is the van der Corput sequence. The second
+	// has the direction numbers of the polynomial x + 1: each one is the one
+	// before xored with itself shifted right.
+	void sobol2D(uint32_t index, uint32_t &first, uint32_t &second) {
+		first = reverseBits(index);
+		second = 0;
+		for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+			if (index & 1) {
+				second ^= v;
+			}
+		}
+	}
+
+	// --------------------------------------------------------------------------
+	// Halton
+
+	const int HALTON_DIMENSIONS = 32;
+	const uint32_t PRIMES[HALTON_DIMENSIONS] = {
+		2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+		59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131
+	};
+
+	// The digits of index in the base, mirrored around the point
+	float radicalInverse(uint32_t base, uint32_t index) {
+		double inverseBase = 1.0/base;
+		double scale = inverseBase;
+		double result = 0;
+		while (index > 0) {
+			result += (index % base)*scale;
+			index /= base;
+			scale *= inverseBase;
+		}
+		return float(result);
+	}
+
+	// --------------------------------------------------------------------------
+	// Blue noise
+
+	const int TILE_SIZE = 64;
+	const int TILE_PIXELS = TILE_SIZE*TILE_SIZE;
+
+	// A tile whose values, thresholded anywhere, give evenly spread points
+	// with no low frequencies, made with Ulichney's void and cluster method.
+	// Values are in [0, 1), one for each rank.
+	class BlueNoiseTile {
+	public:
+		BlueNoiseTile() {
+			// Gaussian around each point, wrapped around the tile so it tiles
+			const float SIGMA = 1.5f;
+			std::vector<float> kernel(TILE_PIXELS);
+			for (int y = 0; y < TILE_SIZE; y++) {
+				for (int x = 0; x < TILE_SIZE; x++) {
+					int dx = std::min(x, TILE_SIZE - x);
+					int dy = std::min(y, TILE_SIZE - y);
+					kernel[y*TILE_SIZE + x] = std::exp(-(dx*dx + dy*dy)/(2.f*SIGMA*SIGMA));
+				}
+			}
+
+			std::vector<unsigned char> on(TILE_PIXELS, 0);
+			std::vector<float> energy(TILE_PIXELS, 0.f);
+			auto toggle = [&](int pixel) {
+				on[pixel] = !on[pixel];
+				float sign = on[pixel] ? 1.f : -1.f;
+				int px = pixel % TILE_SIZE;
+				int py = pixel / TILE_SIZE;
+				for (int y = 0; y < TILE_SIZE; y++) {
+					int ky = (y - py + TILE_SIZE) % TILE_SIZE;
+					for (int x = 0; x < TILE_SIZE; x++) {
+						energy[y*TILE_SIZE + x] += sign*kernel[ky*TILE_SIZE + (x - px + TILE_SIZE) % TILE_SIZE];
+					}
+				}
+			};
+			// The point in the tightest cluster, or the emptiest void
+			auto tightestCluster = [&]() {
+				int best = -1;
+				for (int p = 0; p < TILE_PIXELS; p++) {
+					if (on[p] && (best < 0 || energy[p] > energy[best])) best = p;
+				}
+				return best;
+			};
+			auto largestVoid = [&]() {
+				int best = -1;
+				for (int p = 0; p < TILE_PIXELS; p++) {
+					if (!on[p] && (best < 0 || energy[p] < energy[best])) best = p;
+				}
+				return best;
+			};
+
+			// Start from a tenth of the pixels at random, and spread them out
+			// by moving points from clusters to voids until that changes
+			// nothing (which it always comes to, well before the limit)
+			PCG32 random(453);
+			int initial = TILE_PIXELS/10;
+			for (int count = 0; count < initial; ) {
+				int p = int(random.next() % TILE_PIXELS);
+				if (!on[p]) {
+					toggle(p);
+					count++;
+				}
+			}
+			for (int moves = 0; moves < TILE_PIXELS; moves++) {
+				int cluster = tightestCluster();
+				toggle(cluster);
+				int gap = largestVoid();
+				toggle(gap);
+				if (gap == cluster) {
+					break;
+				}
+			}
+			std::vector<unsigned char> start = on;
+			std::vector<float> startEnergy = energy;
+
+			// Rank the starting points by taking the most clustered first, then
+			// fill the rest in, emptiest first
+			std::vector<int> rank(TILE_PIXELS);
+			for (int r = initial - 1; r >= 0; r--) {
+				int p = tightestCluster();
+				toggle(p);
+				rank[p] = r;
+			}
+			on = start;
+			energy = startEnergy;
+			for (int r = initial; r < TILE_PIXELS; r++) {
+				int p = largestVoid();
+				toggle(p);
+				rank[p] = r;
+			}
+
+			for (int p = 0; p < TILE_PIXELS; p++) {
+				values[p] = (rank[p] + 0.5f)/TILE_PIXELS;
+			}
+		}
+
+		float operator()(int x, int y) const {
+			return values[(y & (TILE_SIZE - 1))*TILE_SIZE + (x & (TILE_SIZE - 1))];
+		}
+
+	private:
+		float values[TILE_PIXELS];
+	};
+
+	BlueNoiseTile const &blueNoise() {
+		// Made by whichever thread gets here first, the others wait for it
+		static const BlueNoiseTile tile;
+		return tile;
+	}
+
+	const struct { const char* name; SampleSequence sequence; } SEQUENCES[] = {
+		{ "random", SampleSequence::Random },
+		{ "halton", SampleSequence::Halton },
+		{ "sobol", SampleSequence::Sobol },
+		{ "bluenoise", SampleSequence::BlueNoise },
+	};
+}
+
+bool findSampleSequence(const char* name, SampleSequence &sequence) {
+	for (auto const &entry : SEQUENCES) {
+		if (std::strcmp(entry.name, name) == 0) {
+			sequence = entry.sequence;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char* sampleSequenceName(SampleSequence sequence) {
+	for (auto const &entry : SEQUENCES) {
+		if (entry.sequence == sequence) {
+			return entry.name;
+		}
+	}
+	return "unknown";
+}
+
+Sampler::Sampler(SampleSequence sequence, int x, int y, int width, int sample)
+	: sequence(sequence)
+	, x(x)
+	, y(y)
+	, sample(uint32_t(sample))
+	, pixelSeed(hash(uint32_t(y)*uint32_t(width) + uint32_t(x)))
+	, random(uint64_t(y)*width + x, uint64_t(sample))
+{
+	if (sequence == SampleSequence::BlueNoise) {
+		// Made now, rather than partway through a tile
+		blueNoise();
+	}
+}
+
+float Sampler::nextFloat() {
+	uint32_t d = dimension++;
+	switch (sequence) {
+	case SampleSequence::Random:
+		break;
+	case SampleSequence::Halton:
+		if (d < uint32_t(HALTON_DIMENSIONS)) {
+			// Cranley-Patterson rotation: shifted by a different amount for
+			// every pixel and dimension, wrapping around
+			float value = radicalInverse(PRIMES[d], sample) + toFloat(hash(pixelSeed, d));
+			value -= std::floor(value);
+			return std::min(value, 0.99999994f);
+		}
+		break;
+	case SampleSequence::Sobol: {
+		if (d & 1) {
+			return pending;
+		}
+		// Each pair of dimensions shuffles the samples differently, so the
+		// pairs aren't correlated with each other
+		uint32_t pairSeed = hash(pixelSeed, d);
+		uint32_t index = owenScramble(sample, pairSeed);
+		uint32_t first, second;
+		sobol2D(index, first, second);
+		pending = toFloat(owenScramble(second, hash(pairSeed, 2)));
+		return toFloat(owenScramble(first, hash(pairSeed, 1)));
+	}
+	case SampleSequence::BlueNoise: {
+		// Every dimension reads the tile from its own offset, and every
+		// sample steps it along by the golden ratio, which keeps a pixel's
+		// samples spread out over time too
+		uint32_t offset = hash(d, 0x5bd1e995u);
+		float value = blueNoise()(x + int(offset & 0xffff), y + int(offset >> 16)) + 0.618034f*(sample % 4096);
+		value -= std::floor(value);
+		return std::min(value, 0.99999994f);
+	}
+	}
+	return random.nextFloat();
+}
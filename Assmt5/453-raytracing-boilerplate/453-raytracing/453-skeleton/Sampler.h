@@ -0,0 +1,62 @@
+//------------------------------------------------------------------------------
+// The numbers each pixel sample uses to jitter its ray, pick lights, bounce
+// and so on, from one of several sequences.
+//
+// Independent random numbers clump and leave gaps, so it takes many samples
+// before a pixel has seen every part of a light or every bounce direction
+// evenly. Low discrepancy sequences spread each pixel's samples out evenly
+// instead, and so reach the same noise level with fewer samples:
+//
+//   random     independent random numbers (PCG32), as the renderer used to
+//   halton     the Halton sequence, a different prime base per dimension
+//   sobol      the Sobol sequence, Owen scrambled (the default)
+//   bluenoise  a tiled blue noise texture, stepped by the golden ratio from
+//              one sample to the next
+//
+// Each number a sample takes is the next dimension of its sequence. Every
+// pixel gets its own scrambling (or, for blue noise, its own place in the
+// texture), so neighbouring pixels don't repeat each other's pattern, and
+// every dimension is scrambled differently so they don't line up either.
+// Sobol is used in pairs of dimensions, each pair a shuffled and scrambled
+// copy of the first two Sobol dimensions (Burley, "Practical Hash-based Owen
+// Scrambling", 2020), which keeps the best quality without needing tables
+// of direction numbers.
+//
+// A Sampler is a few words of state made on the stack for one sample, so it
+// takes no locks and allocates nothing. The only shared data, the blue noise
+// texture, is made once on first use and then only read.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <cstdint>
+
+#include "Random.h"
+
+enum class SampleSequence { Random, Halton, Sobol, BlueNoise };
+
+// The sequence called name, as listed above. Returns false if there's none.
+bool findSampleSequence(const char* name, SampleSequence &sequence);
+const char* sampleSequenceName(SampleSequence sequence);
+
+class Sampler {
+public:
+	Sampler() = default;
+	// For sample number `sample` of pixel (x, y) of an image width wide
+	Sampler(SampleSequence sequence, int x, int y, int width, int sample);
+
+	// Uniform in [0, 1), the next dimension of the sequence
+	float nextFloat();
+
+private:
+	SampleSequence sequence = SampleSequence::Random;
+	int x = 0;
+	int y = 0;
+	uint32_t sample = 0;
+	uint32_t dimension = 0;
+	// Hash of the pixel, to scramble it differently from the others
+	uint32_t pixelSeed = 0;
+	// The random sequence, and every sequence past its last dimension
+	PCG32 random;
+	// Sobol makes two dimensions at a time
+	float pending = 0;
+};
@@ -5,6 +5,41 @@
 #include <algorithm> // For std::max
 #include <limits> // For std::numeric_limits
 
+void Scene::buildAccelerationStructure() {
+	bvh = std::make_shared<BVH>();
+	bvh->build(shapesInScene);
+}
+
+void Scene::prepareLights() {
+	lightDistribution.build(lights);
+	areaLights.clear();
+	ambientLight = glm::vec3(0);
+	for (int l = 0; l < int(lights.size()); l++) {
+		if (lights[l].isArea() && lights[l].hasArea()) {
+			areaLights.push_back(l);
+		}
+		ambientLight += lights[l].ambient*lights[l].colour;
+	}
+}
+
+bool Scene::occluded(glm::vec3 from, glm::vec3 to, int skipID) const {
+	// With the direction unnormalized the segment is 0 < t < 1. Keep clear of
+	// both ends so neither surface counts as its own blocker.
+	const float EPSILON = 0.00001f;
+	Ray ray(from, to - from);
+	float length = glm::length(ray.direction);
+	if (length <= EPSILON) {
+		return false;
+	}
+	return bvh->occluded(ray, skipID, EPSILON/length, 1.f - EPSILON/length);
+}
+
+bool Scene::occludedTowards(glm::vec3 from, glm::vec3 direction, int skipID) const {
+	const float EPSILON = 0.00001f;
+	Ray ray(from, glm::normalize(direction));
+	return bvh->occluded(ray, skipID, EPSILON, std::numeric_limits<float>::infinity());
+}
+
 // Some constants defining the various scenes
 
 //Reflective grey sphere
@@ -305,10 +340,19 @@ Scene initScene1() {
 	backWall->material.diffuse = vec3(1.0, 1.0, 1.0);
 	scene1.shapesInScene.push_back(backWall);
 
-	scene1.lightPosition = vec3(0,2.5,-7.75);
-
-	scene1.lightColor = vec3(1,1,1);
-	scene1.ambientFactor = 0.1f;
+	// Only the sphere and the pyramid cast shadows, the room around them
+	// doesn't
+	for (auto wall : { rightWall, leftWall, floorWall, ceilingWall, backWall }) {
+		wall->castsShadows = false;
+	}
+
+	Light light;
+	light.position = vec3(0,2.5,-7.75);
+	light.colour = vec3(1,1,1);
+	light.ambient = 0.1f;
+	scene1.lights.push_back(light);
+	scene1.prepareLights();
+	scene1.buildAccelerationStructure();
 	return scene1;
 }
 
@@ -370,11 +414,16 @@ Scene initScene2() {
 	backWallTwo->material.ambient = 0.5f*backWallTwo->material.diffuse;
 	backWallTwo->material.specular = backWallTwo->material.diffuse;
 	backWallTwo->material.specularCoefficient = 8;
+	backWallTwo->castsShadows = false;
 	scene2.shapesInScene.push_back(backWallTwo);
 
-	scene2.lightPosition = vec3(4, 6, -1);
-	scene2.lightColor = vec3(1,1,1);
-	scene2.ambientFactor = 0.1f;
+	Light light;
+	light.position = vec3(4, 6, -1);
+	light.colour = vec3(1,1,1);
+	light.ambient = 0.1f;
+	scene2.lights.push_back(light);
+	scene2.prepareLights();
+	scene2.buildAccelerationStructure();
 
 	return scene2;
 }
@@ -7,15 +7,44 @@
 #pragma once
 
 #include "RayTrace.h"
+#include "BVH.h"
+#include "Camera.h"
+#include "Light.h"
 #include <memory>
 
 class Shape;
 
 struct Scene {
-	glm::vec3 lightPosition;
-	glm::vec3 lightColor;
-	float ambientFactor;
+	std::vector<Light> lights;
+	// Built from lights by prepareLights()
+	LightDistribution lightDistribution;
+	// Indices into lights of the ones rays can hit (see Light::hasArea()),
+	// so the others don't have to be tried along every ray
+	std::vector<int> areaLights;
+	// The sum of every light's ambient contribution
+	glm::vec3 ambientLight = glm::vec3(0);
+
+	// What the scene is seen through, see Camera.h
+	Camera camera;
 	std::vector<std::shared_ptr<Shape>> shapesInScene;
+
+	// Built from shapesInScene by buildAccelerationStructure(). Shared so
+	// that copying a Scene doesn't copy the tree.
+	std::shared_ptr<BVH> bvh;
+
+	// Call once all the shapes have been added, and again if they change
+	void buildAccelerationStructure();
+
+	// Call once all the lights have been added, and again if they change
+	void prepareLights();
+
+	// Whether a shape that casts shadows lies on the segment between from
+	// and to, ignoring the shape with id skipID (usually the one `from` is
+	// on). Used for shadow rays, so it stops at the first blocker found.
+	bool occluded(glm::vec3 from, glm::vec3 to, int skipID) const;
+	// Same for the ray from `from` along direction, all the way to infinity,
+	// for lights at infinity
+	bool occludedTowards(glm::vec3 from, glm::vec3 direction, int skipID) const;
 };
 
 
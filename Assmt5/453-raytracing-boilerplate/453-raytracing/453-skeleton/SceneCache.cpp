@@ -0,0 +1,423 @@
+#include "SceneCache.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Instance.h"
+#include "Log.h"
+#include "MappedFile.h"
+
+namespace {
+	// The arrays in the file start on cache line boundaries, so once mapped
+	// they are aligned just like the ones built in memory
+	const std::size_t ALIGNMENT = 64;
+	const char MAGIC[8] = { '4', '5', '3', 'S', 'C', 'E', 'N', 'E' };
+	// Reads back as something else on a machine with the other byte order
+	const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+	static_assert(std::is_trivially_copyable<BVH::Node>::value, "BVH nodes are saved as they are");
+	static_assert(std::is_trivially_copyable<BVH::PrimitiveRef>::value, "BVH primitives are saved as they are");
+
+	// Offsets are from the start of the file. Arrays that aren't there have
+	// offset 0, where the header is.
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		// So a cache from a build that lays these out differently is rejected
+		uint32_t nodeSize;
+		uint32_t primitiveRefSize;
+		uint32_t lightSize;
+		uint32_t cameraSize;
+		uint64_t fileSize;
+
+		// Saved as it is in memory, like the lights
+		Camera camera;
+
+		// Lights are saved as they are in memory
+		uint64_t lightCount;
+		uint64_t lightsOffset;
+		uint64_t shapeCount;
+		uint64_t shapesOffset;
+		uint64_t meshCount;
+		uint64_t meshesOffset;
+		uint64_t prototypeCount;
+		uint64_t prototypesOffset;
+		uint64_t nodeCount;
+		uint64_t nodesOffset;
+		uint64_t primitiveCount;
+		uint64_t primitivesOffset;
+	};
+
+	enum ShapeKind : uint32_t { TrianglesShape, SphereShape, PlaneShape, InstanceShape };
+
+	struct ShapeRecord {
+		uint32_t kind;
+		int32_t id;
+		uint32_t castsShadows;
+		// Index into the meshes for triangles, or into the prototypes for
+		// instances. Shapes can share them.
+		uint32_t index;
+		float ambient[3];
+		float diffuse[3];
+		float specular[3];
+		float reflectionStrength[3];
+		float specularCoefficient;
+		// Sphere: centre and radius. Plane: point and normal.
+		float geometry[6];
+		// Instances: object to world, column by column
+		float transform[16];
+		uint32_t overridesMaterial;
+	};
+
+	// A prototype's shape and its own BVH
+	struct PrototypeRecord {
+		ShapeRecord shape;
+		uint64_t nodeCount;
+		uint64_t nodesOffset;
+		uint64_t primitiveCount;
+		uint64_t primitivesOffset;
+	};
+
+	struct MeshRecord {
+		uint64_t triangleCount;
+		uint64_t columns[TriangleMesh::COLUMN_COUNT];
+		uint64_t cornerNormals;
+		uint64_t cornerUVs;
+	};
+
+	void copy(float* to, vec3 v) {
+		to[0] = v.x; to[1] = v.y; to[2] = v.z;
+	}
+
+	vec3 toVec3(const float* v) {
+		return vec3(v[0], v[1], v[2]);
+	}
+
+	// count elements of type T at offset in the file, checked to be inside
+	// it. nullptr for an empty array.
+	template <class T>
+	T const* arrayAt(MappedFile const &file, std::string const &path, uint64_t offset, uint64_t count) {
+		if (count == 0) {
+			return nullptr;
+		}
+		if (offset % ALIGNMENT != 0 || offset > file.size() || count > (file.size() - offset)/sizeof(T)) {
+			throw std::runtime_error(path + ": the file is damaged");
+		}
+		return reinterpret_cast<T const*>(file.data() + offset);
+	}
+
+	class CacheWriter {
+	public:
+		explicit CacheWriter(std::string const &path) : path(path), out(path, std::ios::binary) {
+			if (!out) {
+				throw std::runtime_error("Can't write " + path);
+			}
+		}
+
+		// Writes the bytes at the next aligned position and returns where
+		uint64_t write(const void* data, std::size_t size) {
+			static const char zeros[ALIGNMENT] = {};
+			out.write(zeros, (ALIGNMENT - position % ALIGNMENT) % ALIGNMENT);
+			position += (ALIGNMENT - position % ALIGNMENT) % ALIGNMENT;
+			uint64_t offset = position;
+			out.write(static_cast<const char*>(data), size);
+			position += size;
+			return offset;
+		}
+
+		void rewrite(uint64_t offset, const void* data, std::size_t size) {
+			out.seekp(offset);
+			out.write(static_cast<const char*>(data), size);
+			out.seekp(position);
+		}
+
+		uint64_t size() const { return position; }
+
+		void close() {
+			out.close();
+			if (!out) {
+				throw std::runtime_error("Can't write " + path);
+			}
+		}
+
+	private:
+		std::string path;
+		std::ofstream out;
+		uint64_t position = 0;
+	};
+}
+
+void saveSceneCache(Scene const &scene, std::string const &path) {
+	if (!scene.bvh) {
+		throw std::runtime_error("Can't save a scene without its acceleration structure");
+	}
+
+	// Written next to the destination and then moved over it, so nothing ever
+	// sees half a cache
+	std::string temporaryPath = path + ".tmp";
+	CacheWriter writer(temporaryPath);
+
+	Header header = {};
+	writer.write(&header, sizeof(header));
+
+	// Each mesh and prototype once, however many shapes use it
+	std::vector<ShapeRecord> shapes;
+	std::vector<MeshRecord> meshes;
+	std::vector<PrototypeRecord> prototypes;
+	std::map<TriangleMesh const*, uint32_t> meshIndices;
+	std::map<Prototype const*, uint32_t> prototypeIndices;
+
+	std::function<ShapeRecord(Shape const &)> describe = [&](Shape const &shape) {
+		if (shape.material.isTextured()) {
+			throw std::runtime_error("Can't save shape " + std::to_string(shape.id) + " in a scene cache: it's textured");
+		}
+		ShapeRecord record = {};
+		record.id = shape.id;
+		record.castsShadows = shape.castsShadows;
+		copy(record.ambient, shape.material.ambient);
+		copy(record.diffuse, shape.material.diffuse);
+		copy(record.specular, shape.material.specular);
+		copy(record.reflectionStrength, shape.material.reflectionStrength);
+		record.specularCoefficient = shape.material.specularCoefficient;
+
+		if (Triangles const* triangles = dynamic_cast<Triangles const*>(&shape)) {
+			TriangleMesh const &mesh = *triangles->mesh;
+			record.kind = TrianglesShape;
+			auto found = meshIndices.find(&mesh);
+			if (found != meshIndices.end()) {
+				record.index = found->second;
+				return record;
+			}
+			MeshRecord meshRecord = {};
+			meshRecord.triangleCount = mesh.size();
+			for (int c = 0; c < TriangleMesh::COLUMN_COUNT; c++) {
+				meshRecord.columns[c] = writer.write(mesh.column(TriangleMesh::Column(c)), mesh.size()*sizeof(float));
+			}
+			if (mesh.hasNormals()) {
+				meshRecord.cornerNormals = writer.write(mesh.cornerNormalData(), 3*mesh.size()*sizeof(vec3));
+			}
+			if (mesh.hasUVs()) {
+				meshRecord.cornerUVs = writer.write(mesh.cornerUVData(), 3*mesh.size()*sizeof(vec2));
+			}
+			record.index = uint32_t(meshes.size());
+			meshIndices[&mesh] = record.index;
+			meshes.push_back(meshRecord);
+		}
+		else if (Sphere const* sphere = dynamic_cast<Sphere const*>(&shape)) {
+			record.kind = SphereShape;
+			copy(record.geometry, sphere->centre);
+			record.geometry[3] = sphere->radius;
+		}
+		else if (Plane const* plane = dynamic_cast<Plane const*>(&shape)) {
+			record.kind = PlaneShape;
+			copy(record.geometry, plane->point);
+			copy(record.geometry + 3, plane->normal);
+		}
+		else if (Instance const* instance = dynamic_cast<Instance const*>(&shape)) {
+			record.kind = InstanceShape;
+			std::memcpy(record.transform, &instance->transform()[0][0], sizeof(record.transform));
+			record.overridesMaterial = instance->overridesMaterial;
+			Prototype const &prototype = *instance->prototype();
+			auto found = prototypeIndices.find(&prototype);
+			if (found != prototypeIndices.end()) {
+				record.index = found->second;
+				return record;
+			}
+			PrototypeRecord prototypeRecord = {};
+			prototypeRecord.shape = describe(*prototype.shape);
+			prototypeRecord.nodeCount = prototype.bvh.nodeCount();
+			prototypeRecord.nodesOffset = writer.write(prototype.bvh.nodeData(), prototypeRecord.nodeCount*sizeof(BVH::Node));
+			prototypeRecord.primitiveCount = prototype.bvh.primitiveCount();
+			prototypeRecord.primitivesOffset = writer.write(prototype.bvh.primitiveData(), prototypeRecord.primitiveCount*sizeof(BVH::PrimitiveRef));
+			record.index = uint32_t(prototypes.size());
+			prototypeIndices[&prototype] = record.index;
+			prototypes.push_back(prototypeRecord);
+		}
+		else {
+			throw std::runtime_error("Can't save shape " + std::to_string(shape.id) + " in a scene cache");
+		}
+		return record;
+	};
+	for (std::shared_ptr<Shape> const &shape : scene.shapesInScene) {
+		shapes.push_back(describe(*shape));
+	}
+
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = SCENE_CACHE_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.nodeSize = sizeof(BVH::Node);
+	header.primitiveRefSize = sizeof(BVH::PrimitiveRef);
+	header.lightSize = sizeof(Light);
+	header.cameraSize = sizeof(Camera);
+	header.camera = scene.camera;
+	header.lightCount = scene.lights.size();
+	header.lightsOffset = writer.write(scene.lights.data(), scene.lights.size()*sizeof(Light));
+	header.shapeCount = shapes.size();
+	header.shapesOffset = writer.write(shapes.data(), shapes.size()*sizeof(ShapeRecord));
+	header.meshCount = meshes.size();
+	header.meshesOffset = writer.write(meshes.data(), meshes.size()*sizeof(MeshRecord));
+	header.prototypeCount = prototypes.size();
+	header.prototypesOffset = writer.write(prototypes.data(), prototypes.size()*sizeof(PrototypeRecord));
+	header.nodeCount = scene.bvh->nodeCount();
+	header.nodesOffset = writer.write(scene.bvh->nodeData(), header.nodeCount*sizeof(BVH::Node));
+	header.primitiveCount = scene.bvh->primitiveCount();
+	header.primitivesOffset = writer.write(scene.bvh->primitiveData(), header.primitiveCount*sizeof(BVH::PrimitiveRef));
+	header.fileSize = writer.size();
+	writer.rewrite(0, &header, sizeof(header));
+	writer.close();
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, path, error);
+	if (error) {
+		std::filesystem::remove(temporaryPath, error);
+		throw std::runtime_error("Can't write " + path);
+	}
+}
+
+Scene loadSceneCache(std::string const &path) {
+	// Shared by the meshes and the BVH that point into it, and unmapped once
+	// the last of them is gone
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+	auto error = [&](std::string const &message) {
+		return std::runtime_error(path + ": " + message);
+	};
+
+	Header header;
+	if (file->size() < sizeof(header)) {
+		throw error("not a scene cache");
+	}
+	std::memcpy(&header, file->data(), sizeof(header));
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+		throw error("not a scene cache");
+	}
+	if (header.version != SCENE_CACHE_VERSION || header.byteOrder != BYTE_ORDER_MARK
+		|| header.nodeSize != sizeof(BVH::Node) || header.primitiveRefSize != sizeof(BVH::PrimitiveRef)
+		|| header.lightSize != sizeof(Light) || header.cameraSize != sizeof(Camera)) {
+		throw error("saved by a different version of the program or kind of machine, it has to be made again");
+	}
+	if (header.fileSize != file->size()) {
+		throw error("the file is incomplete");
+	}
+
+	auto checkCount = [&](uint64_t count) {
+		if (count > uint64_t(std::numeric_limits<int>::max())) {
+			throw error("the file is damaged");
+		}
+		return int(count);
+	};
+
+	Scene scene;
+	scene.camera = header.camera;
+	if (scene.camera.type < Camera::Pinhole || scene.camera.type > Camera::ThinLens) {
+		throw error("the file is damaged");
+	}
+
+	Light const* lights = arrayAt<Light>(*file, path, header.lightsOffset, header.lightCount);
+	scene.lights.assign(lights, lights + header.lightCount);
+	for (Light const &light : scene.lights) {
+		if (light.type < Light::Point || light.type > Light::Sphere) {
+			throw error("the file is damaged");
+		}
+	}
+	scene.prepareLights();
+
+	MeshRecord const* meshRecords = arrayAt<MeshRecord>(*file, path, header.meshesOffset, header.meshCount);
+	std::vector<std::shared_ptr<TriangleMesh>> meshes;
+	for (uint64_t m = 0; m < header.meshCount; m++) {
+		MeshRecord const &record = meshRecords[m];
+		int count = checkCount(record.triangleCount);
+		const float* columns[TriangleMesh::COLUMN_COUNT];
+		for (int c = 0; c < TriangleMesh::COLUMN_COUNT; c++) {
+			columns[c] = arrayAt<float>(*file, path, record.columns[c], count);
+		}
+		const vec3* cornerNormals = record.cornerNormals ? arrayAt<vec3>(*file, path, record.cornerNormals, 3*uint64_t(count)) : nullptr;
+		const vec2* cornerUVs = record.cornerUVs ? arrayAt<vec2>(*file, path, record.cornerUVs, 3*uint64_t(count)) : nullptr;
+
+		std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>();
+		mesh->borrow(count, columns, cornerNormals, cornerUVs, file);
+		meshes.push_back(mesh);
+	}
+
+	std::vector<std::shared_ptr<Prototype const>> prototypes;
+	auto makeShape = [&](ShapeRecord const &record) {
+		std::shared_ptr<Shape> shape;
+		if (record.kind == TrianglesShape) {
+			if (record.index >= meshes.size()) {
+				throw error("the file is damaged");
+			}
+			std::shared_ptr<Triangles> triangles = std::make_shared<Triangles>();
+			triangles->id = record.id;
+			triangles->mesh = meshes[record.index];
+			shape = triangles;
+		}
+		else if (record.kind == SphereShape) {
+			shape = std::make_shared<Sphere>(toVec3(record.geometry), record.geometry[3], record.id);
+		}
+		else if (record.kind == PlaneShape) {
+			shape = std::make_shared<Plane>(toVec3(record.geometry), toVec3(record.geometry + 3), record.id);
+		}
+		else if (record.kind == InstanceShape) {
+			if (record.index >= prototypes.size()) {
+				throw error("the file is damaged");
+			}
+			glm::mat4 transform;
+			std::memcpy(&transform[0][0], record.transform, sizeof(record.transform));
+			std::shared_ptr<Instance> instance = std::make_shared<Instance>(prototypes[record.index], transform, record.id);
+			instance->overridesMaterial = record.overridesMaterial != 0;
+			shape = instance;
+		}
+		else {
+			throw error("the file is damaged");
+		}
+		shape->castsShadows = record.castsShadows != 0;
+		shape->material.ambient = toVec3(record.ambient);
+		shape->material.diffuse = toVec3(record.diffuse);
+		shape->material.specular = toVec3(record.specular);
+		shape->material.reflectionStrength = toVec3(record.reflectionStrength);
+		shape->material.specularCoefficient = record.specularCoefficient;
+		return shape;
+	};
+
+	// Prototypes come first, since instances refer to them. They never are
+	// instances themselves.
+	PrototypeRecord const* prototypeRecords = arrayAt<PrototypeRecord>(*file, path, header.prototypesOffset, header.prototypeCount);
+	for (uint64_t p = 0; p < header.prototypeCount; p++) {
+		PrototypeRecord const &record = prototypeRecords[p];
+		if (record.shape.kind == InstanceShape) {
+			throw error("the file is damaged");
+		}
+		std::shared_ptr<Prototype> prototype = std::make_shared<Prototype>();
+		prototype->shape = makeShape(record.shape);
+		if (!prototype->bvh.borrow({ prototype->shape },
+				arrayAt<BVH::Node>(*file, path, record.nodesOffset, record.nodeCount), checkCount(record.nodeCount),
+				arrayAt<BVH::PrimitiveRef>(*file, path, record.primitivesOffset, record.primitiveCount), checkCount(record.primitiveCount),
+				file)) {
+			throw error("the file is damaged");
+		}
+		prototypes.push_back(prototype);
+	}
+
+	ShapeRecord const* shapeRecords = arrayAt<ShapeRecord>(*file, path, header.shapesOffset, header.shapeCount);
+	for (uint64_t s = 0; s < header.shapeCount; s++) {
+		scene.shapesInScene.push_back(makeShape(shapeRecords[s]));
+	}
+
+	scene.bvh = std::make_shared<BVH>();
+	if (!scene.bvh->borrow(scene.shapesInScene,
+			arrayAt<BVH::Node>(*file, path, header.nodesOffset, header.nodeCount), checkCount(header.nodeCount),
+			arrayAt<BVH::PrimitiveRef>(*file, path, header.primitivesOffset, header.primitiveCount), checkCount(header.primitiveCount),
+			file)) {
+		throw error("the file is damaged");
+	}
+	Log::debug("Mapped scene cache {}: {} shapes, {} meshes, {} BVH nodes",
+		path, header.shapeCount, header.meshCount, header.nodeCount);
+	return scene;
+}
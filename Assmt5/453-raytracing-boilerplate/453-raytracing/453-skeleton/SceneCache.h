@@ -0,0 +1,34 @@
+//------------------------------------------------------------------------------
+// Scenes saved in a binary file, ready to trace as soon as they're loaded.
+//
+// Loading a big scene from its description means parsing every mesh and
+// building the BVH, which takes a while. A scene cache holds the result: the
+// shapes, the triangle arrays of every mesh and the BVHs, laid out just like
+// in memory. Loading one maps the file into memory and points the meshes and
+// the BVH at it, so nothing is parsed, copied or built, and only the parts of
+// the file the rays actually reach are ever read from disk.
+//
+// The file layout is specific to this program and the machine it was saved
+// on (byte order, structure layout), and carries a version number so a cache
+// from a different build is rejected rather than misread. Caches are meant
+// to be made with --write-cache from a scene file, not edited, so beyond
+// checking that everything it points to is inside the file its contents are
+// trusted.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+
+#include "Scene.h"
+
+// Bumped whenever the layout changes
+const unsigned SCENE_CACHE_VERSION = 6;
+
+// Saves the scene, which must have its acceleration structure built. Only
+// triangle meshes, spheres, planes and instances of them, without textures,
+// can be saved. Throws std::runtime_error if it can't be written.
+void saveSceneCache(Scene const &scene, std::string const &path);
+
+// Throws std::runtime_error if the file can't be read, isn't a scene cache,
+// or was saved by a different version or kind of machine
+Scene loadSceneCache(std::string const &path);
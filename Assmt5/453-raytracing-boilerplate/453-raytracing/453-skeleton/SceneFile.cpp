@@ -0,0 +1,570 @@
+#include "SceneFile.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <charconv>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Instance.h"
+#include "MappedFile.h"
+#include "SurfaceTexture.h"
+
+namespace {
+	struct Token {
+		enum Type { Word, Number, String, Open, Close, End };
+		Type type;
+		// Points into the mapped file. Strings are without their quotes.
+		std::string_view text;
+		int line;
+	};
+
+	class SceneParser {
+	public:
+		SceneParser(std::string const &path, MeshCache &meshes)
+			: path(path)
+			, file(path)
+			, position(file.data())
+			, end(file.data() + file.size())
+			, meshes(meshes)
+		{
+			current = scan();
+		}
+
+		Scene parse() {
+			Scene scene;
+			int nextID = 1;
+
+			while (current.type != Token::End) {
+				Token keyword = expect(Token::Word, "an object");
+				if (keyword.text == "camera") {
+					scene.camera = parseCamera(keyword);
+				}
+				else if (keyword.text == "light") {
+					scene.lights.push_back(parseLight(keyword));
+				}
+				else if (keyword.text == "material") {
+					Token name = expect(Token::Word, "a material name");
+					materials[std::string(name.text)] = materialBlock();
+				}
+				else if (keyword.text == "prototype") {
+					Token name = expect(Token::Word, "a prototype name");
+					Token kind = expect(Token::Word, "a shape");
+					std::shared_ptr<Shape> shape = parseShape(kind, 0);
+					if (!shape || !shape->isBounded()) {
+						fail(kind, "expected a sphere, triangles or mesh");
+					}
+					prototypes[std::string(name.text)] = std::make_shared<Prototype>(shape);
+				}
+				else if (keyword.text == "instance") {
+					scene.shapesInScene.push_back(parseInstance(keyword, nextID++));
+				}
+				else if (std::shared_ptr<Shape> shape = parseShape(keyword, nextID)) {
+					nextID++;
+					scene.shapesInScene.push_back(shape);
+				}
+				else {
+					fail(keyword, "unknown object '" + std::string(keyword.text) + "'");
+				}
+			}
+
+			if (scene.lights.empty()) {
+				fail(current, "the scene has no light");
+			}
+			scene.prepareLights();
+			scene.buildAccelerationStructure();
+			return scene;
+		}
+
+		// The shape described by the block after keyword, or nullptr if
+		// keyword isn't a shape
+		std::shared_ptr<Shape> parseShape(Token const &keyword, int id) {
+			if (keyword.text == "sphere") {
+				std::shared_ptr<Sphere> sphere = std::make_shared<Sphere>(vec3(0), 1.f, id);
+				shapeProperties(*sphere, [&](std::string_view key) {
+					if (key == "centre" || key == "center") sphere->centre = vector();
+					else if (key == "radius") sphere->radius = number();
+					else return false;
+					return true;
+				});
+				if (sphere->radius <= 0) {
+					fail(keyword, "sphere radius must be positive");
+				}
+				return sphere;
+			}
+			if (keyword.text == "plane") {
+				std::shared_ptr<Plane> plane = std::make_shared<Plane>(vec3(0), vec3(0, 1, 0), id);
+				shapeProperties(*plane, [&](std::string_view key) {
+					if (key == "point") plane->point = vector();
+					else if (key == "normal") plane->normal = vector();
+					else return false;
+					return true;
+				});
+				if (glm::length(plane->normal) == 0) {
+					fail(keyword, "plane normal can't be 0");
+				}
+				return plane;
+			}
+			if (keyword.text == "triangles") {
+				std::shared_ptr<Triangles> triangles = std::make_shared<Triangles>();
+				triangles->id = id;
+				shapeProperties(*triangles, [&](std::string_view key) {
+					if (key != "vertices") return false;
+					std::vector<vec3> vertices;
+					Token open = expect(Token::Open, "{");
+					while (current.type == Token::Number) {
+						vertices.push_back(vector3());
+					}
+					expect(Token::Close, "}");
+					if (vertices.size() % 3 != 0) {
+						fail(open, "vertices must come in threes, one triangle each");
+					}
+					triangles->initTriangles(int(vertices.size() / 3), vertices.data(), id);
+					return true;
+				});
+				return triangles;
+			}
+			if (keyword.text == "mesh") {
+				std::shared_ptr<Triangles> mesh = std::make_shared<Triangles>();
+				mesh->id = id;
+				bool haveFile = false;
+				shapeProperties(*mesh, [&](std::string_view key) {
+					if (key != "file") return false;
+					Token name = expect(Token::String, "a quoted file name");
+					std::filesystem::path file(name.text);
+					if (file.is_relative()) {
+						file = std::filesystem::path(path).parent_path() / file;
+					}
+					try {
+						mesh->mesh = meshes.get(file.string());
+					}
+					catch (std::runtime_error const &e) {
+						fail(name, e.what());
+					}
+					haveFile = true;
+					return true;
+				});
+				if (!haveFile) {
+					fail(keyword, "mesh without a file");
+				}
+				return mesh;
+			}
+			return nullptr;
+		}
+
+		// A camera of the kind named after keyword, a pinhole camera if
+		// there's no name
+		Camera parseCamera(Token const &keyword) {
+			Camera camera;
+			if (current.type == Token::Word) {
+				Token kind = current;
+				current = scan();
+				if (kind.text == "pinhole") camera.type = Camera::Pinhole;
+				else if (kind.text == "orthographic") camera.type = Camera::Orthographic;
+				else if (kind.text == "thinlens") camera.type = Camera::ThinLens;
+				else fail(kind, "unknown camera '" + std::string(kind.text) + "'");
+			}
+			Camera::Type type = camera.type;
+			bool looksAt = false;
+			glm::vec3 target;
+
+			properties([&](std::string_view key) {
+				if (key == "position") camera.position = vector3();
+				else if (key == "direction") camera.direction = vector3();
+				else if (key == "lookat") { target = vector3(); looksAt = true; }
+				else if (key == "up") camera.up = vector3();
+				else if (key == "fov" && type != Camera::Orthographic) camera.fieldOfView = number();
+				else if (key == "height" && type == Camera::Orthographic) camera.height = number();
+				else if (key == "aperture" && type == Camera::ThinLens) camera.aperture = number();
+				else if (key == "focus" && type == Camera::ThinLens) camera.focusDistance = number();
+				else return false;
+				return true;
+			});
+
+			if (looksAt) {
+				camera.direction = target - camera.position;
+			}
+			if (glm::length(camera.direction) == 0) {
+				fail(keyword, "camera direction can't be 0");
+			}
+			if (glm::length(glm::cross(camera.direction, camera.up)) == 0) {
+				fail(keyword, "camera up can't be along its direction");
+			}
+			if (camera.fieldOfView <= 0 || camera.fieldOfView >= 180) {
+				fail(keyword, "camera fov must be between 0 and 180 degrees");
+			}
+			if (camera.height <= 0 || camera.aperture < 0 || camera.focusDistance <= 0) {
+				fail(keyword, "camera height and focus must be positive, and aperture can't be negative");
+			}
+			return camera;
+		}
+
+		// A light of the kind named after keyword, a point light if there's
+		// no name
+		Light parseLight(Token const &keyword) {
+			Light light;
+			if (current.type == Token::Word) {
+				Token kind = current;
+				current = scan();
+				if (kind.text == "point") light.type = Light::Point;
+				else if (kind.text == "directional") light.type = Light::Directional;
+				else if (kind.text == "spot") light.type = Light::Spot;
+				else if (kind.text == "rectangle") light.type = Light::Rectangle;
+				else if (kind.text == "sphere") light.type = Light::Sphere;
+				else fail(kind, "unknown light '" + std::string(kind.text) + "'");
+			}
+			Light::Type type = light.type;
+			float angle = 45;
+			float inner = -1;
+
+			properties([&](std::string_view key) {
+				if (key == "colour" || key == "color") light.colour = vector();
+				else if (key == "ambient") light.ambient = number();
+				else if (key == "position" && (type == Light::Point || type == Light::Spot)) light.position = vector3();
+				else if (key == "direction" && (type == Light::Directional || type == Light::Spot)) light.direction = vector3();
+				else if (key == "angle" && type == Light::Spot) angle = number();
+				else if (key == "inner" && type == Light::Spot) inner = number();
+				else if (key == "corner" && type == Light::Rectangle) light.position = vector3();
+				else if (key == "edge1" && type == Light::Rectangle) light.edge1 = vector3();
+				else if (key == "edge2" && type == Light::Rectangle) light.edge2 = vector3();
+				else if ((key == "centre" || key == "center") && type == Light::Sphere) light.position = vector3();
+				else if (key == "radius" && type == Light::Sphere) light.radius = number();
+				else return false;
+				return true;
+			});
+
+			if (type == Light::Directional || type == Light::Spot) {
+				if (glm::length(light.direction) == 0) {
+					fail(keyword, "light direction can't be 0");
+				}
+				light.direction = glm::normalize(light.direction);
+			}
+			if (type == Light::Rectangle && glm::length(glm::cross(light.edge1, light.edge2)) == 0) {
+				fail(keyword, "rectangle light edges must be nonzero and not parallel");
+			}
+			if (type == Light::Sphere && light.radius <= 0) {
+				fail(keyword, "sphere light radius must be positive");
+			}
+			if (type == Light::Spot) {
+				// Angles are in degrees from the direction. Without an inner
+				// angle the light fades over the outer quarter of the cone.
+				if (angle <= 0 || angle > 180) {
+					fail(keyword, "spot light angle must be between 0 and 180 degrees");
+				}
+				inner = inner < 0 ? 0.75f*angle : std::min(inner, angle);
+				light.cosOuter = std::cos(glm::radians(angle));
+				light.cosInner = std::cos(glm::radians(inner));
+			}
+			return light;
+		}
+
+		// A texture of the kind named after keyword, an image if there's no
+		// name
+		std::shared_ptr<SurfaceTexture const> parseTexture(Token const &keyword) {
+			bool isNoise = false;
+			if (current.type == Token::Word) {
+				Token kind = current;
+				current = scan();
+				if (kind.text == "noise") isNoise = true;
+				else if (kind.text != "image") fail(kind, "unknown texture '" + std::string(kind.text) + "'");
+			}
+
+			if (isNoise) {
+				std::shared_ptr<NoiseTexture> noise = std::make_shared<NoiseTexture>();
+				properties([&](std::string_view key) {
+					if (key == "pattern") {
+						Token pattern = expect(Token::Word, "fractal, turbulence or marble");
+						if (pattern.text == "fractal") noise->pattern = NoiseTexture::Fractal;
+						else if (pattern.text == "turbulence") noise->pattern = NoiseTexture::Turbulence;
+						else if (pattern.text == "marble") noise->pattern = NoiseTexture::Marble;
+						else fail(pattern, "unknown noise pattern '" + std::string(pattern.text) + "'");
+					}
+					else if (key == "from") noise->from = vector();
+					else if (key == "to") noise->to = vector();
+					else if (key == "scale") noise->scale = number();
+					else if (key == "octaves") noise->octaves = int(number());
+					else return false;
+					return true;
+				});
+				if (noise->scale <= 0 || noise->octaves < 1) {
+					fail(keyword, "noise scale and octaves must be positive");
+				}
+				return noise;
+			}
+
+			std::shared_ptr<TextureCache::Entry> file;
+			glm::vec2 scale(1);
+			properties([&](std::string_view key) {
+				if (key == "file") {
+					Token name = expect(Token::String, "a quoted file name");
+					std::filesystem::path texture(name.text);
+					if (texture.is_relative()) {
+						texture = std::filesystem::path(path).parent_path() / texture;
+					}
+					if (!std::filesystem::exists(texture)) {
+						fail(name, "no texture file " + texture.string());
+					}
+					// Only looked up here; the image is loaded when it's
+					// first rendered
+					file = TextureCache::global().open(texture.string());
+				}
+				else if (key == "scale") {
+					// One number for both directions, or two
+					float u = number();
+					scale = glm::vec2(u, current.type == Token::Number ? number() : u);
+				}
+				else return false;
+				return true;
+			});
+			if (!file) {
+				fail(keyword, "image texture without a file");
+			}
+			return std::make_shared<ImageTexture>(file, scale);
+		}
+
+		// The transforms apply in the order they're given
+		std::shared_ptr<Instance> parseInstance(Token const &keyword, int id) {
+			std::shared_ptr<Prototype const> prototype;
+			glm::mat4 transform(1.f);
+			ObjectMaterial material;
+			bool overridesMaterial = false;
+			bool castsShadows = true;
+			bool shadowsGiven = false;
+
+			properties([&](std::string_view key) {
+				if (key == "of") {
+					Token name = expect(Token::Word, "a prototype name");
+					auto found = prototypes.find(std::string(name.text));
+					if (found == prototypes.end()) {
+						fail(name, "unknown prototype '" + std::string(name.text) + "'");
+					}
+					prototype = found->second;
+				}
+				else if (key == "translate") {
+					transform = glm::translate(glm::mat4(1.f), vector3())*transform;
+				}
+				else if (key == "rotate") {
+					// Axis, then degrees counterclockwise around it
+					vec3 axis = vector3();
+					Token angle = current;
+					float degrees = number();
+					if (glm::length(axis) == 0) {
+						fail(angle, "rotation axis can't be 0");
+					}
+					transform = glm::rotate(glm::mat4(1.f), glm::radians(degrees), axis)*transform;
+				}
+				else if (key == "scale") {
+					Token scale = current;
+					vec3 factors = vector();
+					if (factors.x == 0 || factors.y == 0 || factors.z == 0) {
+						fail(scale, "scale can't be 0");
+					}
+					transform = glm::scale(glm::mat4(1.f), factors)*transform;
+				}
+				else if (key == "material") {
+					material = materialReference();
+					overridesMaterial = true;
+				}
+				else if (key == "shadows") {
+					castsShadows = onOff();
+					shadowsGiven = true;
+				}
+				else return false;
+				return true;
+			});
+			if (!prototype) {
+				fail(keyword, "instance without a prototype ('of')");
+			}
+
+			std::shared_ptr<Instance> instance = std::make_shared<Instance>(prototype, transform, id);
+			if (overridesMaterial) {
+				instance->material = material;
+				instance->overridesMaterial = true;
+			}
+			if (shadowsGiven) {
+				instance->castsShadows = castsShadows;
+			}
+			return instance;
+		}
+
+	private:
+		std::string path;
+		MappedFile file;
+		const char* position;
+		const char* end;
+		int line = 1;
+		Token current;
+
+		MeshCache &meshes;
+		std::map<std::string, ObjectMaterial> materials;
+		std::map<std::string, std::shared_ptr<Prototype const>> prototypes;
+
+		[[noreturn]] void fail(Token const &token, std::string const &message) {
+			throw std::runtime_error(path + ":" + std::to_string(token.line) + ": " + message);
+		}
+
+		Token scan() {
+			// Skip white space and comments
+			while (position < end) {
+				if (*position == '\n') {
+					line++;
+					position++;
+				}
+				else if (*position == ' ' || *position == '\t' || *position == '\r') {
+					position++;
+				}
+				else if (*position == '#') {
+					while (position < end && *position != '\n') position++;
+				}
+				else {
+					break;
+				}
+			}
+			if (position == end) {
+				return Token{ Token::End, std::string_view(), line };
+			}
+
+			const char* start = position;
+			if (*position == '{' || *position == '}') {
+				position++;
+				return Token{ *start == '{' ? Token::Open : Token::Close, std::string_view(start, 1), line };
+			}
+			if (*position == '"') {
+				const char* close = position + 1;
+				while (close < end && *close != '"' && *close != '\n') close++;
+				if (close == end || *close != '"') {
+					fail(Token{ Token::String, std::string_view(), line }, "unterminated string");
+				}
+				position = close + 1;
+				return Token{ Token::String, std::string_view(start + 1, close - start - 1), line };
+			}
+			while (position < end && !std::isspace((unsigned char)*position)
+				&& *position != '{' && *position != '}' && *position != '#') {
+				position++;
+			}
+			bool isNumber = std::isdigit((unsigned char)*start) || *start == '-' || *start == '+' || *start == '.';
+			return Token{ isNumber ? Token::Number : Token::Word, std::string_view(start, position - start), line };
+		}
+
+		Token next() {
+			Token token = current;
+			current = scan();
+			return token;
+		}
+
+		Token expect(Token::Type type, const char* what) {
+			if (current.type != type) {
+				fail(current, std::string("expected ") + what
+					+ (current.type == Token::End ? " at the end of the file" : ", found '" + std::string(current.text) + "'"));
+			}
+			return next();
+		}
+
+		float number() {
+			Token token = expect(Token::Number, "a number");
+			// from_chars doesn't take a leading +
+			const char* first = token.text.data() + (token.text[0] == '+');
+			const char* last = token.text.data() + token.text.size();
+			float value;
+			std::from_chars_result result = std::from_chars(first, last, value);
+			if (result.ec != std::errc() || result.ptr != last) {
+				fail(token, "bad number '" + std::string(token.text) + "'");
+			}
+			return value;
+		}
+
+		// Exactly three numbers
+		vec3 vector3() {
+			float x = number();
+			float y = number();
+			return vec3(x, y, number());
+		}
+
+		// Three numbers, or one for all three
+		vec3 vector() {
+			float x = number();
+			if (current.type != Token::Number) {
+				return vec3(x);
+			}
+			float y = number();
+			return vec3(x, y, number());
+		}
+
+		bool onOff() {
+			Token token = expect(Token::Word, "on or off");
+			if (token.text != "on" && token.text != "off") {
+				fail(token, "expected on or off");
+			}
+			return token.text == "on";
+		}
+
+		// Reads a block of properties. property(key) reads the value of the
+		// key and returns true, or returns false if there is no such key.
+		void properties(std::function<bool(std::string_view)> const &property) {
+			expect(Token::Open, "{");
+			while (current.type != Token::Close) {
+				Token key = expect(Token::Word, "a property name or }");
+				if (!property(key.text)) {
+					fail(key, "unknown property '" + std::string(key.text) + "'");
+				}
+			}
+			next();
+		}
+
+		ObjectMaterial materialBlock() {
+			ObjectMaterial material;
+			properties([&](std::string_view key) {
+				if (key == "ambient") material.ambient = vector();
+				else if (key == "diffuse") material.diffuse = vector();
+				else if (key == "specular") material.specular = vector();
+				else if (key == "reflection") material.reflectionStrength = vector();
+				else if (key == "shininess") material.specularCoefficient = number();
+				else if (key == "texture") material.diffuseTexture = parseTexture(current);
+				else return false;
+				return true;
+			});
+			return material;
+		}
+
+		// The name of a material declared earlier, or a block of its own
+		ObjectMaterial materialReference() {
+			if (current.type == Token::Open) {
+				return materialBlock();
+			}
+			Token name = expect(Token::Word, "a material name or block");
+			auto found = materials.find(std::string(name.text));
+			if (found == materials.end()) {
+				fail(name, "unknown material '" + std::string(name.text) + "'");
+			}
+			return found->second;
+		}
+
+		// The properties every shape has, then its own
+		void shapeProperties(Shape &shape, std::function<bool(std::string_view)> const &property) {
+			properties([&](std::string_view key) {
+				if (key == "material") {
+					shape.material = materialReference();
+				}
+				else if (key == "shadows") {
+					shape.castsShadows = onOff();
+				}
+				else {
+					return property(key);
+				}
+				return true;
+			});
+		}
+	};
+}
+
+Scene loadSceneFile(std::string const &path, MeshCache &meshes) {
+	SceneParser parser(path, meshes);
+	return parser.parse();
+}
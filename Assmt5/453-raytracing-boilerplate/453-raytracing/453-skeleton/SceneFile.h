@@ -0,0 +1,72 @@
+//------------------------------------------------------------------------------
+// Scenes described in text files, so they can be changed without rebuilding.
+//
+// A scene file is a list of objects, each a keyword and a block of
+// properties in braces. Line breaks don't matter, and # starts a comment that
+// runs to the end of the line:
+//
+//   camera { position 0 0 0 }      # or, with depth of field:
+//   camera thinlens { position 0 1 2  lookat 0 0 -6  fov 40  aperture 0.05  focus 8 }
+//   light { position 0 2.5 -7.75  colour 1 1 1  ambient 0.1 }
+//   light spot { position 0 3 -6  direction 0 -1 0  angle 30  colour 0.8 }
+//   light rectangle { corner -1 2.9 -8  edge1 2 0 0  edge2 0 0 2 }
+//
+//   material grey { diffuse 0.6  specular 0.6  reflection 0.4  shininess 64 }
+//   material tiles { diffuse 1  texture { file "textures/tiles.png"  scale 4 } }
+//   material stone { diffuse 1  texture noise { pattern marble  scale 2  from 0.9  to 0.3 0.3 0.35 } }
+//
+//   sphere { centre 0.9 -1.925 -6.69  radius 0.825  material grey }
+//   plane { point 0 -1 0  normal 0 1 0  material { diffuse 0.8 0.8 0.8 } }
+//   triangles {
+//       material grey
+//       vertices { -1 0 -5  1 0 -5  0 1 -5 }   # 9 numbers per triangle
+//   }
+//   mesh { file "models/bunny.ply"  material grey  shadows off }
+//
+//   prototype rock mesh { file "models/rock.obj"  material grey }
+//   instance { of rock  scale 0.5  rotate 0 1 0 45  translate 2 0 -6 }
+//   instance { of rock  translate -2 0 -6  material { diffuse 0.5 0.3 0.1 } }
+//
+// A camera is a pinhole camera unless the word after `camera` says
+// otherwise: orthographic or thinlens (see Camera.h). Every camera has a
+// position, and a direction to look in or a point to look at, and an up
+// (0 1 0 by default). Pinhole and thin lens cameras take a vertical fov in
+// degrees, an orthographic camera the height of its view, and a thin lens
+// the radius of its aperture and its focus distance.
+//
+// A light is a point light unless the word after `light` says otherwise:
+// directional { direction }, spot { position direction angle inner } with
+// angles in degrees, rectangle { corner edge1 edge2 } or sphere { centre
+// radius }. Every light has a colour and an ambient factor (see Light.h).
+//
+// Colours (and other vectors) are three numbers, or one for a grey. A
+// material is either the name of one declared earlier or a block of its own.
+// Every shape can say `shadows off` to not cast shadows. A prototype is a
+// sphere, triangles or mesh that isn't in the scene itself but is placed in
+// it by instances (see Instance.h), each transformed by the translations,
+// rotations (axis, then degrees) and scalings listed, in that order. An
+// instance has the prototype's material unless it gives its own.
+//
+// A material's texture multiplies its diffuse and ambient colours (see
+// SurfaceTexture.h). It's an image unless the word after `texture` is
+// noise. An image has a file and can repeat scale times (one number, or one
+// for each direction) over its texture coordinates. Noise has a pattern
+// (fractal, turbulence or marble), the colours it goes from and to, a scale
+// (features per scene unit) and a number of octaves.
+//
+// Mesh and texture files are found relative to the scene file. Meshes are
+// loaded through a MeshCache so reloading the scene doesn't parse them
+// again, and textures through the TextureCache when they're first rendered.
+//
+// The file is memory mapped and tokenized in place, without copying it.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <string>
+
+#include "MeshLoader.h"
+#include "Scene.h"
+
+// Loads the scene in the file and builds its acceleration structure. Throws
+// std::runtime_error, saying where in the file, if it can't be loaded.
+Scene loadSceneFile(std::string const &path, MeshCache &meshes);
@@ -0,0 +1,196 @@
+#include "SurfaceTexture.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Random.h"
+
+namespace {
+	// Ken Perlin's improved noise ("Improving Noise", 2002), with the
+	// permutation shuffled from a fixed seed rather than written out
+	class PerlinNoise {
+	public:
+		PerlinNoise() {
+			for (int i = 0; i < 256; i++) {
+				permutation[i] = i;
+			}
+			PCG32 random(0x5eed);
+			for (int i = 255; i > 0; i--) {
+				std::swap(permutation[i], permutation[random.next()%(i + 1)]);
+			}
+			for (int i = 0; i < 256; i++) {
+				permutation[256 + i] = permutation[i];
+			}
+
+			// The noise repeats every 256 units, so random points in one
+			// period give its average size
+			const int SAMPLES = 1 << 15;
+			double magnitude = 0;
+			for (int i = 0; i < SAMPLES; i++) {
+				glm::vec3 p(random.nextFloat(), random.nextFloat(), random.nextFloat());
+				magnitude += std::abs((*this)(256.f*p));
+			}
+			meanMagnitude = float(magnitude/SAMPLES);
+		}
+
+		// The average of |noise| over all points. The noise itself averages 0.
+		float meanMagnitude;
+
+		// From about -1 to 1, and 0 at every integer point
+		float operator()(glm::vec3 p) const {
+			glm::vec3 cell = glm::floor(p);
+			glm::vec3 f = p - cell;
+			int x = int(cell.x) & 255;
+			int y = int(cell.y) & 255;
+			int z = int(cell.z) & 255;
+			glm::vec3 s = f*f*f*(f*(f*6.f - 15.f) + 10.f);
+
+			int a = permutation[x] + y;
+			int aa = permutation[a] + z;
+			int ab = permutation[a + 1] + z;
+			int b = permutation[x + 1] + y;
+			int ba = permutation[b] + z;
+			int bb = permutation[b + 1] + z;
+
+			return glm::mix(
+				glm::mix(
+					glm::mix(gradient(permutation[aa], f), gradient(permutation[ba], f - glm::vec3(1, 0, 0)), s.x),
+					glm::mix(gradient(permutation[ab], f - glm::vec3(0, 1, 0)), gradient(permutation[bb], f - glm::vec3(1, 1, 0)), s.x),
+					s.y),
+				glm::mix(
+					glm::mix(gradient(permutation[aa + 1], f - glm::vec3(0, 0, 1)), gradient(permutation[ba + 1], f - glm::vec3(1, 0, 1)), s.x),
+					glm::mix(gradient(permutation[ab + 1], f - glm::vec3(0, 1, 1)), gradient(permutation[bb + 1], f - glm::vec3(1, 1, 1)), s.x),
+					s.y),
+				s.z);
+		}
+
+	private:
+		// The dot product of the offset with one of twelve edge directions
+		static float gradient(int hash, glm::vec3 p) {
+			int h = hash & 15;
+			float u = h < 8 ? p.x : p.y;
+			float v = h < 4 ? p.y : (h == 12 || h == 14 ? p.x : p.z);
+			return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+		}
+
+		int permutation[512];
+	};
+
+	PerlinNoise const &perlin() {
+		static const PerlinNoise noise;
+		return noise;
+	}
+}
+
+ImageTexture::ImageTexture(std::shared_ptr<TextureCache::Entry> file, glm::vec2 scale)
+	: file(file)
+	, scale(scale)
+{}
+
+glm::vec3 ImageTexture::evaluate(TextureLookup const &lookup) const {
+	std::shared_ptr<MipMap const> mipmap = TextureCache::global().lookup(*file);
+	if (!mipmap) {
+		return glm::vec3(1);
+	}
+	// Isotropic: the longer side of the footprint decides the level, so
+	// surfaces seen edge on blur along their shorter side too
+	float width = std::max(glm::length(scale*lookup.duvdx), glm::length(scale*lookup.duvdy));
+	return mipmap->trilinear(scale*lookup.uv, width);
+}
+
+glm::vec3 NoiseTexture::evaluate(TextureLookup const &lookup) const {
+	PerlinNoise const &noise = perlin();
+	glm::vec3 p = scale*lookup.point;
+	// The footprint in the noise's units. An octave fades out as its
+	// features shrink from a half to a quarter of that, which is where
+	// they'd start to alias, rather than dropping out all at once. What
+	// fades out is replaced by the octave's average over the footprint, so
+	// distant surfaces settle to the pattern's mean colour: 0 for fractal
+	// noise, the mean of |noise| for the others.
+	float footprint = scale*std::max(glm::length(lookup.dpdx), glm::length(lookup.dpdy));
+	float mean = pattern == Fractal ? 0.f : noise.meanMagnitude;
+
+	float sum = 0;
+	float total = 0;
+	float frequency = 1;
+	float amplitude = 1;
+	for (int i = 0; i < octaves; i++) {
+		float fade = glm::clamp(2.f - 4.f*frequency*footprint, 0.f, 1.f);
+		if (fade > 0) {
+			float n = noise(frequency*p);
+			sum += fade*amplitude*(pattern == Fractal ? n : std::abs(n));
+		}
+		sum += (1.f - fade)*amplitude*mean;
+		total += amplitude;
+		frequency *= 2;
+		amplitude *= 0.5f;
+	}
+	if (total > 0) {
+		sum /= total;
+	}
+
+	float value;
+	switch (pattern) {
+	case Turbulence:
+		value = 2.f*sum;
+		break;
+	case Marble:
+		value = 0.5f + 0.5f*std::sin(p.x + 8.f*sum);
+		break;
+	case Fractal:
+	default:
+		value = 0.5f + 0.5f*sum;
+		break;
+	}
+	return glm::mix(from, to, glm::clamp(value, 0.f, 1.f));
+}
+
+TextureLookup textureLookup(Ray const &ray, RayDifferential const &differential, Intersection const &hit) {
+	TextureLookup lookup;
+	lookup.point = hit.point;
+	lookup.uv = hit.uv;
+	if (!hit.hit.shape) {
+		return lookup;
+	}
+	SurfaceCoordinates coordinates = hit.hit.shape->surfaceCoordinates(ray, hit.hit);
+	lookup.uv = coordinates.uv;
+	hitDifferential(ray, differential, hit.t, hit.normal, lookup.dpdx, lookup.dpdy);
+
+	// The footprint's sides in texture coordinates: dp = dpdu*du + dpdv*dv,
+	// solved by least squares since dp needn't be quite in the plane of
+	// dpdu and dpdv
+	glm::vec3 dpdu = coordinates.dpdu;
+	glm::vec3 dpdv = coordinates.dpdv;
+	float uu = glm::dot(dpdu, dpdu);
+	float uv = glm::dot(dpdu, dpdv);
+	float vv = glm::dot(dpdv, dpdv);
+	float determinant = uu*vv - uv*uv;
+	if (!(std::abs(determinant) > 1e-20f)) {
+		return lookup;
+	}
+	auto solve = [&](glm::vec3 dp) {
+		float pu = glm::dot(dpdu, dp);
+		float pv = glm::dot(dpdv, dp);
+		return glm::vec2(vv*pu - uv*pv, uu*pv - uv*pu)/determinant;
+	};
+	lookup.duvdx = solve(lookup.dpdx);
+	lookup.duvdy = solve(lookup.dpdy);
+	return lookup;
+}
+
+ObjectMaterial const &materialAt(Ray const &ray, RayDifferential const &differential, Intersection const &hit,
+		ObjectMaterial &storage) {
+	ObjectMaterial const &material = *hit.material;
+	if (!material.isTextured()) {
+		return material;
+	}
+	glm::vec3 colour = material.diffuseTexture->evaluate(textureLookup(ray, differential, hit));
+	// Field by field, leaving the texture behind, so threads shading the
+	// same material don't all count references to it
+	storage.ambient = material.ambient*colour;
+	storage.diffuse = material.diffuse*colour;
+	storage.specular = material.specular;
+	storage.reflectionStrength = material.reflectionStrength;
+	storage.specularCoefficient = material.specularCoefficient;
+	return storage;
+}
@@ -0,0 +1,86 @@
+//------------------------------------------------------------------------------
+// Textures that vary a material's colour over a surface.
+//
+//   image  an image file, mapped onto the surface by its texture coordinates
+//          (see Shape::surfaceCoordinates()), repeating outside [0, 1]
+//   noise  Perlin noise in space, i.e. a solid texture that needs no texture
+//          coordinates, in one of three patterns: fractal (octaves of noise
+//          added up, like clouds), turbulence (the same with every octave's
+//          absolute value, for sharper creases) and marble (stripes bent by
+//          turbulence)
+//
+// A lookup is given the area of the surface the pixel covers, from the ray's
+// differential, and averages the texture over it: image textures with
+// trilinear filtering of their mip levels, noise by putting the average of
+// the octaves finer than it in their place. Otherwise a texture far away or seen edge on would be
+// sampled at a few scattered texels per pixel and shimmer.
+//
+// Image texels come from the TextureCache, so textures are shared and the
+// memory they take is bounded however many a scene uses.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <memory>
+
+#include <glm/glm.hpp>
+
+#include "Material.h"
+#include "RayDifferential.h"
+#include "RayTrace.h"
+#include "TextureCache.h"
+
+// Where a texture is looked up, and how that changes from one pixel to the
+// next across (x) and up (y) the image
+struct TextureLookup {
+	glm::vec2 uv = glm::vec2(0);
+	glm::vec2 duvdx = glm::vec2(0);
+	glm::vec2 duvdy = glm::vec2(0);
+	glm::vec3 point = glm::vec3(0);
+	glm::vec3 dpdx = glm::vec3(0);
+	glm::vec3 dpdy = glm::vec3(0);
+};
+
+class SurfaceTexture {
+public:
+	virtual ~SurfaceTexture() = default;
+	// The colour, averaged over the lookup's footprint
+	virtual glm::vec3 evaluate(TextureLookup const &lookup) const = 0;
+};
+
+class ImageTexture : public SurfaceTexture {
+public:
+	// The image repeats scale times over each unit of texture coordinates.
+	// A file that can't be loaded is white, leaving the material's colours
+	// as they are.
+	ImageTexture(std::shared_ptr<TextureCache::Entry> file, glm::vec2 scale = glm::vec2(1));
+
+	glm::vec3 evaluate(TextureLookup const &lookup) const;
+
+private:
+	std::shared_ptr<TextureCache::Entry> file;
+	glm::vec2 scale;
+};
+
+class NoiseTexture : public SurfaceTexture {
+public:
+	enum Pattern { Fractal, Turbulence, Marble };
+
+	Pattern pattern = Fractal;
+	// The colours at the lowest and highest values of the pattern
+	glm::vec3 from = glm::vec3(0);
+	glm::vec3 to = glm::vec3(1);
+	// Features of the coarsest octave per scene unit, and how many octaves
+	// there are, each twice as fine and half as strong as the one before
+	float scale = 1;
+	int octaves = 6;
+
+	glm::vec3 evaluate(TextureLookup const &lookup) const;
+};
+
+// The lookup for a hit of the ray, which has the given differential
+TextureLookup textureLookup(Ray const &ray, RayDifferential const &differential, Intersection const &hit);
+
+// The material at the hit: the shape's own if it isn't textured, otherwise
+// that material with its textures looked up, put in storage
+ObjectMaterial const &materialAt(Ray const &ray, RayDifferential const &differential, Intersection const &hit,
+	ObjectMaterial &storage);
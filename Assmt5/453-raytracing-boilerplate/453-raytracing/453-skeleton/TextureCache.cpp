@@ -0,0 +1,194 @@
+#include "TextureCache.h"
+
+#include <algorithm>
+
+#include <stb/stb_image.h>
+
+#include "Log.h"
+
+namespace {
+	// The last few textures the thread looked up. Small enough to search
+	// straight through, and replaced round robin. Weak, so a texture the
+	// cache drops goes as soon as the lookups reading it are done.
+	struct ThreadTextures {
+		static const int SIZE = 16;
+		uint64_t serials[SIZE] = {};
+		std::weak_ptr<MipMap const> mipmaps[SIZE];
+		int next = 0;
+	};
+
+	ThreadTextures &threadTextures() {
+		thread_local ThreadTextures textures;
+		return textures;
+	}
+
+	std::shared_ptr<MipMap const> loadMipMap(std::string const &path) {
+		// Top row first: the GL textures may have turned flipping on for
+		// every thread
+		stbi_set_flip_vertically_on_load_thread(0);
+		int width, height, components;
+		unsigned char* data = stbi_load(path.c_str(), &width, &height, &components, 4);
+		if (!data) {
+			Log::error("Can't load texture {}: {}", path, stbi_failure_reason());
+			return nullptr;
+		}
+		std::shared_ptr<MipMap const> mipmap = std::make_shared<MipMap>(width, height, data);
+		stbi_image_free(data);
+		return mipmap;
+	}
+}
+
+TextureCache &TextureCache::global() {
+	static TextureCache cache;
+	return cache;
+}
+
+std::shared_ptr<TextureCache::Entry> TextureCache::open(std::string const &path) {
+	FileVersion file = fileVersion(path);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::shared_ptr<Entry> &entry = entries[file.key];
+	if (entry && file.unchanged(entry->file)) {
+		return entry;
+	}
+	if (entry) {
+		// Materials may still use the old file's texture until they're
+		// replaced, so it stays counted until prune()
+		retired.push_back(entry);
+	}
+	entry = std::make_shared<Entry>();
+	entry->file = file;
+	entry->serial = nextSerial++;
+	return entry;
+}
+
+std::shared_ptr<MipMap const> TextureCache::lookup(Entry &entry) {
+	ThreadTextures &textures = threadTextures();
+	int slot = -1;
+	for (int i = 0; i < ThreadTextures::SIZE; i++) {
+		if (textures.serials[i] == entry.serial) {
+			if (std::shared_ptr<MipMap const> mipmap = textures.mipmaps[i].lock()) {
+				// Still counts as a use for eviction. Only written when it
+				// changes, so threads sharing a texture don't all write it.
+				uint64_t now = clock.load(std::memory_order_relaxed);
+				if (entry.lastUse.load(std::memory_order_relaxed) != now) {
+					entry.lastUse.store(now, std::memory_order_relaxed);
+				}
+				return mipmap;
+			}
+			// Dropped by the cache since: load it again into the same slot
+			slot = i;
+			break;
+		}
+	}
+	std::shared_ptr<MipMap const> mipmap = acquire(entry);
+	if (!mipmap) {
+		return nullptr;
+	}
+	if (slot < 0) {
+		slot = textures.next;
+		textures.next = (slot + 1)%ThreadTextures::SIZE;
+	}
+	textures.serials[slot] = entry.serial;
+	textures.mipmaps[slot] = mipmap;
+	return mipmap;
+}
+
+std::shared_ptr<MipMap const> TextureCache::acquire(Entry &entry) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (entry.mipmap || entry.failed) {
+			entry.lastUse = ++clock;
+			return entry.mipmap;
+		}
+	}
+
+	// The file is read outside the cache's lock, so other threads' lookups
+	// carry on meanwhile
+	std::lock_guard<std::mutex> loading(entry.loading);
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (entry.mipmap || entry.failed) {
+			// Another thread loaded it while this one waited
+			entry.lastUse = ++clock;
+			return entry.mipmap;
+		}
+	}
+	std::shared_ptr<MipMap const> mipmap = loadMipMap(entry.file.key);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	entry.lastUse = ++clock;
+	if (!mipmap) {
+		entry.failed = true;
+		return nullptr;
+	}
+	Log::debug("Loaded texture {}: {}x{}, {:.1f} MB", entry.file.key, mipmap->width(), mipmap->height(), mipmap->bytes()/1048576.0);
+	entry.mipmap = mipmap;
+	loadedBytes += mipmap->bytes();
+	evict(&entry);
+	return mipmap;
+}
+
+void TextureCache::evict(Entry const* keep) {
+	while (loadedBytes > budgetBytes) {
+		Entry* oldest = nullptr;
+		auto consider = [&](Entry* entry) {
+			if (entry->mipmap && entry != keep && (!oldest || entry->lastUse < oldest->lastUse)) {
+				oldest = entry;
+			}
+		};
+		for (auto const &named : entries) {
+			consider(named.second.get());
+		}
+		for (std::shared_ptr<Entry> const &entry : retired) {
+			consider(entry.get());
+		}
+		if (!oldest) {
+			return;
+		}
+		Log::debug("Dropped texture {} to stay within the texture cache", oldest->file.key);
+		loadedBytes -= oldest->mipmap->bytes();
+		oldest->mipmap.reset();
+	}
+}
+
+void TextureCache::setBudget(std::size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	budgetBytes = bytes;
+	evict(nullptr);
+}
+
+std::size_t TextureCache::budget() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return budgetBytes;
+}
+
+std::size_t TextureCache::bytesLoaded() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return loadedBytes;
+}
+
+void TextureCache::prune() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto i = entries.begin(); i != entries.end();) {
+		if (i->second.use_count() == 1) {
+			if (i->second->mipmap) {
+				loadedBytes -= i->second->mipmap->bytes();
+			}
+			i = entries.erase(i);
+		}
+		else {
+			++i;
+		}
+	}
+	auto unused = std::remove_if(retired.begin(), retired.end(), [&](std::shared_ptr<Entry> const &entry) {
+		if (entry.use_count() > 1) {
+			return false;
+		}
+		if (entry->mipmap) {
+			loadedBytes -= entry->mipmap->bytes();
+		}
+		return true;
+	});
+	retired.erase(unused, retired.end());
+}
@@ -0,0 +1,96 @@
+//------------------------------------------------------------------------------
+// Keeps the image textures of the scene in memory, within a budget.
+//
+// Scenes name texture files through entries from open(), which loads
+// nothing. A file is loaded, and its MipMap built, the first time a render
+// looks it up. When the textures loaded add up to more than the budget, the
+// ones looked up least recently are dropped, to be loaded again if they're
+// needed again, so a scene can use more textures than fit in memory as long
+// as those a render needs at the same time do.
+//
+// Every textured hit of every render thread looks a texture up, so lookups
+// mostly stay away from the cache's lock: each thread remembers the last few
+// textures it used and only goes to the cache for one it doesn't have.
+// The threads' memory of a texture doesn't keep it alive, so one the cache
+// drops is freed once the lookups sampling it at that moment are done, and
+// memory only goes over the budget by those.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "FileVersion.h"
+#include "MipMap.h"
+
+class TextureCache {
+public:
+	// One texture file, looked up by what holds on to it
+	class Entry {
+	public:
+		std::string const &path() const { return file.key; }
+
+	private:
+		friend class TextureCache;
+
+		FileVersion file;
+		// Tells entries apart in the threads' caches, without comparing
+		// addresses that could be reused
+		uint64_t serial = 0;
+
+		// The rest belongs to the cache, under its lock, except that lookups
+		// can bring lastUse up to the clock without it
+		std::shared_ptr<MipMap const> mipmap;
+		std::atomic<uint64_t> lastUse{ 0 };
+		bool failed = false;
+		// Held while the file loads, so two threads needing it don't both
+		// load it
+		std::mutex loading;
+	};
+
+	static const std::size_t DEFAULT_BUDGET = std::size_t(512) << 20;
+
+	static TextureCache &global();
+
+	// The entry for the file, the same one for every call until the file is
+	// modified. Safe to call from several threads at once.
+	std::shared_ptr<Entry> open(std::string const &path);
+
+	// The texture in the entry's file, loaded if it isn't in memory, or
+	// nullptr if the file can't be loaded (which is logged the first time).
+	// Hold on to it only while sampling it: what's held is outside the
+	// budget.
+	std::shared_ptr<MipMap const> lookup(Entry &entry);
+
+	// Changes the most memory the textures should take, dropping textures if
+	// they take more
+	void setBudget(std::size_t bytes);
+	std::size_t budget() const;
+	// Memory taken by the textures in the cache
+	std::size_t bytesLoaded() const;
+
+	// Forgets the entries that no material uses any more
+	void prune();
+
+private:
+	// The texture, from the cache's own table rather than the thread's
+	std::shared_ptr<MipMap const> acquire(Entry &entry);
+	// Drops textures, least recently used first, until they fit the budget.
+	// keep is never dropped. Called with the lock held.
+	void evict(Entry const* keep);
+
+	std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+	// Entries for files modified since, until the materials using them go
+	std::vector<std::shared_ptr<Entry>> retired;
+	std::size_t budgetBytes = DEFAULT_BUDGET;
+	std::size_t loadedBytes = 0;
+	std::atomic<uint64_t> clock{ 0 };
+	uint64_t nextSerial = 1;
+	mutable std::mutex mutex;
+};
@@ -0,0 +1,137 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace {
+	// Which pool (if any) the current thread works for, and its queue index
+	thread_local ThreadPool const* currentPool = nullptr;
+	thread_local int currentIndex = -1;
+}
+
+ThreadPool::ThreadPool(unsigned threadCount) {
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+	for (unsigned i = 0; i < threadCount; i++) {
+		queues.push_back(std::make_unique<WorkQueue>());
+	}
+	for (unsigned i = 0; i < threadCount; i++) {
+		workers.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wakeUp.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::global() {
+	static ThreadPool pool;
+	return pool;
+}
+
+int ThreadPool::currentWorker() const {
+	return currentPool == this ? currentIndex : -1;
+}
+
+void ThreadPool::submit(TaskGroup &group, std::function<void()> task) {
+	group.pending++;
+
+	// Workers push onto their own queue, everyone else spreads tasks around
+	int queue = currentWorker();
+	if (queue < 0) {
+		queue = int(nextQueue++ % queues.size());
+	}
+	{
+		std::lock_guard<std::mutex> lock(queues[queue]->mutex);
+		queues[queue]->tasks.push_back(Task{std::move(task), &group});
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		queuedTasks++;
+	}
+	wakeUp.notify_one();
+}
+
+bool ThreadPool::runOneTask(int self) {
+	Task task;
+	bool found = false;
+
+	// Own queue first, newest task (its data is most likely still in cache)
+	if (self >= 0) {
+		WorkQueue &own = *queues[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	// Otherwise steal the oldest task from someone else
+	int count = int(queues.size());
+	int start = self >= 0 ? self + 1 : int(nextQueue.load() % queues.size());
+	for (int i = 0; i < count && !found; i++) {
+		WorkQueue &victim = *queues[(start + i) % count];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found) {
+		return false;
+	}
+
+	queuedTasks--;
+	task.function();
+	if (--task.group->pending == 0) {
+		// Someone may be sleeping in wait() on this group
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		wakeUp.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+	currentPool = this;
+	currentIndex = int(index);
+
+	while (true) {
+		if (runOneTask(int(index))) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.wait(lock, [&]() { return stopping || queuedTasks > 0; });
+		if (stopping && queuedTasks == 0) {
+			return;
+		}
+	}
+}
+
+void ThreadPool::wait(TaskGroup &group) {
+	int self = currentWorker();
+	while (!group.isDone()) {
+		if (runOneTask(self)) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wakeUp.wait(lock, [&]() { return group.isDone() || queuedTasks > 0; });
+	}
+}
+
+void ThreadPool::parallelFor(int count, std::function<void(int)> const &task) {
+	TaskGroup group;
+	for (int i = 0; i < count; i++) {
+		submit(group, [&task, i]() { task(i); });
+	}
+	wait(group);
+}
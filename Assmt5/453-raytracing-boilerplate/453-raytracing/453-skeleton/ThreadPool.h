@@ -0,0 +1,91 @@
+//------------------------------------------------------------------------------
+// A small work-stealing thread pool.
+//
+// Every worker owns a queue. Workers take their own newest task first and,
+// when their queue runs dry, steal the oldest task from another worker. This
+// keeps every core busy even when tasks (like image tiles) take very
+// different amounts of time.
+//
+// Tasks are grouped in a TaskGroup so that a caller can wait for exactly the
+// tasks it submitted. A thread that waits on a group runs queued tasks while
+// it waits instead of blocking, so waiting from inside a task is fine.
+//
+// Example:
+//	TaskGroup group;
+//	for (int i = 0; i < 10; i++) pool.submit(group, [i]() { work(i); });
+//	pool.wait(group);
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool;
+
+class TaskGroup {
+public:
+	TaskGroup() = default;
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup operator=(const TaskGroup&) = delete;
+
+	// True once every task submitted to the group has finished
+	bool isDone() const { return pending.load() == 0; }
+
+private:
+	friend class ThreadPool;
+	std::atomic<int> pending{0};
+};
+
+class ThreadPool {
+public:
+	// 0 threads means one per hardware thread
+	explicit ThreadPool(unsigned threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool operator=(const ThreadPool&) = delete;
+
+	unsigned size() const { return unsigned(workers.size()); }
+
+	void submit(TaskGroup &group, std::function<void()> task);
+
+	// Blocks until every task in the group has run, helping out meanwhile
+	void wait(TaskGroup &group);
+
+	// Runs task(i) for every i in [0, count) and waits for all of them
+	void parallelFor(int count, std::function<void(int)> const &task);
+
+	// Pool shared by the whole program, sized to the hardware concurrency
+	static ThreadPool& global();
+
+private:
+	struct Task {
+		std::function<void()> function;
+		TaskGroup* group;
+	};
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	void workerLoop(unsigned index);
+	bool runOneTask(int self);
+	int currentWorker() const;
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+
+	// Sleeping workers and waiters wait on this for new tasks / finished groups
+	std::mutex sleepMutex;
+	std::condition_variable wakeUp;
+	std::atomic<int> queuedTasks{0};
+	std::atomic<unsigned> nextQueue{0};
+	bool stopping = false;
+};
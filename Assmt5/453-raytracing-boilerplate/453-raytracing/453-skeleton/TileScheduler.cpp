@@ -0,0 +1,21 @@
+#include "TileScheduler.h"
+
+#include <algorithm>
+
+TileScheduler::TileScheduler(int imageWidth, int imageHeight, int tileSize) {
+	for (int y = 0; y < imageHeight; y += tileSize) {
+		for (int x = 0; x < imageWidth; x += tileSize) {
+			tileList.push_back(Tile{
+				x, y,
+				std::min(tileSize, imageWidth - x),
+				std::min(tileSize, imageHeight - y)
+			});
+		}
+	}
+}
+
+void TileScheduler::run(ThreadPool &pool, std::function<void(Tile const &)> const &renderTile) const {
+	pool.parallelFor(int(tileList.size()), [&](int i) {
+		renderTile(tileList[i]);
+	});
+}
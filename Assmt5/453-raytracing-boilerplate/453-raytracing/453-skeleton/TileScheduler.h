@@ -0,0 +1,41 @@
+//------------------------------------------------------------------------------
+// Splits an image into square screen-space tiles and renders them in
+// parallel on a ThreadPool.
+//
+// Tiles are the unit of work handed to the threads: big enough that the
+// scheduling overhead is negligible, small enough that there are many more
+// tiles than threads so the work-stealing can even out slow and fast areas
+// of the image.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "ThreadPool.h"
+
+struct Tile {
+	// Bottom-left pixel and size. Tiles on the right and top edges of the
+	// image may be smaller than the rest.
+	int x;
+	int y;
+	int width;
+	int height;
+};
+
+class TileScheduler {
+public:
+	static const int DEFAULT_TILE_SIZE = 32;
+
+	TileScheduler(int imageWidth, int imageHeight, int tileSize = DEFAULT_TILE_SIZE);
+
+	std::vector<Tile> const &tiles() const { return tileList; }
+
+	// Calls renderTile once for every tile from the pool's threads, and
+	// returns once all tiles are done. renderTile must be safe to call
+	// concurrently for different tiles.
+	void run(ThreadPool &pool, std::function<void(Tile const &)> const &renderTile) const;
+
+private:
+	std::vector<Tile> tileList;
+};
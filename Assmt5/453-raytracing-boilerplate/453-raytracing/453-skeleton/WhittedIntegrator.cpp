@@ -0,0 +1,100 @@
+#include "WhittedIntegrator.h"
+
+#include "SurfaceTexture.h"
+
+namespace {
+	float maxComponent(glm::vec3 v) {
+		return glm::max(glm::max(v.x, v.y), v.z);
+	}
+}
+
+glm::vec3 WhittedIntegrator::shade(Scene const &scene, Ray const &ray, Intersection const &hit, PathContext &path) const {
+	return shadeIntersection(scene, ray, hit, settings.maxDepth, glm::vec3(1), path);
+}
+
+glm::vec3 WhittedIntegrator::shadeWithLight(Scene const &scene, PhongReflection &phong, Light const &light, float weight,
+		int depth, PathContext &path) const {
+	Intersection const &hit = phong.intersection;
+	LightSample sample = sampleLight(light, hit.point, path.sampler);
+	path.statistics.shadowRays[depth]++;
+	glm::vec3 normal = glm::normalize(hit.normal);
+	glm::vec3 origin = offsetFromSurface(hit.point, glm::dot(normal, sample.toLight) < 0 ? -normal : normal);
+	bool shadowed = sample.atInfinity
+		? scene.occludedTowards(origin, sample.toLight, -1)
+		: scene.occluded(origin, sample.position, -1);
+	if (shadowed) {
+		return glm::vec3(0);
+	}
+	phong.toLight = sample.toLight;
+	phong.lightColour = sample.colour;
+	return weight*phong.direct();
+}
+
+glm::vec3 WhittedIntegrator::directLight(Scene const &scene, PhongReflection &phong, int depth, PathContext &path) const {
+	glm::vec3 light(0);
+	int lightCount = int(scene.lights.size());
+	if (lightCount <= settings.lightSamplesPerHit) {
+		for (Light const &l : scene.lights) {
+			light += shadeWithLight(scene, phong, l, 1.f, depth, path);
+		}
+		return light;
+	}
+	for (int s = 0; s < settings.lightSamplesPerHit; s++) {
+		float probability;
+		int picked = scene.lightDistribution.pick(path.sampler, probability);
+		light += shadeWithLight(scene, phong, scene.lights[picked], 1.f/(probability*settings.lightSamplesPerHit), depth, path);
+	}
+	return light;
+}
+
+glm::vec3 WhittedIntegrator::shadeIntersection(Scene const &scene, Ray const &ray, Intersection const &result, int level,
+		glm::vec3 throughput, PathContext &path) const {
+	if(result.numberOfIntersections == 0) return glm::vec3(0, 0, 0); // black;
+
+	ObjectMaterial textured;
+	ObjectMaterial const &material = materialAt(ray, path.differential, result, textured);
+
+	PhongReflection phong;
+	phong.ray = ray;
+	phong.material = &material;
+	phong.intersection = result;
+	phong.ambientLight = scene.ambientLight;
+
+	// Points in shadow only get the ambient light
+	int depth = settings.maxDepth - level;
+	glm::vec3 colour = directLight(scene, phong, depth, path) + phong.Ia();
+
+	glm::vec3 reflectance = material.reflectionStrength;
+	if (level < 1 || maxComponent(reflectance) <= 0.f) {
+		return colour;
+	}
+
+	// Russian roulette: paths that carry little light only continue with a
+	// probability proportional to how much they carry, and the ones that do
+	// count for correspondingly more
+	glm::vec3 reflectedThroughput = throughput*reflectance;
+	float carried = maxComponent(reflectedThroughput);
+	if (carried < settings.rouletteThreshold) {
+		float survival = carried / settings.rouletteThreshold;
+		if (path.sampler.nextFloat() >= survival) {
+			path.statistics.rouletteKills[depth]++;
+			return colour;
+		}
+		reflectance /= survival;
+		reflectedThroughput /= survival;
+	}
+
+	glm::vec3 normal = glm::normalize(result.normal);
+	if (glm::dot(normal, ray.direction) > 0) normal = -normal;
+	Ray reflected(offsetFromSurface(result.point, normal), glm::reflect(ray.direction, normal));
+	// Nothing at this level looks at the differential after this
+	path.differential = bounceDifferential(ray, path.differential, result, true);
+	return colour + reflectance*raytraceSingleRay(scene, reflected, level - 1, reflectedThroughput, path);
+}
+
+glm::vec3 WhittedIntegrator::raytraceSingleRay(Scene const &scene, Ray const &ray, int level, glm::vec3 throughput,
+		PathContext &path) const {
+	path.statistics.rays[settings.maxDepth - level]++;
+	Intersection result = scene.bvh->closestIntersection(ray, -1);
+	return shadeIntersection(scene, ray, result, level, throughput, path);
+}
@@ -0,0 +1,36 @@
+//------------------------------------------------------------------------------
+// The assignment's ray tracer: Phong shading from every light that isn't in
+// shadow, plus ambient light, plus mirror reflections traced recursively.
+//------------------------------------------------------------------------------
+#pragma once
+
+#include "Integrator.h"
+#include "Lighting.h"
+
+class WhittedIntegrator : public Integrator {
+public:
+	using Integrator::Integrator;
+
+	const char* name() const { return "whitted"; }
+
+	glm::vec3 shade(Scene const &scene, Ray const &ray, Intersection const &hit, PathContext &path) const;
+
+private:
+	// Colour seen along the ray, given what it hit. level is the number of
+	// reflections the path may still take, and throughput how much of the
+	// colour found here makes it to the image.
+	glm::vec3 shadeIntersection(Scene const &scene, Ray const &ray, Intersection const &result, int level,
+		glm::vec3 throughput, PathContext &path) const;
+	// Colour seen along a reflected ray, which starts off the surface it
+	// leaves (see offsetFromSurface)
+	glm::vec3 raytraceSingleRay(Scene const &scene, Ray const &ray, int level, glm::vec3 throughput,
+		PathContext &path) const;
+
+	// Light reaching the point of phong from all of the scene's lights
+	glm::vec3 directLight(Scene const &scene, PhongReflection &phong, int depth, PathContext &path) const;
+	// Diffuse and specular light reaching the point of phong from one light,
+	// unless it's in shadow. weight scales it, to make up for lights that
+	// weren't sampled.
+	glm::vec3 shadeWithLight(Scene const &scene, PhongReflection &phong, Light const &light, float weight,
+		int depth, PathContext &path) const;
+};
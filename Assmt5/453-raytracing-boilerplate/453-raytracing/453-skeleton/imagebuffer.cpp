@@ -7,9 +7,8 @@
 //
 // You may use this code (or not) however you see fit for your work.
 //
-// Set the #defines below to choose the image library you have installed on
-// your system, that you will be using for your assignment. Then compile and
-// link this source file with your project.
+// Images are saved through ImageWriter.h, as PNG or as one of the float
+// formats it supports.
 //
 // Authors: Sonny Chan, Alex Brown
 //          University of Calgary
@@ -21,10 +20,6 @@
 
 #include "imagebuffer.h"
 
-
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb/stb_image_write.h"
-
 using namespace std;
 using namespace glm;
 
@@ -55,18 +50,7 @@ bool ImageBuffer::Initialize()
     // retrieve the current viewport size
     GLint viewport[4];
     glGetIntegerv(GL_VIEWPORT, viewport);
-    m_width = viewport[2];
-    m_height = viewport[3];
-
-    // allocate image data
-    m_imageData.resize(m_width * m_height);
-    for (int i = 0, k = 0; i < m_height; ++i)
-        for (int j = 0; j < m_width; ++j, ++k)
-        {
-            int p = (i >> 4) + (j >> 4);
-            float c = 0.2 + ((p & 1) ? 0.1f : 0.0f);
-            m_imageData[k] = vec3(c);
-        }
+    Initialize(viewport[2], viewport[3]);
 
     // allocate texture object
     if (!m_textureName)
@@ -93,6 +77,23 @@ bool ImageBuffer::Initialize()
     return status == GL_FRAMEBUFFER_COMPLETE;
 }
 
+void ImageBuffer::Initialize(int width, int height)
+{
+    m_width = width;
+    m_height = height;
+
+    // allocate image data
+    m_imageData.resize(m_width * m_height);
+    for (int i = 0, k = 0; i < m_height; ++i)
+        for (int j = 0; j < m_width; ++j, ++k)
+        {
+            int p = (i >> 4) + (j >> 4);
+            float c = 0.2 + ((p & 1) ? 0.1f : 0.0f);
+            m_imageData[k] = vec3(c);
+        }
+    ResetModified();
+}
+
 void ImageBuffer::Destroy()
 {
     if (m_framebufferObject) {
@@ -118,6 +119,20 @@ void ImageBuffer::SetPixel(int x, int y, vec3 colour)
     m_modifiedUpper = glm::max(m_modifiedUpper, y+1);
 }
 
+void ImageBuffer::SetPixels(int x, int y, int width, int height, const vec3 *colours)
+{
+    // Render() may be uploading the rows on another thread, so the copy is
+    // done under the lock too. It is only a tile's worth of pixels.
+    std::lock_guard<std::mutex> lock(m_modifiedMutex);
+    for (int i = 0, k = 0; i < height; ++i)
+        for (int j = 0; j < width; ++j, ++k)
+            m_imageData[(y + i) * m_width + x + j] = colours[k];
+
+    m_modified = true;
+    m_modifiedLower = glm::min(m_modifiedLower, y);
+    m_modifiedUpper = glm::max(m_modifiedUpper, y+height);
+}
+
 // --------------------------------------------------------------------------
 
 void ImageBuffer::Render()
@@ -125,6 +140,8 @@ void ImageBuffer::Render()
     if (!m_framebufferObject) return;
 
     // check for modifications to the image data and update texture as needed
+    // (tiles may be arriving from other threads while we do)
+    std::unique_lock<std::mutex> lock(m_modifiedMutex);
     if (m_modified)
     {
         int sizeY = m_modifiedUpper - m_modifiedLower;
@@ -139,6 +156,7 @@ void ImageBuffer::Render()
         // mark that we've updated the texture
         ResetModified();
     }
+    lock.unlock();
 
     // bind the framebuffer object with our texture in it and copy to screen
     glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebufferObject);
@@ -150,7 +168,7 @@ void ImageBuffer::Render()
 
 // --------------------------------------------------------------------------
 
-bool ImageBuffer::SaveToFile(const string &imageFileName)
+bool ImageBuffer::SaveToFile(const string &imageFileName, ToneMapping toneMapping)
 {
     if (m_width == 0 || m_height == 0)
     {
@@ -159,33 +177,6 @@ bool ImageBuffer::SaveToFile(const string &imageFileName)
     }
     cout << "ImageBuffer saving image to " << imageFileName << "..." << endl;
 
-    const unsigned numComponents = 3; //RGB
-    unsigned char* pixels = new unsigned char[m_width*m_height*numComponents];
-
-    for (int y = 0; y < m_height; ++y)
-        for (int x = 0; x < m_width; ++x)
-        {
-            glm::vec3& color = m_imageData[y * m_width + x];
-            int i = (m_height - 1 - y) * m_width + x;
-            i *= numComponents;
-
-            pixels[i]     = (unsigned char) (255 * clamp(color.r, 0.f, 1.f));	// red
-            pixels[i + 1] = (unsigned char) (255 * clamp(color.g, 0.f, 1.f));	// green
-            pixels[i + 2] = (unsigned char) (255 * clamp(color.b, 0.f, 1.f));	// blue
-        }
-
-    // Save the image to disk
-    int stride = 0;
-    if (!stbi_write_png(imageFileName.data(), m_width, m_height, numComponents, pixels, stride))
-    {
-        // Fail! delete and exit
-        cout << "STB failed to write image " << imageFileName << endl;
-        delete[] pixels;
-        return false;
-    }
-
-    //success, delete and exit
-    delete[] pixels;
-    return true;
+    // The format goes by the extension, see ImageWriter.h
+    return writeImage(imageFileName, m_width, m_height, m_imageData.data(), toneMapping);
 }
-
@@ -14,8 +14,11 @@
 
 #include <vector>
 #include <string>
+#include <mutex>
 #include <glm/vec3.hpp>
 
+#include "ImageWriter.h"
+
 #ifndef GLFW_VERSION_MAJOR
 #include <GL/glew.h>
 //#define GLFW_INCLUDE_GLCOREARB
@@ -41,6 +44,7 @@ class ImageBuffer
     // state variables to keep track of modified region
     bool    m_modified;
     int     m_modifiedLower, m_modifiedUpper;
+    std::mutex m_modifiedMutex;
 
     void ResetModified();
 
@@ -56,6 +60,11 @@ public:
     // buffer that matches the size of your viewport
     bool Initialize();
 
+    // call this to create an image buffer of a given size that only lives
+    // in memory. Needs no OpenGL context, e.g. for rendering headless and
+    // saving the result with SaveToFile. Render() does nothing for it.
+    void Initialize(int width, int height);
+
     // call this if you need to delete the framebuffer object and texture
     void Destroy();
 
@@ -64,11 +73,21 @@ public:
     //  - colour is RGB given as floating point numbers in the range [0,1]
     void SetPixel(int x, int y, glm::vec3 colour);
 
+    // set a width x height block of pixels with (x,y) as its bottom-left
+    // corner, from an array of colours stored row by row, bottom row first.
+    // Several threads may call this at once, e.g. one tile each, and while
+    // Render() runs on another thread; only the rows changed since the last
+    // Render() are uploaded.
+    void SetPixels(int x, int y, int width, int height, const glm::vec3 *colours);
+
     // call this in your render function to copy this image onto your screen
     void Render();
 
-    // call this at the end of your render to save the image to file
-    bool SaveToFile(const std::string &imageFileName);
+    // call this at the end of your render to save the image to file. The
+    // extension picks the format: .pfm, .hdr or .exr keep the float colours
+    // as they are, anything else is saved as PNG with the colours mapped
+    // into [0,1] by toneMapping
+    bool SaveToFile(const std::string &imageFileName, ToneMapping toneMapping = ToneMapping::Clamp);
 };
 
 // --------------------------------------------------------------------------
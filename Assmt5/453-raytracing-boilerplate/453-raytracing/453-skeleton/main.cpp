@@ -4,9 +4,17 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
+#include <argh.h>
 #include <glm/gtx/vector_query.hpp>
 
 #include "Geometry.h"
@@ -17,156 +25,399 @@
 #include "Texture.h"
 #include "Window.h"
 #include "imagebuffer.h"
+#include "ImageWriter.h"
 #include "RayTrace.h"
+#include "Camera.h"
 #include "Scene.h"
-#include "Lighting.h"
+#include "SceneFile.h"
+#include "SceneCache.h"
+#include "Integrator.h"
+#include "TileScheduler.h"
+#include "RayPacket.h"
+#include "RenderJob.h"
+#include "AccumulationBuffer.h"
+#include "Denoiser.h"
+#include "Sampler.h"
+#include "RayStatistics.h"
+#include "TextureCache.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_glfw.h"
 #include "imgui/imgui_impl_opengl3.h"
 
-int sceneNumber = 1;
+// SIMD kernels used to trace primary rays in packets. nullptr traces every
+// ray on its own with the scalar code.
+PacketKernels const* primaryRayKernels = selectPacketKernels();
 
-int hasIntersection(Scene const &scene, Ray ray, int skipID){
-	for (auto &shape : scene.shapesInScene) {
-		Intersection tmp = shape->getIntersection(ray);
-		if(
-			shape->id != skipID
-			&& tmp.numberOfIntersections!=0
-			&& glm::distance(tmp.point, ray.origin) > 0.00001
-			&& glm::distance(tmp.point, ray.origin) < glm::distance(ray.origin, scene.lightPosition) - 0.01
-		){
-			return tmp.id;
+// Where the samples of each pixel get their numbers from, see Sampler.h
+SampleSequence sampleSequence = SampleSequence::Sobol;
+
+// How saved PNGs fit colours above 1 in, see ImageWriter.h
+ToneMapping toneMapping = ToneMapping::Clamp;
+
+// Whether renders are denoised after every pass, see Denoiser.h
+bool denoiseImage = false;
+DenoiserSettings denoiserSettings;
+
+// Traces a bundle of coherent primary rays, as a SIMD packet if possible, and
+// has the integrator shade what they hit. Secondary rays go in all
+// directions, so the integrators trace them one by one. Each ray has its own
+// sampler and differential. The features of what each ray hit go in
+// features, for the denoiser.
+void raytracePrimaryRays(Scene const &scene, Integrator const &integrator, Ray const* rays, RayDifferential const* differentials,
+		Sampler* samplers, int count, RayStatistics &statistics, glm::vec3* colours, SurfaceFeatures* features) {
+	statistics.rays[0] += count;
+	if (!primaryRayKernels || count == 1) {
+		for (int i = 0; i < count; i++) {
+			PathContext path{samplers[i], statistics, differentials[i]};
+			Intersection result = scene.bvh->closestIntersection(rays[i], -1);
+			colours[i] = integrator.shade(scene, rays[i], result, path);
+			features[i] = surfaceFeatures(scene, rays[i], differentials[i], result);
 		}
+		return;
+	}
+
+	RayPacket packet;
+	setRayPacket(packet, rays, count, primaryRayKernels->width);
+	scene.bvh->closestIntersections(*primaryRayKernels, packet, -1);
+	for (int i = 0; i < count; i++) {
+		PathContext path{samplers[i], statistics, differentials[i]};
+		Intersection result = scene.bvh->resolvePacketHit(rays[i], packet.hit[i], -1);
+		colours[i] = integrator.shade(scene, rays[i], result, path);
+		features[i] = surfaceFeatures(scene, rays[i], differentials[i], result);
 	}
-	return -1;
 }
 
-Intersection getClosestIntersection(Scene const &scene, Ray ray, int skipID){ //get the nearest
-	Intersection closestIntersection;
-	float min = std::numeric_limits<float>::max();
-	for(auto &shape : scene.shapesInScene) {
-		if(skipID == shape->id) {
-			// Sometimes you need to skip certain shapes. Useful to
-			// avoid self-intersection. ;)
-			continue;
+// When to stop refining the image
+struct RenderTarget {
+	// Samples per pixel to stop at, 0 for no limit
+	int samplesPerPixel = 1;
+	// Stop once a pass ends after this many seconds, 0 for no limit
+	double seconds = 0;
+	// Adaptive sampling: a pixel gets no more samples once the estimated
+	// relative error of its brightness is below this (and that of all its
+	// neighbours too). 0 samples every pixel equally.
+	float noiseThreshold = 0.f;
+	// Before the first pass, trace one sample for each block of this many
+	// pixels square and fill the block with it, for a rough image within a
+	// fraction of the time of a pass. 0 or 1 for none.
+	int previewBlockSize = 0;
+};
+
+// Per-pixel features of what the camera rays hit, averaged over each
+// pixel's samples, row by row, bottom row first. See SurfaceFeatures.
+struct RenderAOVs {
+	std::vector<glm::vec3> albedo;
+	std::vector<glm::vec3> normal;
+	std::vector<float> depth;
+};
+
+// Pixels are never considered converged with fewer samples than this, since
+// with only a few samples an edge can look perfectly flat by chance
+const int MIN_ADAPTIVE_SAMPLES = 16;
+
+// Renders progressively: each pass adds more samples to every pixel that
+// still needs them, and the image is updated with the mean so far as each
+// tile of a pass completes. The first sample of a pixel goes through its
+// corner; the others are jittered randomly over it. The rays are made by the
+// camera as each sample is traced. With a preview block size, a rough
+// preview covers the image before the first pass.
+//
+// The integrator shades what the camera rays hit. The image must already be
+// initialized to the size to render at. Once *cancelled is set no more tiles
+// are written. Counts of the rays traced are added to *statistics if given,
+// and the features of what the camera rays hit are put in *aovs. Returns the
+// average number of samples per pixel in the image.
+double raytraceImage(Scene const &scene, Integrator const &integrator, ImageBuffer &image, Camera const &camera,
+		RenderTarget const &target,
+		std::atomic<bool> const* cancelled = nullptr, RayStatistics* statistics = nullptr, RenderAOVs* aovs = nullptr) {
+	int width = image.Width();
+	int height = image.Height();
+	CameraRays cameraRays(camera, width, height);
+	AccumulationBuffer accumulation;
+	accumulation.initialize(width, height);
+
+	// Which pixels get samples in the next pass
+	std::vector<unsigned char> active(width*height, 1);
+
+	// The image is split into tiles which are traced in parallel on all of
+	// the CPU cores. Every sample is traced exactly as it would be serially,
+	// so the image is the same no matter how many threads there are.
+	//
+	// Every sample has its own sampler, made from the pixel and sample index,
+	// for jittering the ray and picking a point on the lens, then for
+	// sampling lights, bouncing and Russian roulette.
+	auto primaryRay = [&](int x, int y, int sample, Sampler &sampler) {
+		sampler = Sampler(sampleSequence, x, y, width, sample);
+		glm::vec2 offset(0);
+		if (sample > 0) {
+			offset.x = sampler.nextFloat();
+			offset.y = sampler.nextFloat();
 		}
-		Intersection p = shape->getIntersection(ray);
-		float distance = glm::distance(p.point, ray.origin);
-		if(p.numberOfIntersections !=0 && distance < min){
-			min = distance;
-			closestIntersection = p;
+		glm::vec2 lensSample(0);
+		if (camera.hasLens()) {
+			lensSample.x = sampler.nextFloat();
+			lensSample.y = sampler.nextFloat();
 		}
-	}
-	return closestIntersection;
-}
+		return cameraRays.generate(x, y, offset, lensSample);
+	};
+	// Textures are filtered over the share of the pixel each sample stands
+	// for: 1/sqrt(samples) of it across, but no less than an eighth (as in
+	// pbrt), which is also what renders without a sample limit get
+	int expectedSamples = target.samplesPerPixel > 0 ? target.samplesPerPixel : 64;
+	float sampleFootprint = std::max(0.125f, 1.f/std::sqrt(float(expectedSamples)));
+	std::mutex statisticsMutex;
 
+	auto isCancelled = [&]() { return cancelled && cancelled->load(); };
+	bool firstPass = true;
+	auto renderPass = [&](Tile const &tile, int sampleCount) {
+		if (isCancelled()) {
+			return;
+		}
 
-glm::vec3 raytraceSingleRay(Scene const &scene, Ray const &ray, int level, int source_id) {
-	// TODO: Part 3: Somewhere in this function you will need to add the code to determine
-	//               if a given point is in shadow or not. Think carefully about what parts
-	//               of the lighting equation should be used when a point is in shadow.
-	// TODO: Part 4: Somewhere in this function you will need to add the code that does reflections.
-	//               NOTE: The ObjectMaterial class already has a parameter to store the object's
-	//               reflective properties. Use this parameter + the color coming back from the
-	//               reflected array and the color from the phong shading equation.
-	Intersection result = getClosestIntersection(scene, ray, source_id); //find intersection
+		// Neighbouring pixels are traced together, in blocks that fill one
+		// SIMD packet: 2x2 pixels for 4 wide, 4x2 for 8 wide, 4x4 for 16 wide
+		int packetWidth = primaryRayKernels ? primaryRayKernels->width : 1;
+		int blockWidth = packetWidth >= 8 ? 4 : (packetWidth >= 4 ? 2 : 1);
+		int blockHeight = packetWidth / blockWidth;
 
-	PhongReflection phong;
-	phong.ray = ray;
-	phong.scene = scene;
-	phong.material = result.material;
-	phong.intersection = result;
+		// The tile runs start to end on this thread, so the thread's
+		// traversal counters only move for it meanwhile
+		auto tileStart = std::chrono::steady_clock::now();
+		TraversalCounters traversalBefore = threadTraversalCounters();
 
-	if(result.numberOfIntersections == 0) return glm::vec3(0, 0, 0); // black;
+		RayStatistics tileStatistics;
+		bool anyActive = false;
+		for (int by = tile.y; by < tile.y + tile.height; by += blockHeight) {
+			if (isCancelled()) {
+				return;
+			}
+			for (int bx = tile.x; bx < tile.x + tile.width; bx += blockWidth) {
+				for (int s = 0; s < sampleCount; s++) {
+					Ray blockRays[MAX_PACKET_WIDTH];
+					RayDifferential blockDifferentials[MAX_PACKET_WIDTH];
+					Sampler blockSamplers[MAX_PACKET_WIDTH];
+					int blockX[MAX_PACKET_WIDTH];
+					int blockY[MAX_PACKET_WIDTH];
+					int count = 0;
+					for (int y = by; y < std::min(by + blockHeight, tile.y + tile.height); y++) {
+						for (int x = bx; x < std::min(bx + blockWidth, tile.x + tile.width); x++) {
+							if (!active[y*width + x]) {
+								continue;
+							}
+							blockRays[count] = primaryRay(x, y, accumulation.samples(x, y), blockSamplers[count]);
+							blockDifferentials[count] = cameraRays.differential(blockRays[count]).scaled(sampleFootprint);
+							blockX[count] = x;
+							blockY[count++] = y;
+						}
+					}
+					if (count == 0) {
+						break;
+					}
 
-	if (level < 1) {
-		phong.material.reflectionStrength = glm::vec3(0);
-	}
+					glm::vec3 blockColours[MAX_PACKET_WIDTH];
+					SurfaceFeatures blockFeatures[MAX_PACKET_WIDTH];
+					raytracePrimaryRays(scene, integrator, blockRays, blockDifferentials, blockSamplers, count,
+						tileStatistics, blockColours, blockFeatures);
+					for (int i = 0; i < count; i++) {
+						accumulation.add(blockX[i], blockY[i], blockColours[i], blockFeatures[i]);
+					}
+					anyActive = true;
+				}
+			}
+		}
 
-	Ray shadowRay(result.point, scene.lightPosition - result.point);
-	Intersection shadowResult = getClosestIntersection(scene, shadowRay, result.id);
-	if (sceneNumber == 1)
-	{
-		if (shadowResult.numberOfIntersections > 0 && shadowResult.id < 3)
-		{
-			return phong.Ia();
+		// Hand the tile over in one go, so the threads never fight over the
+		// image. When denoising, tiles only show up as they are first traced,
+		// so there's something to look at; after that the whole image is
+		// denoised and replaced at the end of each pass.
+		if (anyActive && (!denoiseImage || firstPass)) {
+			std::vector<glm::vec3> colours(tile.width*tile.height);
+			accumulation.resolve(tile, colours.data());
+			image.SetPixels(tile.x, tile.y, tile.width, tile.height, colours.data());
 		}
-	}
-	else
-	{
-		if (shadowResult.numberOfIntersections > 0 && shadowResult.id < 7)
-		{
-			return phong.Ia();
+
+		if (statistics) {
+			tileStatistics.traversal = threadTraversalCounters();
+			tileStatistics.traversal.subtract(traversalBefore);
+			std::chrono::duration<double> tileTime = std::chrono::steady_clock::now() - tileStart;
+			tileStatistics.tiles = 1;
+			tileStatistics.tileSeconds = tileStatistics.slowestTileSeconds = tileTime.count();
+			std::lock_guard<std::mutex> lock(statisticsMutex);
+			statistics->add(tileStatistics);
 		}
-	}
+	};
 
+	// The preview: one sample through each block, on the pixel nearest its
+	// middle, shown for the whole block. It's only shown, not accumulated,
+	// so the passes after it sample every pixel as they would without it.
+	auto previewPass = [&](Tile const &tile) {
+		if (isCancelled()) {
+			return;
+		}
+		int block = target.previewBlockSize;
+		TraversalCounters traversalBefore = threadTraversalCounters();
+		RayStatistics tileStatistics;
 
-	return phong.I();
-}
+		std::vector<Ray> rays;
+		std::vector<RayDifferential> differentials;
+		std::vector<Sampler> samplers;
+		std::vector<glm::ivec2> blocks;
+		for (int by = tile.y; by < tile.y + tile.height; by += block) {
+			for (int bx = tile.x; bx < tile.x + tile.width; bx += block) {
+				int x = std::min(bx + block/2, tile.x + tile.width - 1);
+				int y = std::min(by + block/2, tile.y + tile.height - 1);
+				samplers.emplace_back();
+				rays.push_back(primaryRay(x, y, 0, samplers.back()));
+				// The sample stands for the whole block
+				differentials.push_back(cameraRays.differential(rays.back()).scaled(float(block)));
+				blocks.push_back(glm::ivec2(bx, by));
+			}
+		}
 
-struct RayAndPixel {
-	Ray ray;
-	int x;
-	int y;
-};
+		// A row of neighbouring blocks at a time is still coherent enough
+		// for a packet
+		int packetWidth = primaryRayKernels ? primaryRayKernels->width : 1;
+		std::vector<glm::vec3> blockColours(rays.size());
+		std::vector<SurfaceFeatures> blockFeatures(rays.size());
+		for (std::size_t i = 0; i < rays.size(); i += packetWidth) {
+			int count = std::min(packetWidth, int(rays.size() - i));
+			raytracePrimaryRays(scene, integrator, &rays[i], &differentials[i], &samplers[i], count, tileStatistics,
+				&blockColours[i], &blockFeatures[i]);
+		}
+		if (isCancelled()) {
+			return;
+		}
 
-std::vector<RayAndPixel> getRaysForViewpoint(Scene const &scene, ImageBuffer &image, glm::vec3 viewPoint) {
-	// This is the function you must implement for part 1
-	//
-	// This function is responsible for creating the rays that go
-	// from the viewpoint out into the scene with the appropriate direction
-	// and angles to produce a perspective image.
-	int x = 0;
-	int y = 0;
-	std::vector<RayAndPixel> rays;
-
-	for (float i = -0.5; x < image.Width(); x++) {
-		y = 0;
-		for (float j = -0.5; y < image.Height(); y++) {
-			glm::vec3 direction = glm::normalize(glm::vec3(i - viewPoint.x, j - viewPoint.y, -1));
-			glm::vec3 viewPointOrthographic(viewPoint.x, viewPoint.y, 0);
-			Ray r = Ray(viewPointOrthographic, direction);
-			rays.push_back({r, x, y});
-			j += 1.f / image.Height();
-		}
-		i += 1.f / image.Width();
-	}
-	return rays;
-}
+		std::vector<glm::vec3> colours(tile.width*tile.height);
+		for (std::size_t i = 0; i < blocks.size(); i++) {
+			for (int y = blocks[i].y; y < std::min(blocks[i].y + block, tile.y + tile.height); y++) {
+				for (int x = blocks[i].x; x < std::min(blocks[i].x + block, tile.x + tile.width); x++) {
+					colours[(y - tile.y)*tile.width + (x - tile.x)] = blockColours[i];
+				}
+			}
+		}
+		image.SetPixels(tile.x, tile.y, tile.width, tile.height, colours.data());
 
-void raytraceImage(Scene const &scene, ImageBuffer &image, glm::vec3 viewPoint) {
-	// Reset the image to the current size of the screen.
-	image.Initialize();
+		if (statistics) {
+			tileStatistics.traversal = threadTraversalCounters();
+			tileStatistics.traversal.subtract(traversalBefore);
+			std::lock_guard<std::mutex> lock(statisticsMutex);
+			statistics->add(tileStatistics);
+		}
+	};
 
-	// Get the set of rays to cast for this given image / viewpoint
-	std::vector<RayAndPixel> rays = getRaysForViewpoint(scene, image, viewPoint);
+	// A pixel stays active while it or one of its neighbours is still too
+	// noisy. Looking at the neighbours too catches edges that the pixel's
+	// own samples happened to miss so far. Returns how many are active.
+	auto updateActive = [&](Tile const &tile) {
+		int count = 0;
+		for (int y = tile.y; y < tile.y + tile.height; y++) {
+			for (int x = tile.x; x < tile.x + tile.width; x++) {
+				bool noisy = false;
+				for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1) && !noisy; ny++) {
+					for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1) && !noisy; nx++) {
+						noisy = accumulation.relativeError(nx, ny) > target.noiseThreshold;
+					}
+				}
+				active[y*width + x] = noisy;
+				count += noisy;
+			}
+		}
+		return count;
+	};
 
+	auto start = std::chrono::steady_clock::now();
+	auto outOfTime = [&]() {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return target.seconds > 0 && elapsed.count() >= target.seconds;
+	};
 
-	// This loops processes each ray and stores the resulting pixel in the image.
-	// final color into the image at the appropriate location.
-	//
-	// I've written it this way, because if you're keen on this, you can
-	// try and parallelize this loop to ensure that your ray tracer makes use
-	// of all of your CPU cores
-	//
-	// Note, if you do this, you will need to be careful about how you render
-	// things below too
-	// std::for_each(std::begin(rays), std::end(rays), [&] (auto const &r) {
-	for (auto const & r : rays) {
-		glm::vec3 color = raytraceSingleRay(scene, r.ray, 5, -1);
-		image.SetPixel(r.x, r.y, color);
+	// Passes start at one sample per pixel so there is something to look at
+	// quickly, then grow so the image isn't resolved more often than needed
+	const int MAX_SAMPLES_PER_PASS = 16;
+	TileScheduler scheduler(width, height);
+	if (target.previewBlockSize > 1) {
+		scheduler.run(ThreadPool::global(), previewPass);
 	}
+	int samples = 0;
+	while (target.samplesPerPixel == 0 || samples < target.samplesPerPixel) {
+		if (samples > 0 && outOfTime()) {
+			break;
+		}
+		if (target.noiseThreshold > 0 && samples >= MIN_ADAPTIVE_SAMPLES) {
+			std::atomic<int> activePixels(0);
+			scheduler.run(ThreadPool::global(), [&](Tile const &tile) {
+				activePixels += updateActive(tile);
+			});
+			if (activePixels == 0) {
+				break; // everything has converged
+			}
+		}
+
+		int passSamples = std::min(std::max(samples, 1), MAX_SAMPLES_PER_PASS);
+		if (target.samplesPerPixel > 0) {
+			passSamples = std::min(passSamples, target.samplesPerPixel - samples);
+		}
+		scheduler.run(ThreadPool::global(), [&](Tile const &tile) {
+			renderPass(tile, passSamples);
+		});
+		if (isCancelled()) {
+			break;
+		}
+		samples += passSamples;
+		firstPass = false;
+
+		if (denoiseImage) {
+			std::vector<glm::vec3> colours;
+			denoise(accumulation, denoiserSettings, colours);
+			image.SetPixels(0, 0, width, height, colours.data());
+		}
+	}
+
+	if (aovs) {
+		aovs->albedo.resize(width*height);
+		aovs->normal.resize(width*height);
+		aovs->depth.resize(width*height);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				SurfaceFeatures const &features = accumulation.features(x, y);
+				aovs->albedo[y*width + x] = features.albedo;
+				aovs->normal[y*width + x] = features.normal;
+				aovs->depth[y*width + x] = features.depth;
+			}
+		}
+	}
+
+	if (statistics) {
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		statistics->seconds += elapsed.count();
+	}
+
+	double totalSamples = 0;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			totalSamples += accumulation.samples(x, y);
+		}
+	}
+	return totalSamples / (double(width)*height);
 }
 
 // EXAMPLE CALLBACKS
 class Assignment5 : public CallbackInterface {
 
 public:
-	Assignment5() {
-		viewPoint = glm::vec3(0, 0, 0);
-		scene = initScene1();
-		raytraceImage(scene, outputImage, viewPoint);
+	Assignment5(std::string const &initialScene, RenderTarget target, std::string const &initialIntegrator,
+			IntegratorSettings const &settings)
+		: renderTarget(target)
+		, integratorSettings(settings)
+	{
+		integrator = createIntegrator(initialIntegrator, integratorSettings);
+		sceneName = initialScene;
+		scene = loadScene(initialScene, meshes);
+		camera = scene.camera;
+		renderTarget.previewBlockSize = PREVIEW_BLOCK_SIZE;
+		startRender();
 	}
 
 	virtual void keyCallback(int key, int scancode, int action, int mods) {
@@ -175,60 +426,602 @@ public:
 		}
 
 		if (key == GLFW_KEY_1 && action == GLFW_PRESS) {
-			scene = initScene1();
-			sceneNumber = 1;
-			raytraceImage(scene, outputImage, viewPoint);
+			switchScene("1");
 		}
 
 		if (key == GLFW_KEY_2 && action == GLFW_PRESS) {
-			scene = initScene2();
-			sceneNumber = 2;
-			raytraceImage(scene, outputImage, viewPoint);
+			switchScene("2");
+		}
+
+		// Picks up changes to the scene file (and the meshes it uses)
+		if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+			switchScene(sceneName);
+		}
+
+		if (key == GLFW_KEY_S && action == GLFW_PRESS) {
+			showStatistics = !showStatistics;
+		}
+
+		// Flying: the arrows move across and along the view, Page Up and
+		// Page Down up and down, and keep going while held
+		if (action == GLFW_PRESS || action == GLFW_REPEAT) {
+			float step = MOVE_STEP*distanceAhead();
+			glm::vec3 offset(0);
+			if (key == GLFW_KEY_UP) offset.z = step;
+			else if (key == GLFW_KEY_DOWN) offset.z = -step;
+			else if (key == GLFW_KEY_RIGHT) offset.x = step;
+			else if (key == GLFW_KEY_LEFT) offset.x = -step;
+			else if (key == GLFW_KEY_PAGE_UP) offset.y = step;
+			else if (key == GLFW_KEY_PAGE_DOWN) offset.y = -step;
+			if (offset != glm::vec3(0)) {
+				camera.move(offset);
+				cameraMoved = true;
+			}
+		}
+
+		// Back to the scene's own camera
+		if (key == GLFW_KEY_HOME && action == GLFW_PRESS) {
+			camera = scene.camera;
+			cameraMoved = true;
+		}
+
+		// Between the Whitted ray tracer and the path tracer
+		if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+			std::string next = std::string(integrator->name()) == "path" ? "whitted" : "path";
+			cancelRender();
+			integrator = createIntegrator(next, integratorSettings);
+			Log::info("Rendering with the {} integrator", integrator->name());
+			startRender();
+		}
+	}
+
+	// Dragging with the left mouse button orbits around what's in the middle
+	// of the view, with the right one looks around, and with the middle one
+	// pans. Drags that start on the statistics overlay are left to it.
+	virtual void mouseButtonCallback(int button, int action, int mods) {
+		if (action == GLFW_RELEASE) {
+			drag = Drag::None;
+			return;
+		}
+		if (action != GLFW_PRESS || ImGui::GetIO().WantCaptureMouse) {
+			return;
+		}
+		if (button == GLFW_MOUSE_BUTTON_LEFT) {
+			drag = Drag::Orbit;
+			orbitCentre = camera.position + distanceAhead()*glm::normalize(camera.direction);
+		}
+		else if (button == GLFW_MOUSE_BUTTON_RIGHT) {
+			drag = Drag::Look;
+		}
+		else if (button == GLFW_MOUSE_BUTTON_MIDDLE) {
+			drag = Drag::Pan;
+			panDistance = distanceAhead();
+		}
+	}
+
+	virtual void cursorPosCallback(double xpos, double ypos) {
+		glm::vec2 delta = glm::vec2(xpos, ypos) - cursor;
+		cursor = glm::vec2(xpos, ypos);
+		// Window coordinates go down, the camera's up
+		switch (drag) {
+		case Drag::None:
+			return;
+		case Drag::Orbit:
+			camera.orbit(orbitCentre, -TURN_SPEED*delta.x, -TURN_SPEED*delta.y);
+			break;
+		case Drag::Look:
+			camera.turn(-TURN_SPEED*delta.x, -TURN_SPEED*delta.y);
+			break;
+		case Drag::Pan: {
+			// So what's in the middle of the view follows the mouse
+			float viewHeight = camera.type == Camera::Orthographic
+				? camera.height
+				: panDistance*2.f*std::tan(0.5f*glm::radians(camera.fieldOfView));
+			float unitsPerPixel = viewHeight/std::max(outputImage.Height(), 1);
+			camera.move(glm::vec3(-delta.x, delta.y, 0)*unitsPerPixel);
+			break;
+		}
+		}
+		cameraMoved = true;
+	}
+
+	// Scrolling moves towards what's in the middle of the view, by a tenth
+	// of the way there for each step of the wheel
+	virtual void scrollCallback(double xoffset, double yoffset) {
+		if (ImGui::GetIO().WantCaptureMouse) {
+			return;
+		}
+		camera.move(glm::vec3(0, 0, 0.1f*float(yoffset)*distanceAhead()));
+		cameraMoved = true;
+	}
+
+	// Called once a frame. If the camera moved since the last frame, however
+	// many times, restarts the render from where it is now. The image isn't
+	// cleared first: it stays up until the preview replaces it, so moving
+	// the camera doesn't flicker.
+	void update() {
+		if (cameraMoved) {
+			cameraMoved = false;
+			startRender(false);
 		}
 	}
 
+	// "1" and "2" are the built-in scenes, files ending in .scenecache are
+	// scene caches, and anything else is a scene file. Throws
+	// std::runtime_error if the file can't be loaded.
+	static Scene loadScene(std::string const &name, MeshCache &meshes) {
+		if (name == "1") return initScene1();
+		if (name == "2") return initScene2();
+		if (std::filesystem::path(name).extension() == ".scenecache") return loadSceneCache(name);
+		return loadSceneFile(name, meshes);
+	}
+
+	void switchScene(std::string const &name) {
+		// Load it first, so a mistake in the file leaves the current scene up
+		Scene next;
+		try {
+			next = loadScene(name, meshes);
+		}
+		catch (std::runtime_error const &e) {
+			Log::error("Can't load scene: {}", e.what());
+			return;
+		}
+
+		// The running render reads the scene, so it has to stop first.
+		// Reloading the same scene keeps the camera where it was moved to.
+		cancelRender();
+		if (name != sceneName) {
+			camera = next.camera;
+		}
+		sceneName = name;
+		scene = next;
+		meshes.prune();
+		TextureCache::global().prune();
+		startRender();
+	}
+
+	// Renders the scene in the background, through the camera as it is now.
+	// Tiles show up in outputImage as they finish, and keep refining until
+	// renderTarget is reached; the render loop keeps drawing it in the
+	// meantime. clearImage starts from an empty image rather than what was
+	// rendered before.
+	void startRender(bool clearImage = true) {
+		cancelRender();
+		if (clearImage) {
+			outputImage.Initialize();
+		}
+		renderJob = std::make_unique<RenderJob>([this, camera = camera](std::atomic<bool> const &cancelled) {
+			auto start = std::chrono::steady_clock::now();
+			RayStatistics statistics;
+			double samples = raytraceImage(scene, *integrator, outputImage, camera, renderTarget, &cancelled, &statistics);
+			if (!cancelled) {
+				std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+				Log::info("Rendered scene {}, {:.1f} samples per pixel in {:.2f} seconds", sceneName, samples, elapsed.count());
+				statistics.log();
+				std::lock_guard<std::mutex> lock(statisticsMutex);
+				lastStatistics = statistics;
+				lastSamples = samples;
+			}
+		});
+	}
+
+	void cancelRender() {
+		renderJob.reset();
+	}
+
+	void finishRender() {
+		if (renderJob) {
+			renderJob->wait();
+		}
+	}
+
+	// How far ahead of the camera the middle of the view hits something, or
+	// a distance in proportion to the scene if nothing is there. Orbiting,
+	// panning, scrolling and flying go by it, so they're as fast in a small
+	// scene as in a large one.
+	float distanceAhead() const {
+		glm::vec3 forward = glm::normalize(camera.direction);
+		Intersection hit = scene.bvh->closestIntersection(Ray(camera.position, forward), -1);
+		if (hit.numberOfIntersections > 0) {
+			return hit.t;
+		}
+		AABB bounds = scene.bvh->bounds();
+		return bounds.isEmpty() ? 1.f : 0.5f*glm::length(bounds.extent());
+	}
+
+	// The statistics of the last render to finish, for the overlay
+	void drawStatistics() {
+		if (!showStatistics) {
+			return;
+		}
+		RayStatistics statistics;
+		double samples;
+		{
+			std::lock_guard<std::mutex> lock(statisticsMutex);
+			statistics = lastStatistics;
+			samples = lastSamples;
+		}
+		TraversalCounters const &traversal = statistics.traversal;
+
+		ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_FirstUseEver);
+		ImGui::SetNextWindowBgAlpha(0.6f);
+		ImGui::Begin("Statistics", &showStatistics, ImGuiWindowFlags_AlwaysAutoResize);
+		if (statistics.tiles == 0) {
+			ImGui::Text("Rendering...");
+		}
+		else {
+			ImGui::Text("%.1f samples per pixel in %.2f s", samples, statistics.seconds);
+			ImGui::Text("%.2f Mrays/s", statistics.megaraysPerSecond());
+			ImGui::Separator();
+			for (int i = 0; i <= RayStatistics::MAX_DEPTH; i++) {
+				if (statistics.rays[i] > 0) {
+					ImGui::Text("Depth %d: %llu rays, %llu shadow rays", i,
+						(unsigned long long)statistics.rays[i], (unsigned long long)statistics.shadowRays[i]);
+				}
+			}
+			ImGui::Separator();
+			ImGui::Text("Per ray query: %.1f nodes, %.1f primitives",
+				traversal.nodesPerQuery(), traversal.primitivesPerQuery());
+			ImGui::Text("Per packet: %.1f nodes, %.1f primitives",
+				traversal.nodesPerPacket(), traversal.primitivesPerPacket());
+			ImGui::Text("Tiles: %.2f ms average, %.2f ms slowest",
+				1000*statistics.tileSeconds/statistics.tiles, 1000*statistics.slowestTileSeconds);
+		}
+		ImGui::End();
+	}
+
 	bool shouldQuit = false;
+	bool showStatistics = true;
+
+	// Blocks of the preview that shows before the first pass of every
+	// render, and more so while the camera moves
+	static const int PREVIEW_BLOCK_SIZE = 4;
+	// Radians the camera turns for each pixel the mouse moves
+	static constexpr float TURN_SPEED = 0.005f;
+	// How far a press of an arrow key flies, as a fraction of distanceAhead()
+	static constexpr float MOVE_STEP = 0.05f;
+
+	// Where the camera has been moved to. The scene keeps the camera it was
+	// loaded with, and renders get a copy of this one when they start.
+	Camera camera;
+	// Whether it moved since the render was last started
+	bool cameraMoved = false;
+
+	enum class Drag { None, Orbit, Look, Pan };
+	Drag drag = Drag::None;
+	glm::vec2 cursor = glm::vec2(0);
+	// Where the orbit started looking at, and how far off what was in the
+	// middle of the view when the pan started
+	glm::vec3 orbitCentre = glm::vec3(0);
+	float panDistance = 1;
 
 	ImageBuffer outputImage;
+	std::string sceneName;
+	MeshCache meshes;
 	Scene scene;
-	glm::vec3 viewPoint;
+	RenderTarget renderTarget;
+	IntegratorSettings integratorSettings;
+	// Only changed while no render is running
+	std::shared_ptr<Integrator const> integrator;
+
+	// Written by the render thread as it finishes
+	std::mutex statisticsMutex;
+	RayStatistics lastStatistics;
+	double lastSamples = 0;
+
+	// Declared last so it is destroyed (cancelled) before what it renders
+	std::unique_ptr<RenderJob> renderJob;
 
 };
 // END EXAMPLES
 
+void printUsage() {
+	std::cout <<
+		"Usage: 453-skeleton [options] [scene files...]\n"
+		"  --headless          render without opening a window, then save and exit.\n"
+		"                      Scene files after the options are each rendered and\n"
+		"                      saved next to the file, as a PNG of the same name.\n"
+		"  -s, --scene <scene> scene to render: 1 or 2 for the built-in ones, a scene\n"
+		"                      file, or a scene cache ending in .scenecache (default\n"
+		"                      1). In the window, 1 and 2 switch scenes and R\n"
+		"                      reloads the scene file.\n"
+		"  --write-cache <file> save the scene as a scene cache, which loads almost\n"
+		"                      instantly, and exit\n"
+		"  --width <pixels>    image width (default 800)\n"
+		"  --height <pixels>   image height (default 800)\n"
+		"  -n, --samples <n>   samples per pixel to refine the image up to, 0 for no\n"
+		"                      limit (default 1 when headless, 64 otherwise)\n"
+		"  -t, --time <s>      stop refining after this many seconds (default: no\n"
+		"                      limit)\n"
+		"  --noise <error>     adaptive sampling: stop sampling pixels once their\n"
+		"                      estimated relative error is below this (default\n"
+		"                      0.01, 0 samples all pixels equally)\n"
+		"  -o, --output <file> where to save the image (default render.png when\n"
+		"                      headless, not saved otherwise). Ending in .pfm, .hdr\n"
+		"                      or .exr saves it in that float format, unclipped;\n"
+		"                      anything else saves a PNG. The window saves it when\n"
+		"                      closed, once the render is done, or as it is if\n"
+		"                      the render has no limit.\n"
+		"  --tonemap <op>      how a PNG fits colours brighter than 1 in: clamp\n"
+		"                      (default) clips them, reinhard or aces compress them\n"
+		"  --integrator <name> how light is traced: whitted (default), the ray tracer\n"
+		"                      of the assignment, or path, a path tracer for global\n"
+		"                      illumination. In the window, P switches between them.\n"
+		"  --depth <n>         most bounces per path, up to 16 (default 5)\n"
+		"  --roulette <t>      end paths carrying less light than this early with\n"
+		"                      Russian roulette (default 0.1, 0 never does)\n"
+		"  --light-samples <n> shadow rays per hit; scenes with more lights than\n"
+		"                      this sample that many, picked by power (default 1)\n"
+		"  --sampler <name>    numbers for jittering rays, sampling lights and\n"
+		"                      bouncing: sobol (default), halton, bluenoise or\n"
+		"                      random\n"
+		"  --denoise           smooth the noise out of the image after every pass,\n"
+		"                      for clean images from few samples\n"
+		"  --aovs              when headless, also save the albedo, normal and depth\n"
+		"                      of what each pixel sees next to the image, with\n"
+		"                      .albedo, .normal and .depth before its extension\n"
+		"  --stats             when headless, also save the statistics of each render\n"
+		"                      (rays, Mrays/s, BVH traversal cost, tile times) as\n"
+		"                      JSON next to the image, with .stats.json in place\n"
+		"                      of its extension (render.stats.json for\n"
+		"                      render.png). In the window, S shows or hides them.\n"
+		"  --texture-cache <MB> most memory image textures can take; the least\n"
+		"                      recently used are dropped to stay within it\n"
+		"                      (default 512)\n"
+		"  --simd <set>        SIMD kernels for primary rays: auto (default, the\n"
+		"                      best this CPU supports), AVX-512, AVX2, SSE2 or off\n"
+		"  --help              show this message\n";
+}
+
+// Saves the AOVs of a render next to its image at path, in the same format,
+// with .albedo, .normal and .depth added before the extension. The float
+// formats get the values as they are. For PNG normals are mapped from
+// [-1, 1] to [0, 1], and depths from [0, furthest] to [1, 0] so nearer is
+// brighter. Returns false if any can't be saved.
+bool saveAOVs(RenderAOVs const &aovs, int width, int height, std::string const &path) {
+	bool raw = isFloatImageFile(path);
+	float furthest = 0;
+	for (float depth : aovs.depth) {
+		furthest = std::max(furthest, depth);
+	}
+	std::vector<glm::vec3> normals(aovs.normal.size());
+	std::vector<glm::vec3> depths(aovs.depth.size());
+	for (std::size_t i = 0; i < normals.size(); i++) {
+		if (raw) {
+			normals[i] = aovs.normal[i];
+			depths[i] = glm::vec3(aovs.depth[i]);
+		}
+		else {
+			normals[i] = aovs.normal[i]*0.5f + glm::vec3(0.5f);
+			depths[i] = glm::vec3(aovs.depth[i] > 0 ? 1.f - aovs.depth[i]/furthest : 0.f);
+		}
+	}
+
+	std::filesystem::path file(path);
+	std::string extension = file.extension().string();
+	auto save = [&](std::vector<glm::vec3> const &colours, const char* name) {
+		return writeImage(std::filesystem::path(file).replace_extension(name + extension).string(), width, height, colours.data());
+	};
+	bool saved = save(aovs.albedo, ".albedo");
+	saved &= save(normals, ".normal");
+	saved &= save(depths, ".depth");
+	return saved;
+}
 
-int main() {
+// Renders each scene on the CPU and saves it. Doesn't touch GLFW or OpenGL,
+// so it runs on machines with no GPU or display. Meshes are loaded once and
+// shared by all the scenes that use them. With writeAOVs, the AOVs of each
+// are saved next to it too, and with writeStatistics its statistics as JSON,
+// with .stats.json for extension. Returns 0 if every scene rendered.
+int renderHeadless(std::vector<std::string> const &scenes, int width, int height, RenderTarget const &target,
+		Integrator const &integrator, std::vector<std::string> const &outputPaths, bool writeAOVs, bool writeStatistics) {
+	MeshCache meshes;
+	int failures = 0;
+	for (std::size_t i = 0; i < scenes.size(); i++) {
+		Scene scene;
+		try {
+			scene = Assignment5::loadScene(scenes[i], meshes);
+		}
+		catch (std::runtime_error const &e) {
+			Log::error("Can't load scene: {}", e.what());
+			failures++;
+			continue;
+		}
+
+		ImageBuffer image;
+		image.Initialize(width, height);
+
+		auto start = std::chrono::steady_clock::now();
+		RayStatistics statistics;
+		RenderAOVs aovs;
+		double samples = raytraceImage(scene, integrator, image, scene.camera, target, nullptr, &statistics,
+			writeAOVs ? &aovs : nullptr);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		Log::info("Rendered scene {} at {}x{}, {:.1f} samples per pixel in {:.2f} seconds",
+			scenes[i], width, height, samples, elapsed.count());
+		statistics.log();
+
+		failures += !image.SaveToFile(outputPaths[i], toneMapping);
+		if (writeAOVs) {
+			failures += !saveAOVs(aovs, width, height, outputPaths[i]);
+		}
+		if (writeStatistics) {
+			std::string path = std::filesystem::path(outputPaths[i]).replace_extension(".stats.json").string();
+			std::ofstream out(path);
+			out << statistics.toJSON();
+			out.close();
+			if (!out) {
+				Log::error("Can't write the statistics to {}", path);
+				failures++;
+			}
+		}
+	}
+	return failures == 0 ? 0 : 1;
+}
+
+
+int main(int argc, char* argv[]) {
 	Log::debug("Starting main");
 
+	argh::parser cmdl({ "-s", "--scene", "--width", "--height", "-n", "--samples", "-o", "--output", "--simd", "-t", "--time", "--noise", "--depth", "--roulette", "--light-samples", "--integrator", "--sampler", "--write-cache", "--tonemap", "--texture-cache" });
+	cmdl.parse(argc, argv);
+
+	if (cmdl["--help"]) {
+		printUsage();
+		return 0;
+	}
+
+	// Change your image/screensize here (or with --width and --height).
+	bool headless = cmdl["--headless"];
+	std::string initialScene = cmdl({ "-s", "--scene" }, "1").str();
+	std::vector<std::string> sceneFiles(cmdl.pos_args().begin() + 1, cmdl.pos_args().end());
+	int width, height;
+	RenderTarget target;
+	IntegratorSettings integratorSettings;
+	int textureCacheMB;
+	if (!(cmdl("--width", 800) >> width) || width <= 0
+		|| !(cmdl("--height", 800) >> height) || height <= 0
+		|| !(cmdl({ "-n", "--samples" }, headless ? 1 : 64) >> target.samplesPerPixel) || target.samplesPerPixel < 0
+		|| !(cmdl({ "-t", "--time" }, 0) >> target.seconds) || target.seconds < 0
+		|| !(cmdl("--noise", 0.01f) >> target.noiseThreshold) || target.noiseThreshold < 0
+		|| !(cmdl("--depth", 5) >> integratorSettings.maxDepth) || integratorSettings.maxDepth < 0
+		|| integratorSettings.maxDepth > RayStatistics::MAX_DEPTH
+		|| !(cmdl("--roulette", 0.1f) >> integratorSettings.rouletteThreshold) || integratorSettings.rouletteThreshold < 0
+		|| !(cmdl("--light-samples", 1) >> integratorSettings.lightSamplesPerHit) || integratorSettings.lightSamplesPerHit < 1
+		|| !(cmdl("--texture-cache", 512) >> textureCacheMB) || textureCacheMB < 1
+		// a headless render has to stop by itself
+		|| (headless && target.samplesPerPixel == 0 && target.seconds == 0)
+		// only headless renders take several scenes
+		|| (!headless && !sceneFiles.empty())
+	) {
+		Log::error("Invalid command line arguments");
+		printUsage();
+		return 1;
+	}
+
+	TextureCache::global().setBudget(std::size_t(textureCacheMB) << 20);
+
+	std::string cachePath = cmdl("--write-cache", "").str();
+	if (!cachePath.empty()) {
+		MeshCache meshes;
+		try {
+			saveSceneCache(Assignment5::loadScene(initialScene, meshes), cachePath);
+		}
+		catch (std::runtime_error const &e) {
+			Log::error("Can't write scene cache: {}", e.what());
+			return 1;
+		}
+		Log::info("Saved scene {} to {}", initialScene, cachePath);
+		return 0;
+	}
+
+	std::string simd = cmdl("--simd", "auto").str();
+	if (simd == "off") {
+		primaryRayKernels = nullptr;
+	}
+	else if (simd != "auto") {
+		primaryRayKernels = findPacketKernels(simd.c_str());
+		if (!primaryRayKernels) {
+			Log::error("SIMD kernels '{}' are not available on this CPU", simd);
+			return 1;
+		}
+	}
+	Log::info("Tracing primary rays with {}", primaryRayKernels ? primaryRayKernels->name : "scalar code");
+
+	std::string sequence = cmdl("--sampler", "sobol").str();
+	if (!findSampleSequence(sequence.c_str(), sampleSequence)) {
+		Log::error("There's no sampler called '{}'", sequence);
+		printUsage();
+		return 1;
+	}
+
+	std::string toneMappingName = cmdl("--tonemap", "clamp").str();
+	if (!findToneMapping(toneMappingName.c_str(), toneMapping)) {
+		Log::error("There's no tone mapping called '{}'", toneMappingName);
+		printUsage();
+		return 1;
+	}
+
+	denoiseImage = cmdl["--denoise"];
+	bool writeAOVs = cmdl["--aovs"];
+	bool writeStatistics = cmdl["--stats"];
+
+	std::string integratorName = cmdl("--integrator", "whitted").str();
+	std::shared_ptr<Integrator const> integrator = createIntegrator(integratorName, integratorSettings);
+	if (!integrator) {
+		Log::error("There's no integrator called '{}'", integratorName);
+		printUsage();
+		return 1;
+	}
+
+	std::string outputPath = cmdl({ "-o", "--output" }, headless ? "render.png" : "").str();
+
+	if (headless) {
+		if (sceneFiles.empty()) {
+			return renderHeadless({ initialScene }, width, height, target, *integrator, { outputPath }, writeAOVs, writeStatistics);
+		}
+		std::vector<std::string> outputPaths;
+		for (std::string const &file : sceneFiles) {
+			outputPaths.push_back(std::filesystem::path(file).replace_extension(".png").string());
+		}
+		return renderHeadless(sceneFiles, width, height, target, *integrator, outputPaths, writeAOVs, writeStatistics);
+	}
+
 	// WINDOW
 	glfwInit();
 
-	// Change your image/screensize here.
-	int width = 800;
-	int height = 800;
 	Window window(width, height, "CPSC 453");
 
 	GLDebug::enable();
 
 	// CALLBACKS
-	std::shared_ptr<Assignment5> a5 = std::make_shared<Assignment5>(); // can also update callbacks to new ones
+	std::shared_ptr<Assignment5> a5;
+	try {
+		a5 = std::make_shared<Assignment5>(initialScene, target, integratorName, integratorSettings);
+	}
+	catch (std::runtime_error const &e) {
+		Log::error("Can't load scene: {}", e.what());
+		glfwTerminate();
+		return 1;
+	} // can also update callbacks to new ones
 	window.setCallbacks(a5); // can also update callbacks to new ones
 
 	// RENDER LOOP
 	while (!window.shouldClose() && !a5->shouldQuit) {
 		glfwPollEvents();
+		a5->update();
 
 		glEnable(GL_FRAMEBUFFER_SRGB);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		a5->outputImage.Render();
 
+		ImGui_ImplOpenGL3_NewFrame();
+		ImGui_ImplGlfw_NewFrame();
+		ImGui::NewFrame();
+		a5->drawStatistics();
+		ImGui::Render();
+		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+
 		window.swapBuffers();
 	}
 
 
 	// Save image to file:
-	// outpuImage.SaveToFile("foo.png")
+	if (!outputPath.empty()) {
+		// A render with no sample count or time limit never finishes, so it's
+		// saved as far as it got
+		bool unlimited = a5->renderTarget.samplesPerPixel == 0 && a5->renderTarget.seconds == 0;
+		if (a5->renderJob && !a5->renderJob->isDone()) {
+			Log::info(unlimited ? "Stopping the render to save it" : "Waiting for the render to finish before saving it");
+		}
+		if (unlimited && a5->renderJob) {
+			a5->renderJob->cancel();
+		}
+		a5->finishRender();
+		a5->outputImage.SaveToFile(outputPath, toneMapping);
+	}
+	a5->cancelRender();
 
 	glfwTerminate();
 	return 0;